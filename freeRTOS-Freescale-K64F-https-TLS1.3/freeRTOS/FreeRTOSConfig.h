@@ -85,7 +85,12 @@ extern uint32_t SystemCoreClock;
  *----------------------------------------------------------*/
 
 #define configUSE_PREEMPTION                    1
+#ifdef K64F_TICKLESS
+/* Stop the tick while all the tasks are blocked (TICKLESS=1) */
+#define configUSE_TICKLESS_IDLE                 1
+#else
 #define configUSE_TICKLESS_IDLE                 0
+#endif
 #define configCPU_CLOCK_HZ                      (SystemCoreClock)
 #define configTICK_RATE_HZ                      ((TickType_t)1000)
 #define configMAX_PRIORITIES                    5
@@ -107,7 +112,12 @@ extern uint32_t SystemCoreClock;
 #define configUSE_APPLICATION_TASK_TAG          0
 
 /* Memory allocation related definitions. */
+#ifdef K64F_STATIC_ALLOC
+/* Task stacks and kernel objects in .bss (STATIC_ALLOC=1) */
+#define configSUPPORT_STATIC_ALLOCATION         1
+#else
 #define configSUPPORT_STATIC_ALLOCATION         0
+#endif
 #define configSUPPORT_DYNAMIC_ALLOCATION        1
 #define configTOTAL_HEAP_SIZE                   ((size_t)(10240))
 #define configAPPLICATION_ALLOCATED_HEAP        0
@@ -147,7 +157,7 @@ extern uint32_t SystemCoreClock;
 #define INCLUDE_vTaskDelay                      1
 #define INCLUDE_xTaskGetSchedulerState          1
 #define INCLUDE_xTaskGetCurrentTaskHandle       1
-#define INCLUDE_uxTaskGetStackHighWaterMark     0
+#define INCLUDE_uxTaskGetStackHighWaterMark     1
 #define INCLUDE_xTaskGetIdleTaskHandle          0
 #define INCLUDE_eTaskGetState                   0
 #define INCLUDE_xEventGroupSetBitFromISR        1
@@ -186,6 +196,21 @@ standard names. */
 #define xPortPendSVHandler PendSV_Handler
 #define xPortSysTickHandler SysTick_Handler
 
+/* Wake-up counters, reported in /status.json (see main.c): tick
+interrupts, and switches from the idle task to a task that was woken up. */
+extern volatile uint32_t rtos_tick_irqs;
+extern volatile uint32_t rtos_idle_exits;
+#define traceTASK_INCREMENT_TICK(xTickCount) rtos_tick_irqs++
+#define traceTASK_SWITCHED_OUT() do { if (pxCurrentTCB == xIdleTaskHandle) rtos_idle_exits++; } while (0)
+
+#ifdef K64F_HEAP_TRACE
+/* Allocation trace ring (HEAP_TRACE=n), see src/heap_trace.c. Expanded
+inside pvPortMalloc() and vPortFree(): the return address is their caller. */
+void heap_trace_record(int op, void *addr, size_t size, void *caller);
+#define traceMALLOC(pvAddress, uiSize) heap_trace_record('m', (pvAddress), (uiSize), __builtin_return_address(0))
+#define traceFREE(pvAddress, uiSize) heap_trace_record('f', (pvAddress), (uiSize), __builtin_return_address(0))
+#endif
+
 /* Tasks.c additions (e.g. Thread Aware Debug capability) */
 #define configINCLUDE_FREERTOS_TASK_C_ADDITIONS_H 1
 
@@ -130,6 +130,41 @@ typedef struct HeapRegion
  */
 void vPortDefineHeapRegions( const HeapRegion_t * const pxHeapRegions ) PRIVILEGED_FUNCTION;
 
+/* Used to pass information about the heap out of vPortGetHeapStats()
+(backported from FreeRTOS V10.2.1, heap_4, heap_5 and heap_6 only). */
+typedef struct xHeapStats
+{
+	size_t xAvailableHeapSpaceInBytes;		/* The total heap size currently available - this is the sum of all the free blocks, not the largest block that can be allocated. */
+	size_t xSizeOfLargestFreeBlockInBytes; 	/* The maximum size, in bytes, of all the free blocks within the heap at the time vPortGetHeapStats() is called. */
+	size_t xSizeOfSmallestFreeBlockInBytes; /* The minimum size, in bytes, of all the free blocks within the heap at the time vPortGetHeapStats() is called. */
+	size_t xNumberOfFreeBlocks;				/* The number of free memory blocks within the heap at the time vPortGetHeapStats() is called. */
+	size_t xMinimumEverFreeBytesRemaining;	/* The minimum amount of total free memory (sum of all free blocks) there has been in the heap since the system booted. */
+	size_t xNumberOfSuccessfulAllocations;	/* The number of calls to pvPortMalloc() that have returned a valid memory block. */
+	size_t xNumberOfSuccessfulFrees;		/* The number of calls to vPortFree() that has successfully freed a block of memory. */
+} HeapStats_t;
+
+/*
+ * Returns a HeapStats_t structure filled with information about the current
+ * heap state.
+ */
+void vPortGetHeapStats( HeapStats_t *pxHeapStats );
+
+/* Used to pass information about each size class out of
+uxPortGetSizeClassStats() (heap_6 only). */
+typedef struct xSizeClassStats
+{
+	size_t xBlockSize;		/* The usable size of the blocks of the class. */
+	size_t xFreeBlocks;		/* The number of freed blocks kept in the free list of the class. */
+	size_t xHits;			/* The number of allocations served from the free list of the class. */
+	size_t xMisses;			/* The number of allocations that had to take a new block from the heap. */
+} SizeClassStats_t;
+
+/*
+ * Fills pxStats with the statistics of up to uxMaxClasses size classes,
+ * smallest first, and returns the number of entries written.
+ */
+UBaseType_t uxPortGetSizeClassStats( SizeClassStats_t *pxStats, UBaseType_t uxMaxClasses );
+
 
 /*
  * Map to the memory management routines required for the port.
@@ -0,0 +1,692 @@
+/*
+ * FreeRTOS Kernel V10.2.0
+ * Copyright (C) 2019 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * http://www.FreeRTOS.org
+ * http://aws.amazon.com/freertos
+ *
+ * 1 tab == 4 spaces!
+ */
+
+/*
+ * A variant of heap_5.c with segregated size classes in front of the heap_5
+ * free list.
+ *
+ * heap_5 walks its address ordered free list on every pvPortMalloc(), which
+ * takes a time proportional to the number of free blocks.  heap_6 keeps a
+ * separate LIFO free list for each power of two size class, from
+ * heapMIN_CLASS_SIZE to heapMAX_CLASS_SIZE bytes:
+ *
+ * - A small request is rounded up to its size class, and served from the
+ *   free list of the class in constant time.  When the list is empty a new
+ *   block of the class size is taken from the heap_5 free list.
+ * - A freed small block goes back to the free list of its class in constant
+ *   time, without being merged with its neighbours.
+ * - Requests larger than heapMAX_CLASS_SIZE are handled exactly as in heap_5.
+ * - If the heap cannot satisfy a request, the blocks kept in the size class
+ *   free lists are given back to the heap, where they are merged with their
+ *   neighbours, and the request is tried again.
+ *
+ * The number of size classes is set with configHEAP6_SIZE_CLASSES (default 6:
+ * 16 to 512 bytes).  The API is the same as heap_5: vPortDefineHeapRegions()
+ * ***must*** be called before pvPortMalloc(), see heap_5.c.  The blocks kept
+ * in the size class free lists are included in xPortGetFreeHeapSize(); their
+ * state is returned by uxPortGetSizeClassStats().
+ */
+#include <stdlib.h>
+
+/* Defining MPU_WRAPPERS_INCLUDED_FROM_API_FILE prevents task.h from redefining
+all the API functions to use the MPU wrappers.  That should only be done when
+task.h is included from an application file. */
+#define MPU_WRAPPERS_INCLUDED_FROM_API_FILE
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#undef MPU_WRAPPERS_INCLUDED_FROM_API_FILE
+
+#if( configSUPPORT_DYNAMIC_ALLOCATION == 0 )
+	#error This file must not be used if configSUPPORT_DYNAMIC_ALLOCATION is 0
+#endif
+
+/* Block sizes must not get too small. */
+#define heapMINIMUM_BLOCK_SIZE	( ( size_t ) ( xHeapStructSize << 1 ) )
+
+/* Assumes 8bit bytes! */
+#define heapBITS_PER_BYTE		( ( size_t ) 8 )
+
+/* Size classes: heapMIN_CLASS_SIZE, twice that, and so on. */
+#ifndef configHEAP6_SIZE_CLASSES
+	#define configHEAP6_SIZE_CLASSES	6
+#endif
+#define heapNUM_SIZE_CLASSES	( ( UBaseType_t ) configHEAP6_SIZE_CLASSES )
+#define heapMIN_CLASS_SIZE		( ( size_t ) 16 )
+#define heapCLASS_SIZE( x )		( heapMIN_CLASS_SIZE << ( x ) )
+#define heapMAX_CLASS_SIZE		heapCLASS_SIZE( heapNUM_SIZE_CLASSES - 1 )
+
+/* Define the linked list structure.  This is used to link free blocks in order
+of their memory address, and the blocks kept in a size class free list. */
+typedef struct A_BLOCK_LINK
+{
+	struct A_BLOCK_LINK *pxNextFreeBlock;	/*<< The next free block in the list. */
+	size_t xBlockSize;						/*<< The size of the free block. */
+} BlockLink_t;
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Inserts a block of memory that is being freed into the correct position in
+ * the list of free memory blocks.  The block being freed will be merged with
+ * the block in front it and/or the block behind it if the memory blocks are
+ * adjacent to each other.
+ */
+static void prvInsertBlockIntoFreeList( BlockLink_t *pxBlockToInsert );
+
+/*
+ * Takes a block of xWantedSize bytes (including the BlockLink_t structure)
+ * from the list of free memory blocks, or returns NULL.
+ */
+static BlockLink_t *prvTakeBlockFromFreeList( size_t xWantedSize );
+
+/*
+ * Returns all the blocks kept in the size class free lists to the list of
+ * free memory blocks.
+ */
+static void prvReleaseClassBlocks( void );
+
+/*-----------------------------------------------------------*/
+
+/* The size of the structure placed at the beginning of each allocated memory
+block must by correctly byte aligned. */
+static const size_t xHeapStructSize	= ( sizeof( BlockLink_t ) + ( ( size_t ) ( portBYTE_ALIGNMENT - 1 ) ) ) & ~( ( size_t ) portBYTE_ALIGNMENT_MASK );
+
+/* Create a couple of list links to mark the start and end of the list. */
+static BlockLink_t xStart, *pxEnd = NULL;
+
+/* Heads of the size class free lists.  The lists end with xClassListEnd, so
+that a block kept in a size class free list never has a NULL pxNextFreeBlock,
+which vPortFree() uses to detect double frees. */
+static BlockLink_t xClassListEnd;
+static BlockLink_t *pxClassFreeList[ heapNUM_SIZE_CLASSES ];
+static SizeClassStats_t xClassStats[ heapNUM_SIZE_CLASSES ];
+
+/* Keeps track of the number of free bytes remaining, but says nothing about
+fragmentation.  xCachedBytes is the part of it kept in the size class free
+lists. */
+static size_t xFreeBytesRemaining = 0U;
+static size_t xMinimumEverFreeBytesRemaining = 0U;
+static size_t xCachedBytes = 0U;
+static size_t xNumberOfSuccessfulAllocations = 0;
+static size_t xNumberOfSuccessfulFrees = 0;
+
+/* Gets set to the top bit of an size_t type.  When this bit in the xBlockSize
+member of an BlockLink_t structure is set then the block belongs to the
+application, or is kept in a size class free list.  When the bit is free the
+block is part of the list of free memory blocks. */
+static size_t xBlockAllocatedBit = 0;
+
+/*-----------------------------------------------------------*/
+
+void *pvPortMalloc( size_t xWantedSize )
+{
+BlockLink_t *pxBlock = NULL;
+UBaseType_t xClass;
+void *pvReturn = NULL;
+
+	/* The heap must be initialised before the first call to
+	prvPortMalloc(). */
+	configASSERT( pxEnd );
+
+	vTaskSuspendAll();
+	{
+		/* Check the requested block size is not so large that the top bit is
+		set.  The top bit of the block size member of the BlockLink_t structure
+		is used to determine who owns the block - the application or the
+		kernel, so it must be free. */
+		if( ( xWantedSize > 0 ) && ( ( xWantedSize & xBlockAllocatedBit ) == 0 ) )
+		{
+			if( xWantedSize <= heapMAX_CLASS_SIZE )
+			{
+				/* Smallest size class that fits. */
+				for( xClass = 0; heapCLASS_SIZE( xClass ) < xWantedSize; xClass++ )
+				{
+				}
+
+				if( pxClassFreeList[ xClass ] != &xClassListEnd )
+				{
+					pxBlock = pxClassFreeList[ xClass ];
+					pxClassFreeList[ xClass ] = pxBlock->pxNextFreeBlock;
+					pxBlock->pxNextFreeBlock = NULL;
+					xCachedBytes -= pxBlock->xBlockSize & ~xBlockAllocatedBit;
+					xFreeBytesRemaining -= pxBlock->xBlockSize & ~xBlockAllocatedBit;
+					xClassStats[ xClass ].xFreeBlocks--;
+					xClassStats[ xClass ].xHits++;
+				}
+				else
+				{
+					/* Take a block of the full class size, so that it can
+					serve any request of the class once freed. */
+					xWantedSize = heapCLASS_SIZE( xClass );
+					xClassStats[ xClass ].xMisses++;
+				}
+			}
+			else
+			{
+				mtCOVERAGE_TEST_MARKER();
+			}
+
+			if( pxBlock == NULL )
+			{
+				/* The wanted size is increased so it can contain a BlockLink_t
+				structure in addition to the requested amount of bytes. */
+				xWantedSize += xHeapStructSize;
+
+				/* Ensure that blocks are always aligned to the required number
+				of bytes. */
+				if( ( xWantedSize & portBYTE_ALIGNMENT_MASK ) != 0x00 )
+				{
+					/* Byte alignment required. */
+					xWantedSize += ( portBYTE_ALIGNMENT - ( xWantedSize & portBYTE_ALIGNMENT_MASK ) );
+				}
+				else
+				{
+					mtCOVERAGE_TEST_MARKER();
+				}
+
+				pxBlock = prvTakeBlockFromFreeList( xWantedSize );
+
+				if( ( pxBlock == NULL ) && ( xCachedBytes > 0 ) )
+				{
+					/* Give the size class free lists back to the heap, which
+					merges them with their neighbours, and try again. */
+					prvReleaseClassBlocks();
+					pxBlock = prvTakeBlockFromFreeList( xWantedSize );
+				}
+				else
+				{
+					mtCOVERAGE_TEST_MARKER();
+				}
+			}
+			else
+			{
+				mtCOVERAGE_TEST_MARKER();
+			}
+
+			if( pxBlock != NULL )
+			{
+				/* Return the memory space pointed to - jumping over the
+				BlockLink_t structure at its start. */
+				pvReturn = ( void * ) ( ( ( uint8_t * ) pxBlock ) + xHeapStructSize );
+
+				if( xFreeBytesRemaining < xMinimumEverFreeBytesRemaining )
+				{
+					xMinimumEverFreeBytesRemaining = xFreeBytesRemaining;
+				}
+				else
+				{
+					mtCOVERAGE_TEST_MARKER();
+				}
+
+				xNumberOfSuccessfulAllocations++;
+			}
+			else
+			{
+				mtCOVERAGE_TEST_MARKER();
+			}
+		}
+		else
+		{
+			mtCOVERAGE_TEST_MARKER();
+		}
+
+		/* As in heap_5, the size traced includes the BlockLink_t header. */
+		traceMALLOC( pvReturn, ( pxBlock != NULL ) ? ( pxBlock->xBlockSize & ~xBlockAllocatedBit ) : xWantedSize );
+	}
+	( void ) xTaskResumeAll();
+
+	#if( configUSE_MALLOC_FAILED_HOOK == 1 )
+	{
+		if( pvReturn == NULL )
+		{
+			extern void vApplicationMallocFailedHook( void );
+			vApplicationMallocFailedHook();
+		}
+		else
+		{
+			mtCOVERAGE_TEST_MARKER();
+		}
+	}
+	#endif
+
+	return pvReturn;
+}
+/*-----------------------------------------------------------*/
+
+void vPortFree( void *pv )
+{
+uint8_t *puc = ( uint8_t * ) pv;
+BlockLink_t *pxLink;
+size_t xBlockSize;
+UBaseType_t xClass;
+
+	if( pv != NULL )
+	{
+		/* The memory being freed will have an BlockLink_t structure immediately
+		before it. */
+		puc -= xHeapStructSize;
+
+		/* This casting is to keep the compiler from issuing warnings. */
+		pxLink = ( void * ) puc;
+
+		/* Check the block is actually allocated. */
+		configASSERT( ( pxLink->xBlockSize & xBlockAllocatedBit ) != 0 );
+		configASSERT( pxLink->pxNextFreeBlock == NULL );
+
+		if( ( pxLink->xBlockSize & xBlockAllocatedBit ) != 0 )
+		{
+			if( pxLink->pxNextFreeBlock == NULL )
+			{
+				xBlockSize = pxLink->xBlockSize & ~xBlockAllocatedBit;
+
+				vTaskSuspendAll();
+				{
+					xFreeBytesRemaining += xBlockSize;
+					traceFREE( pv, xBlockSize );
+
+					if( ( ( xBlockSize - xHeapStructSize ) >= heapMIN_CLASS_SIZE ) && ( ( xBlockSize - xHeapStructSize ) <= heapMAX_CLASS_SIZE ) )
+					{
+						/* Largest size class the block can serve.  It stays
+						marked as allocated while in the free list. */
+						for( xClass = heapNUM_SIZE_CLASSES - 1; heapCLASS_SIZE( xClass ) > ( xBlockSize - xHeapStructSize ); xClass-- )
+						{
+						}
+
+						pxLink->pxNextFreeBlock = pxClassFreeList[ xClass ];
+						pxClassFreeList[ xClass ] = pxLink;
+						xCachedBytes += xBlockSize;
+						xClassStats[ xClass ].xFreeBlocks++;
+					}
+					else
+					{
+						/* The block is being returned to the heap - it is no
+						longer allocated. */
+						pxLink->xBlockSize = xBlockSize;
+						prvInsertBlockIntoFreeList( pxLink );
+					}
+
+					xNumberOfSuccessfulFrees++;
+				}
+				( void ) xTaskResumeAll();
+			}
+			else
+			{
+				mtCOVERAGE_TEST_MARKER();
+			}
+		}
+		else
+		{
+			mtCOVERAGE_TEST_MARKER();
+		}
+	}
+}
+/*-----------------------------------------------------------*/
+
+size_t xPortGetFreeHeapSize( void )
+{
+	return xFreeBytesRemaining;
+}
+/*-----------------------------------------------------------*/
+
+size_t xPortGetMinimumEverFreeHeapSize( void )
+{
+	return xMinimumEverFreeBytesRemaining;
+}
+/*-----------------------------------------------------------*/
+
+void vPortGetHeapStats( HeapStats_t *pxHeapStats )
+{
+BlockLink_t *pxBlock;
+size_t xBlocks = 0, xMaxSize = 0, xMinSize = portMAX_DELAY; /* portMAX_DELAY used as a portable way of getting the maximum value. */
+
+	vTaskSuspendAll();
+	{
+		pxBlock = xStart.pxNextFreeBlock;
+
+		/* pxBlock will be NULL if the heap has not been initialised.  Only the
+		list of free memory blocks is walked: the blocks kept in the size
+		class free lists are reported by uxPortGetSizeClassStats(). */
+		if( pxBlock != NULL )
+		{
+			do
+			{
+				/* Increment the number of blocks and record the largest block seen
+				so far. */
+				xBlocks++;
+
+				if( pxBlock->xBlockSize > xMaxSize )
+				{
+					xMaxSize = pxBlock->xBlockSize;
+				}
+
+				/* There is a zero sized block at the end of each heap region -
+				the block is only used to link to the next heap region so it not
+				included in the minimum size calculation. */
+				if( pxBlock->xBlockSize != 0 )
+				{
+					if( pxBlock->xBlockSize < xMinSize )
+					{
+						xMinSize = pxBlock->xBlockSize;
+					}
+				}
+
+				/* Move to the next block in the chain until the last block is
+				reached. */
+				pxBlock = pxBlock->pxNextFreeBlock;
+			} while( pxBlock != pxEnd );
+		}
+	}
+	xTaskResumeAll();
+
+	pxHeapStats->xSizeOfLargestFreeBlockInBytes = xMaxSize;
+	pxHeapStats->xSizeOfSmallestFreeBlockInBytes = xMinSize;
+	pxHeapStats->xNumberOfFreeBlocks = xBlocks;
+
+	taskENTER_CRITICAL();
+	{
+		pxHeapStats->xAvailableHeapSpaceInBytes = xFreeBytesRemaining;
+		pxHeapStats->xNumberOfSuccessfulAllocations = xNumberOfSuccessfulAllocations;
+		pxHeapStats->xNumberOfSuccessfulFrees = xNumberOfSuccessfulFrees;
+		pxHeapStats->xMinimumEverFreeBytesRemaining = xMinimumEverFreeBytesRemaining;
+	}
+	taskEXIT_CRITICAL();
+}
+/*-----------------------------------------------------------*/
+
+UBaseType_t uxPortGetSizeClassStats( SizeClassStats_t *pxStats, UBaseType_t uxMaxClasses )
+{
+UBaseType_t xClass;
+
+	if( uxMaxClasses > heapNUM_SIZE_CLASSES )
+	{
+		uxMaxClasses = heapNUM_SIZE_CLASSES;
+	}
+
+	vTaskSuspendAll();
+	{
+		for( xClass = 0; xClass < uxMaxClasses; xClass++ )
+		{
+			pxStats[ xClass ] = xClassStats[ xClass ];
+			pxStats[ xClass ].xBlockSize = heapCLASS_SIZE( xClass );
+		}
+	}
+	( void ) xTaskResumeAll();
+
+	return uxMaxClasses;
+}
+/*-----------------------------------------------------------*/
+
+static BlockLink_t *prvTakeBlockFromFreeList( size_t xWantedSize )
+{
+BlockLink_t *pxBlock, *pxPreviousBlock, *pxNewBlockLink;
+
+	if( xWantedSize > ( xFreeBytesRemaining - xCachedBytes ) )
+	{
+		return NULL;
+	}
+
+	/* Traverse the list from the start	(lowest address) block until
+	one	of adequate size is found. */
+	pxPreviousBlock = &xStart;
+	pxBlock = xStart.pxNextFreeBlock;
+	while( ( pxBlock->xBlockSize < xWantedSize ) && ( pxBlock->pxNextFreeBlock != NULL ) )
+	{
+		pxPreviousBlock = pxBlock;
+		pxBlock = pxBlock->pxNextFreeBlock;
+	}
+
+	/* If the end marker was reached then a block of adequate size
+	was	not found. */
+	if( pxBlock == pxEnd )
+	{
+		return NULL;
+	}
+
+	/* This block is being returned for use so must be taken out
+	of the list of free blocks. */
+	pxPreviousBlock->pxNextFreeBlock = pxBlock->pxNextFreeBlock;
+
+	/* If the block is larger than required it can be split into
+	two. */
+	if( ( pxBlock->xBlockSize - xWantedSize ) > heapMINIMUM_BLOCK_SIZE )
+	{
+		/* This block is to be split into two.  Create a new
+		block following the number of bytes requested. The void
+		cast is used to prevent byte alignment warnings from the
+		compiler. */
+		pxNewBlockLink = ( void * ) ( ( ( uint8_t * ) pxBlock ) + xWantedSize );
+
+		/* Calculate the sizes of two blocks split from the
+		single block. */
+		pxNewBlockLink->xBlockSize = pxBlock->xBlockSize - xWantedSize;
+		pxBlock->xBlockSize = xWantedSize;
+
+		/* Insert the new block into the list of free blocks. */
+		prvInsertBlockIntoFreeList( ( pxNewBlockLink ) );
+	}
+	else
+	{
+		mtCOVERAGE_TEST_MARKER();
+	}
+
+	xFreeBytesRemaining -= pxBlock->xBlockSize;
+
+	/* The block is being returned - it is allocated and owned
+	by the application and has no "next" block. */
+	pxBlock->xBlockSize |= xBlockAllocatedBit;
+	pxBlock->pxNextFreeBlock = NULL;
+
+	return pxBlock;
+}
+/*-----------------------------------------------------------*/
+
+static void prvReleaseClassBlocks( void )
+{
+BlockLink_t *pxBlock;
+UBaseType_t xClass;
+
+	for( xClass = 0; xClass < heapNUM_SIZE_CLASSES; xClass++ )
+	{
+		while( pxClassFreeList[ xClass ] != &xClassListEnd )
+		{
+			pxBlock = pxClassFreeList[ xClass ];
+			pxClassFreeList[ xClass ] = pxBlock->pxNextFreeBlock;
+			pxBlock->xBlockSize &= ~xBlockAllocatedBit;
+			prvInsertBlockIntoFreeList( pxBlock );
+		}
+
+		xClassStats[ xClass ].xFreeBlocks = 0;
+	}
+
+	xCachedBytes = 0U;
+}
+/*-----------------------------------------------------------*/
+
+static void prvInsertBlockIntoFreeList( BlockLink_t *pxBlockToInsert )
+{
+BlockLink_t *pxIterator;
+uint8_t *puc;
+
+	/* Iterate through the list until a block is found that has a higher address
+	than the block being inserted. */
+	for( pxIterator = &xStart; pxIterator->pxNextFreeBlock < pxBlockToInsert; pxIterator = pxIterator->pxNextFreeBlock )
+	{
+		/* Nothing to do here, just iterate to the right position. */
+	}
+
+	/* Do the block being inserted, and the block it is being inserted after
+	make a contiguous block of memory? */
+	puc = ( uint8_t * ) pxIterator;
+	if( ( puc + pxIterator->xBlockSize ) == ( uint8_t * ) pxBlockToInsert )
+	{
+		pxIterator->xBlockSize += pxBlockToInsert->xBlockSize;
+		pxBlockToInsert = pxIterator;
+	}
+	else
+	{
+		mtCOVERAGE_TEST_MARKER();
+	}
+
+	/* Do the block being inserted, and the block it is being inserted before
+	make a contiguous block of memory? */
+	puc = ( uint8_t * ) pxBlockToInsert;
+	if( ( puc + pxBlockToInsert->xBlockSize ) == ( uint8_t * ) pxIterator->pxNextFreeBlock )
+	{
+		if( pxIterator->pxNextFreeBlock != pxEnd )
+		{
+			/* Form one big block from the two blocks. */
+			pxBlockToInsert->xBlockSize += pxIterator->pxNextFreeBlock->xBlockSize;
+			pxBlockToInsert->pxNextFreeBlock = pxIterator->pxNextFreeBlock->pxNextFreeBlock;
+		}
+		else
+		{
+			pxBlockToInsert->pxNextFreeBlock = pxEnd;
+		}
+	}
+	else
+	{
+		pxBlockToInsert->pxNextFreeBlock = pxIterator->pxNextFreeBlock;
+	}
+
+	/* If the block being inserted plugged a gab, so was merged with the block
+	before and the block after, then it's pxNextFreeBlock pointer will have
+	already been set, and should not be set here as that would make it point
+	to itself. */
+	if( pxIterator != pxBlockToInsert )
+	{
+		pxIterator->pxNextFreeBlock = pxBlockToInsert;
+	}
+	else
+	{
+		mtCOVERAGE_TEST_MARKER();
+	}
+}
+/*-----------------------------------------------------------*/
+
+void vPortDefineHeapRegions( const HeapRegion_t * const pxHeapRegions )
+{
+BlockLink_t *pxFirstFreeBlockInRegion = NULL, *pxPreviousFreeBlock;
+size_t xAlignedHeap;
+size_t xTotalRegionSize, xTotalHeapSize = 0;
+BaseType_t xDefinedRegions = 0;
+size_t xAddress;
+const HeapRegion_t *pxHeapRegion;
+UBaseType_t xClass;
+
+	/* Can only call once! */
+	configASSERT( pxEnd == NULL );
+
+	pxHeapRegion = &( pxHeapRegions[ xDefinedRegions ] );
+
+	while( pxHeapRegion->xSizeInBytes > 0 )
+	{
+		xTotalRegionSize = pxHeapRegion->xSizeInBytes;
+
+		/* Ensure the heap region starts on a correctly aligned boundary. */
+		xAddress = ( size_t ) pxHeapRegion->pucStartAddress;
+		if( ( xAddress & portBYTE_ALIGNMENT_MASK ) != 0 )
+		{
+			xAddress += ( portBYTE_ALIGNMENT - 1 );
+			xAddress &= ~portBYTE_ALIGNMENT_MASK;
+
+			/* Adjust the size for the bytes lost to alignment. */
+			xTotalRegionSize -= xAddress - ( size_t ) pxHeapRegion->pucStartAddress;
+		}
+
+		xAlignedHeap = xAddress;
+
+		/* Set xStart if it has not already been set. */
+		if( xDefinedRegions == 0 )
+		{
+			/* xStart is used to hold a pointer to the first item in the list of
+			free blocks.  The void cast is used to prevent compiler warnings. */
+			xStart.pxNextFreeBlock = ( BlockLink_t * ) xAlignedHeap;
+			xStart.xBlockSize = ( size_t ) 0;
+		}
+		else
+		{
+			/* Should only get here if one region has already been added to the
+			heap. */
+			configASSERT( pxEnd != NULL );
+
+			/* Check blocks are passed in with increasing start addresses. */
+			configASSERT( xAddress > ( size_t ) pxEnd );
+		}
+
+		/* Remember the location of the end marker in the previous region, if
+		any. */
+		pxPreviousFreeBlock = pxEnd;
+
+		/* pxEnd is used to mark the end of the list of free blocks and is
+		inserted at the end of the region space. */
+		xAddress = xAlignedHeap + xTotalRegionSize;
+		xAddress -= xHeapStructSize;
+		xAddress &= ~portBYTE_ALIGNMENT_MASK;
+		pxEnd = ( BlockLink_t * ) xAddress;
+		pxEnd->xBlockSize = 0;
+		pxEnd->pxNextFreeBlock = NULL;
+
+		/* To start with there is a single free block in this region that is
+		sized to take up the entire heap region minus the space taken by the
+		free block structure. */
+		pxFirstFreeBlockInRegion = ( BlockLink_t * ) xAlignedHeap;
+		pxFirstFreeBlockInRegion->xBlockSize = xAddress - ( size_t ) pxFirstFreeBlockInRegion;
+		pxFirstFreeBlockInRegion->pxNextFreeBlock = pxEnd;
+
+		/* If this is not the first region that makes up the entire heap space
+		then link the previous region to this region. */
+		if( pxPreviousFreeBlock != NULL )
+		{
+			pxPreviousFreeBlock->pxNextFreeBlock = pxFirstFreeBlockInRegion;
+		}
+
+		xTotalHeapSize += pxFirstFreeBlockInRegion->xBlockSize;
+
+		/* Move onto the next HeapRegion_t structure. */
+		xDefinedRegions++;
+		pxHeapRegion = &( pxHeapRegions[ xDefinedRegions ] );
+	}
+
+	xMinimumEverFreeBytesRemaining = xTotalHeapSize;
+	xFreeBytesRemaining = xTotalHeapSize;
+	xCachedBytes = 0U;
+
+	/* Check something was actually defined before it is accessed. */
+	configASSERT( xTotalHeapSize );
+
+	/* Work out the position of the top bit in a size_t variable. */
+	xBlockAllocatedBit = ( ( size_t ) 1 ) << ( ( sizeof( size_t ) * heapBITS_PER_BYTE ) - 1 );
+
+	/* All the size classes start empty. */
+	for( xClass = 0; xClass < heapNUM_SIZE_CLASSES; xClass++ )
+	{
+		pxClassFreeList[ xClass ] = &xClassListEnd;
+	}
+}
+
@@ -0,0 +1,426 @@
+/* heap_bench.c
+ *
+ * Host benchmark of the FreeRTOS heap implementations (heap_4, heap_5,
+ * heap_6), replaying allocation traces.
+ *
+ * A trace is a text file with one operation per line, as served by
+ * /heap-trace on a HEAP_TRACE=n build:
+ *
+ *   m <address> <size> [<caller> <ms>]     allocation of <size> bytes
+ *   f <address> [<size> <caller> <ms>]     free of <address>
+ *
+ * Lines starting with '#' are ignored, and so are allocations that failed
+ * on the target (address 0) and frees of blocks allocated before the trace
+ * started. Addresses only identify the blocks: each trace is replayed
+ * against every heap, with the same regions as the K64F examples.
+ *
+ * A first replay samples vPortGetHeapStats() after every operation: peak
+ * heap usage, smallest "largest free block" (the biggest allocation that
+ * would have succeeded at any time) and worst fragmentation (share of the
+ * free heap outside the largest free block). The trace is then replayed
+ * 'runs' times to measure the average time per operation.
+ *
+ * Copyright (C) 2019 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "FreeRTOS.h"
+
+/* Same layout as the K64F heap_5 regions: 16KB in SRAM_LOWER, 128KB in
+ * SRAM_UPPER */
+#define REGION_LOWER    (16 * 1024)
+#define REGION_UPPER    (128 * 1024)
+#define REGION_GAP      64
+
+#define MAX_OPS         (1 << 20)
+#define MAX_LIVE        4096
+
+/* heap_N.c, built with the heapN_ prefix (see host/heap_rename.h) */
+#define HEAP_API(n) \
+    void *heap##n##_pvPortMalloc(size_t); \
+    void heap##n##_vPortFree(void *); \
+    size_t heap##n##_xPortGetFreeHeapSize(void); \
+    void heap##n##_vPortGetHeapStats(HeapStats_t *);
+HEAP_API(4)
+HEAP_API(5)
+HEAP_API(6)
+void heap5_vPortDefineHeapRegions(const HeapRegion_t * const);
+void heap6_vPortDefineHeapRegions(const HeapRegion_t * const);
+
+/* Single threaded: nothing to lock */
+void vTaskSuspendAll(void)
+{
+}
+
+BaseType_t xTaskResumeAll(void)
+{
+    return pdFALSE;
+}
+
+struct heap {
+    const char *name;
+    void *(*alloc)(size_t);
+    void (*free)(void *);
+    size_t (*free_size)(void);
+    void (*stats)(HeapStats_t *);
+    void (*define_regions)(const HeapRegion_t * const);
+};
+
+static const struct heap heaps[] = {
+    { "heap_4", heap4_pvPortMalloc, heap4_vPortFree, heap4_xPortGetFreeHeapSize,
+        heap4_vPortGetHeapStats, NULL },
+    { "heap_5", heap5_pvPortMalloc, heap5_vPortFree, heap5_xPortGetFreeHeapSize,
+        heap5_vPortGetHeapStats, heap5_vPortDefineHeapRegions },
+    { "heap_6", heap6_pvPortMalloc, heap6_vPortFree, heap6_xPortGetFreeHeapSize,
+        heap6_vPortGetHeapStats, heap6_vPortDefineHeapRegions },
+};
+#define N_HEAPS ((int)(sizeof(heaps) / sizeof(heaps[0])))
+
+static uint8_t region_mem[N_HEAPS][REGION_LOWER + REGION_GAP + REGION_UPPER]
+    __attribute__((aligned(8)));
+
+struct op {
+    uint8_t type;       /* 'm' or 'f' */
+    uint16_t slot;      /* Live block, see load_trace() */
+    uint32_t size;
+    uint32_t caller;    /* 0 if not in the trace */
+};
+
+static struct op ops[MAX_OPS];
+static int n_ops, n_alloc, n_free, n_failed;
+static void *live[MAX_LIVE];
+
+/* Recorded address and size of the block held in each slot, while it is
+ * live */
+static unsigned long slot_addr[MAX_LIVE];
+static uint32_t slot_size[MAX_LIVE];
+static uint8_t slot_used[MAX_LIVE];
+static size_t peak_live;
+
+static int slot_find(unsigned long addr)
+{
+    int i;
+    for (i = 0; i < MAX_LIVE; i++) {
+        if (slot_used[i] && slot_addr[i] == addr)
+            return i;
+    }
+    return -1;
+}
+
+static int load_trace(const char *path)
+{
+    char line[256];
+    unsigned long addr, size, caller;
+    int slot, lineno = 0, unknown = 0;
+    size_t live_bytes = 0;
+    FILE *f = fopen(path, "r");
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    memset(slot_used, 0, sizeof(slot_used));
+    n_ops = n_alloc = n_free = n_failed = 0;
+    peak_live = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        if (n_ops == MAX_OPS) {
+            fprintf(stderr, "%s: more than %d operations\n", path, MAX_OPS);
+            break;
+        }
+        caller = 0;
+        if (sscanf(line, "m %lx %lu %lx", &addr, &size, &caller) >= 2) {
+            if (addr == 0) {
+                /* Failed on the target */
+                n_failed++;
+                continue;
+            }
+            for (slot = 0; slot < MAX_LIVE && slot_used[slot]; slot++)
+                ;
+            if (slot == MAX_LIVE) {
+                fprintf(stderr, "%s:%d: more than %d live blocks\n", path,
+                        lineno, MAX_LIVE);
+                fclose(f);
+                return -1;
+            }
+            slot_used[slot] = 1;
+            slot_addr[slot] = addr;
+            slot_size[slot] = size;
+            live_bytes += size;
+            if (live_bytes > peak_live)
+                peak_live = live_bytes;
+            ops[n_ops].type = 'm';
+            ops[n_ops].slot = slot;
+            ops[n_ops].size = size;
+            ops[n_ops].caller = caller;
+            n_ops++;
+            n_alloc++;
+        } else if (sscanf(line, "f %lx %lu %lx", &addr, &size, &caller) >= 1) {
+            slot = slot_find(addr);
+            if (slot < 0) {
+                /* Allocated before the trace started */
+                unknown++;
+                continue;
+            }
+            slot_used[slot] = 0;
+            live_bytes -= slot_size[slot];
+            ops[n_ops].type = 'f';
+            ops[n_ops].slot = slot;
+            ops[n_ops].size = 0;
+            ops[n_ops].caller = caller;
+            n_ops++;
+            n_free++;
+        }
+    }
+    fclose(f);
+    if (unknown)
+        fprintf(stderr, "%s: %d frees of blocks allocated before the trace\n",
+                path, unknown);
+    if (n_failed)
+        fprintf(stderr, "%s: %d allocations failed on the target\n", path,
+                n_failed);
+    return 0;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Host times are only meaningful relative to each other. Each run of the
+ * trace is timed as a whole, since a clock read costs as much as a call to
+ * pvPortMalloc(); the best run is the least disturbed by the host. */
+struct result {
+    uint64_t total_ns;
+    uint64_t best_ns;
+    uint32_t failures;
+};
+
+/* Heap state over one replay, from vPortGetHeapStats() */
+struct usage {
+    size_t peak_used;
+    size_t min_largest;
+    unsigned max_frag;      /* Percent */
+    size_t max_blocks;
+};
+
+static void release_live(const struct heap *h)
+{
+    int i;
+    for (i = 0; i < MAX_LIVE; i++) {
+        if (live[i]) {
+            h->free(live[i]);
+            live[i] = NULL;
+        }
+    }
+}
+
+static void replay_stats(const struct heap *h, struct usage *u)
+{
+    HeapStats_t st;
+    size_t total;
+    unsigned frag;
+    int i;
+
+    /* heap_4 only initialises itself on the first allocation */
+    h->free(h->alloc(1));
+    total = h->free_size();
+    memset(u, 0, sizeof(*u));
+    u->min_largest = SIZE_MAX;
+    memset(live, 0, sizeof(live));
+    for (i = 0; i < n_ops; i++) {
+        struct op *o = &ops[i];
+        if (o->type == 'm') {
+            live[o->slot] = h->alloc(o->size);
+        } else if (live[o->slot]) {
+            h->free(live[o->slot]);
+            live[o->slot] = NULL;
+        }
+        h->stats(&st);
+        if (total - st.xAvailableHeapSpaceInBytes > u->peak_used)
+            u->peak_used = total - st.xAvailableHeapSpaceInBytes;
+        if (st.xSizeOfLargestFreeBlockInBytes < u->min_largest)
+            u->min_largest = st.xSizeOfLargestFreeBlockInBytes;
+        if (st.xNumberOfFreeBlocks > u->max_blocks)
+            u->max_blocks = st.xNumberOfFreeBlocks;
+        if (st.xAvailableHeapSpaceInBytes) {
+            frag = 100 - (unsigned)(st.xSizeOfLargestFreeBlockInBytes * 100 /
+                    st.xAvailableHeapSpaceInBytes);
+            if (frag > u->max_frag)
+                u->max_frag = frag;
+        }
+    }
+    release_live(h);
+}
+
+static void replay(const struct heap *h, int runs, struct result *r)
+{
+    uint64_t t0, t;
+    int run, i;
+
+    memset(r, 0, sizeof(*r));
+    r->best_ns = UINT64_MAX;
+    for (run = 0; run < runs; run++) {
+        memset(live, 0, sizeof(live));
+        t0 = now_ns();
+        for (i = 0; i < n_ops; i++) {
+            struct op *o = &ops[i];
+            if (o->type == 'm') {
+                live[o->slot] = h->alloc(o->size);
+                if (!live[o->slot])
+                    r->failures++;
+            } else if (live[o->slot]) {
+                h->free(live[o->slot]);
+                live[o->slot] = NULL;
+            }
+        }
+        t = now_ns() - t0;
+        r->total_ns += t;
+        if (t < r->best_ns)
+            r->best_ns = t;
+        /* Blocks still allocated at the end of the trace */
+        release_live(h);
+    }
+}
+
+/* Allocations per call site, for traces that record the caller */
+struct caller_stats {
+    uint32_t caller;
+    uint32_t count;
+    uint32_t max_size;
+    uint64_t bytes;
+};
+
+#define MAX_CALLERS     1024
+#define TOP_CALLERS     15
+
+static struct caller_stats callers[MAX_CALLERS];
+
+static int cmp_bytes(const void *a, const void *b)
+{
+    const struct caller_stats *ca = a, *cb = b;
+    if (ca->bytes == cb->bytes)
+        return 0;
+    return (ca->bytes < cb->bytes) ? 1 : -1;
+}
+
+static void print_callers(void)
+{
+    int i, j, n = 0;
+
+    for (i = 0; i < n_ops; i++) {
+        struct op *o = &ops[i];
+        if (o->type != 'm' || o->caller == 0)
+            continue;
+        for (j = 0; j < n && callers[j].caller != o->caller; j++)
+            ;
+        if (j == n) {
+            if (n == MAX_CALLERS)
+                continue;
+            memset(&callers[n], 0, sizeof(callers[n]));
+            callers[n++].caller = o->caller;
+        }
+        callers[j].count++;
+        callers[j].bytes += o->size;
+        if (o->size > callers[j].max_size)
+            callers[j].max_size = o->size;
+    }
+    if (n == 0) {
+        printf("No callers recorded in the trace\n\n");
+        return;
+    }
+    qsort(callers, n, sizeof(callers[0]), cmp_bytes);
+    printf("%-10s %8s %10s %8s\n", "caller", "allocs", "bytes", "max");
+    for (i = 0; i < n && i < TOP_CALLERS; i++) {
+        printf("%08x   %8u %10llu %8u\n", callers[i].caller, callers[i].count,
+                (unsigned long long)callers[i].bytes, callers[i].max_size);
+    }
+    printf("\n");
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-c] [-n runs] trace...\n", name);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    struct result r;
+    struct usage u;
+    int runs = 1000;
+    int show_callers = 0;
+    int i, t;
+
+    while ((i = getopt(argc, argv, "cn:")) != -1) {
+        if (i == 'c')
+            show_callers = 1;
+        else if (i == 'n')
+            runs = atoi(optarg);
+        else
+            usage(argv[0]);
+    }
+    if ((optind >= argc) || (runs < 1))
+        usage(argv[0]);
+
+    for (i = 0; i < N_HEAPS; i++) {
+        if (heaps[i].define_regions) {
+            HeapRegion_t regions[] = {
+                { region_mem[i], REGION_LOWER },
+                { region_mem[i] + REGION_LOWER + REGION_GAP, REGION_UPPER },
+                { NULL, 0 }
+            };
+            heaps[i].define_regions(regions);
+        }
+    }
+
+    for (t = optind; t < argc; t++) {
+        if (load_trace(argv[t]) < 0)
+            return 1;
+        printf("%s: %d allocations, %d frees, %lu bytes peak live\n", argv[t],
+                n_alloc, n_free, (unsigned long)peak_live);
+        printf("%-8s %10s %12s %10s %10s\n", "heap", "peak used",
+                "min largest", "max frag", "max blocks");
+        for (i = 0; i < N_HEAPS; i++) {
+            replay_stats(&heaps[i], &u);
+            printf("%-8s %10lu %12lu %9u%% %10lu\n", heaps[i].name,
+                    (unsigned long)u.peak_used, (unsigned long)u.min_largest,
+                    u.max_frag, (unsigned long)u.max_blocks);
+        }
+        printf("\n%d runs\n", runs);
+        printf("%-8s %12s %12s %8s\n", "heap", "ns/op avg", "ns/op best",
+                "failed");
+        for (i = 0; i < N_HEAPS; i++) {
+            replay(&heaps[i], runs, &r);
+            printf("%-8s %12.1f %12.1f %8u\n", heaps[i].name,
+                    (double)r.total_ns / ((double)n_ops * runs),
+                    (double)r.best_ns / n_ops, r.failures / runs);
+        }
+        printf("\n");
+        if (show_callers)
+            print_callers();
+    }
+    return 0;
+}
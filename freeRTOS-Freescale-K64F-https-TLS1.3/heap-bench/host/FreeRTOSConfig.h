@@ -0,0 +1,29 @@
+/* FreeRTOSConfig.h
+ *
+ * Host build of the FreeRTOS heap implementations, for heap-bench.
+ * Only the settings used by portable/MemMang/heap_*.c matter; the heap size
+ * and regions match the K64F examples (see heap_bench.c).
+ */
+#ifndef FREERTOS_CONFIG_H
+#define FREERTOS_CONFIG_H
+#include <assert.h>
+
+#define configUSE_PREEMPTION                    1
+#define configUSE_IDLE_HOOK                     0
+#define configUSE_TICK_HOOK                     0
+#define configUSE_16_BIT_TICKS                  0
+#define configTICK_RATE_HZ                      ((TickType_t)1000)
+#define configMAX_PRIORITIES                    5
+#define configMINIMAL_STACK_SIZE                ((unsigned short)90)
+#define configMAX_TASK_NAME_LEN                 16
+
+#define configSUPPORT_STATIC_ALLOCATION         0
+#define configSUPPORT_DYNAMIC_ALLOCATION        1
+#define configUSE_MALLOC_FAILED_HOOK            0
+#define configAPPLICATION_ALLOCATED_HEAP        0
+/* heap_4: a single region, as large as the two heap_5 regions together */
+#define configTOTAL_HEAP_SIZE                   ((size_t)((16 + 128) * 1024))
+
+#define configASSERT(x) assert(x)
+
+#endif /* FREERTOS_CONFIG_H */
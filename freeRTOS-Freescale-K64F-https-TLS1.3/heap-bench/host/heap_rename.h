@@ -0,0 +1,23 @@
+/* heap_rename.h
+ *
+ * Forced include for the host build of each heap_N.c: prefixes the public
+ * heap functions with HEAP_PREFIX (e.g. heap5_pvPortMalloc), so that all
+ * the implementations can be linked into the same program.
+ */
+#ifndef HEAP_RENAME_H
+#define HEAP_RENAME_H
+
+#define HEAP_CAT2(a, b) a##b
+#define HEAP_CAT(a, b) HEAP_CAT2(a, b)
+#define HEAP_SYM(f) HEAP_CAT(HEAP_PREFIX, f)
+
+#define pvPortMalloc                    HEAP_SYM(pvPortMalloc)
+#define vPortFree                       HEAP_SYM(vPortFree)
+#define vPortInitialiseBlocks           HEAP_SYM(vPortInitialiseBlocks)
+#define xPortGetFreeHeapSize            HEAP_SYM(xPortGetFreeHeapSize)
+#define xPortGetMinimumEverFreeHeapSize HEAP_SYM(xPortGetMinimumEverFreeHeapSize)
+#define vPortDefineHeapRegions          HEAP_SYM(vPortDefineHeapRegions)
+#define vPortGetHeapStats               HEAP_SYM(vPortGetHeapStats)
+#define uxPortGetSizeClassStats         HEAP_SYM(uxPortGetSizeClassStats)
+
+#endif /* HEAP_RENAME_H */
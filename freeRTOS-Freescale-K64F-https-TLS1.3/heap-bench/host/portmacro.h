@@ -0,0 +1,43 @@
+/* portmacro.h
+ *
+ * Host port for heap-bench: single threaded, so the critical sections and
+ * the scheduler locks are no-ops. Types and alignment follow the Cortex-M4
+ * port used on the K64F.
+ */
+#ifndef PORTMACRO_H
+#define PORTMACRO_H
+#include <stdint.h>
+#include <stddef.h>
+
+#define portCHAR        char
+#define portFLOAT       float
+#define portDOUBLE      double
+#define portLONG        long
+#define portSHORT       short
+#define portSTACK_TYPE  uint32_t
+#define portBASE_TYPE   long
+
+typedef portSTACK_TYPE StackType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+#define portMAX_DELAY ( TickType_t ) 0xffffffffUL
+
+#define portPOINTER_SIZE_TYPE       size_t
+#define portSTACK_GROWTH            ( -1 )
+#define portTICK_PERIOD_MS          ( ( TickType_t ) 1000 / configTICK_RATE_HZ )
+#define portBYTE_ALIGNMENT          8
+
+#define portYIELD()
+#define portENTER_CRITICAL()
+#define portEXIT_CRITICAL()
+#define portDISABLE_INTERRUPTS()
+#define portENABLE_INTERRUPTS()
+#define portSET_INTERRUPT_MASK_FROM_ISR()       0
+#define portCLEAR_INTERRUPT_MASK_FROM_ISR(x)    (void)(x)
+#define portNOP()
+
+#define portTASK_FUNCTION_PROTO( vFunction, pvParameters ) void vFunction( void *pvParameters )
+#define portTASK_FUNCTION( vFunction, pvParameters ) void vFunction( void *pvParameters )
+
+#endif /* PORTMACRO_H */
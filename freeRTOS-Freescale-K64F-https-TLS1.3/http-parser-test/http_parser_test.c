@@ -0,0 +1,590 @@
+/* http_parser_test.c
+ *
+ * Host test of the incremental HTTP parser (src/http_parser.c), fed with
+ * random fragmentations of the same input.
+ *
+ * Each test case is a stream of pipelined requests, generated at random:
+ * GET/HEAD without a body, and POST with a Content-Length or a chunked
+ * body, either raw binary data or multipart/form-data. Part contents are
+ * biased towards CR, LF, '-' and prefixes of the delimiter, so that the
+ * boundary matcher is exercised near its edges. The generator also
+ * produces the event log the parser must report.
+ *
+ * The stream is parsed in one call, then cut into fragments 'runs' times
+ * (single bytes, small and large random sizes). Every fragment is copied
+ * to a buffer of its exact size and freed after http_parse() returns, so
+ * that, under AddressSanitizer, reading past a fragment or keeping a
+ * pointer into a previous one is caught. The event log, with consecutive
+ * body and part data runs merged, must be identical in all cases.
+ *
+ * A few malformed requests, and header lines at the length limit, are
+ * checked for the same result with every fragmentation.
+ *
+ * Copyright (C) 2019 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "http_parser.h"
+
+#define MAX_REQUESTS    5
+#define MAX_PARTS       4
+#define MAX_CONTENT     600
+
+static const char *ev_name[] = {
+    "REQUEST", "HEADER", "HEADERS_COMPLETE", "BODY", "PART_HEADER",
+    "PART_BEGIN", "PART_DATA", "PART_END", "MESSAGE_COMPLETE"
+};
+
+/* Growing byte buffer */
+struct buf {
+    uint8_t *data;
+    uint32_t len;
+    uint32_t size;
+};
+
+static void buf_put(struct buf *b, const void *data, uint32_t len)
+{
+    if (b->len + len > b->size) {
+        while (b->len + len > b->size)
+            b->size = b->size ? 2 * b->size : 1024;
+        b->data = realloc(b->data, b->size);
+        if (!b->data) {
+            perror("realloc");
+            exit(2);
+        }
+    }
+    if (len > 0)
+        memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+static void buf_str(struct buf *b, const char *s)
+{
+    buf_put(b, s, strlen(s));
+}
+
+/* Event log: one entry per event, as <event> <length, 4 bytes> <data>.
+ * BODY and PART_DATA events are split wherever the input was, so
+ * consecutive ones are merged, and empty ones dropped. */
+struct event_log {
+    struct buf b;
+    uint32_t last;          /* Offset of the last entry */
+    int last_ev;
+};
+
+static void log_reset(struct event_log *l)
+{
+    l->b.len = 0;
+    l->last = 0;
+    l->last_ev = -1;
+}
+
+static void log_event(struct event_log *l, int ev, const void *data,
+        uint32_t len)
+{
+    uint8_t hdr[5];
+    uint32_t n;
+
+    if ((ev == HTTP_EV_BODY) || (ev == HTTP_EV_PART_DATA)) {
+        if (len == 0)
+            return;
+        if (l->last_ev == ev) {
+            memcpy(&n, l->b.data + l->last + 1, 4);
+            n += len;
+            memcpy(l->b.data + l->last + 1, &n, 4);
+            buf_put(&l->b, data, len);
+            return;
+        }
+    }
+    hdr[0] = (uint8_t)ev;
+    memcpy(hdr + 1, &len, 4);
+    l->last = l->b.len;
+    l->last_ev = ev;
+    buf_put(&l->b, hdr, 5);
+    buf_put(&l->b, data, len);
+}
+
+/* Print the entry at offset 'off', for failure reports */
+static void log_print(const char *what, const struct event_log *l,
+        uint32_t off)
+{
+    uint32_t len, i;
+
+    if (off >= l->b.len) {
+        fprintf(stderr, "  %s: <end of log>\n", what);
+        return;
+    }
+    memcpy(&len, l->b.data + off + 1, 4);
+    fprintf(stderr, "  %s: %s (%u bytes)", what, ev_name[l->b.data[off]], len);
+    for (i = 0; (i < len) && (i < 48); i++) {
+        uint8_t c = l->b.data[off + 5 + i];
+        if ((c >= 0x20) && (c < 0x7F))
+            fputc(c, stderr);
+        else
+            fprintf(stderr, "\\x%02x", c);
+    }
+    fprintf(stderr, "\n");
+}
+
+/* Offset of the first entry that differs, or -1 */
+static long log_diff(const struct event_log *a, const struct event_log *b)
+{
+    uint32_t off = 0, la, lb;
+
+    while ((off < a->b.len) && (off < b->b.len)) {
+        memcpy(&la, a->b.data + off + 1, 4);
+        memcpy(&lb, b->b.data + off + 1, 4);
+        if ((la != lb) || (memcmp(a->b.data + off, b->b.data + off, 5 + la) != 0))
+            return off;
+        off += 5 + la;
+    }
+    if (a->b.len != b->b.len)
+        return off;
+    return -1;
+}
+
+/* Parser callback: HEADERS_COMPLETE is logged with the method and flags
+ * decoded so far. */
+static int on_event(struct http_parser *p, enum http_event ev,
+        const uint8_t *data, uint32_t len)
+{
+    struct event_log *l = p->arg;
+
+    if (ev == HTTP_EV_HEADERS_COMPLETE) {
+        uint8_t req[2] = { (uint8_t)p->method, (uint8_t)p->flags };
+        log_event(l, ev, req, 2);
+    } else {
+        log_event(l, ev, data, len);
+    }
+    return 0;
+}
+
+/* xorshift32, seeded from the command line so that failures replay */
+static uint32_t rnd_state;
+
+static uint32_t rnd(uint32_t n)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state % n;
+}
+
+static const char bchars[] =
+    "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ'()+_,-./:=?";
+
+static void rnd_text(char *s, int len, const char *chars)
+{
+    int i, n = strlen(chars);
+    for (i = 0; i < len; i++)
+        s[i] = chars[rnd(n)];
+    s[len] = '\0';
+}
+
+static int contains(const uint8_t *h, uint32_t hlen, const char *n,
+        uint32_t nlen)
+{
+    uint32_t i;
+    for (i = 0; i + nlen <= hlen; i++) {
+        if (memcmp(h + i, n, nlen) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/* Binary data: mostly random bytes, with runs of CR, LF and '-' and, if
+ * 'delim' is given, prefixes of it. The full delimiter is never included,
+ * even straddling the end of the content and the real delimiter. */
+static uint32_t rnd_content(uint8_t *out, const char *delim)
+{
+    uint32_t len = rnd(4) ? rnd(80) : rnd(MAX_CONTENT);
+    uint32_t dlen = delim ? strlen(delim) : 0;
+    uint32_t i = 0, k;
+    static uint8_t check[MAX_CONTENT + HTTP_BOUNDARY_MAX + 8];
+
+    while (i < len) {
+        switch (rnd(8)) {
+            case 0:
+            case 1:
+                out[i++] = "\r\n-"[rnd(3)];
+                break;
+            case 2:
+                if (dlen > 0) {
+                    k = 1 + rnd(dlen - 1);
+                    if (k > len - i)
+                        k = len - i;
+                    memcpy(out + i, delim, k);
+                    i += k;
+                    break;
+                }
+                /* fall through */
+            default:
+                out[i++] = (uint8_t)rnd(256);
+                break;
+        }
+    }
+    if (dlen > 0) {
+        memcpy(check, out, len);
+        memcpy(check + len, delim, dlen);
+        while (contains(check, len + dlen - 1, delim, dlen)) {
+            /* Break the first occurrence */
+            for (k = 0; k + dlen <= len + dlen - 1; k++) {
+                if (memcmp(check + k, delim, dlen) == 0) {
+                    check[k] = out[k] = 'x';
+                    break;
+                }
+            }
+        }
+    }
+    return len;
+}
+
+/* Append 'body' to the stream, with random chunk sizes, size case,
+ * extensions and trailers */
+static void put_chunked(struct buf *s, const uint8_t *body, uint32_t len)
+{
+    char line[32];
+    uint32_t off = 0, n;
+
+    while (off < len) {
+        n = rnd(4) ? 1 + rnd(64) : 1 + rnd(len);
+        if (n > len - off)
+            n = len - off;
+        snprintf(line, sizeof(line), rnd(2) ? "%x" : "%X", n);
+        buf_str(s, line);
+        if (rnd(6) == 0)
+            buf_str(s, ";ext=1");
+        buf_str(s, "\r\n");
+        buf_put(s, body + off, n);
+        buf_str(s, "\r\n");
+        off += n;
+    }
+    buf_str(s, "0\r\n");
+    if (rnd(4) == 0)
+        buf_str(s, "X-Trailer: 1\r\n");
+    buf_str(s, "\r\n");
+}
+
+static void put_header(struct buf *s, struct event_log *l, const char *line)
+{
+    buf_str(s, line);
+    buf_str(s, "\r\n");
+    log_event(l, HTTP_EV_HEADER, line, strlen(line));
+}
+
+/* Generate one request into 's', and the expected events into 'l' */
+static void gen_request(struct buf *s, struct event_log *l)
+{
+    static uint8_t content[MAX_CONTENT];
+    struct buf body = { 0 };
+    struct event_log parts_log = { { 0 }, 0, -1 };
+    char url[48], line[HTTP_LINE_MAX], boundary[HTTP_BOUNDARY_MAX + 1];
+    char delim[HTTP_BOUNDARY_MAX + 5];
+    uint8_t req[2];
+    uint32_t len;
+    int kind = rnd(6), chunked = rnd(2), i, parts;
+
+    while (rnd(5) == 0)
+        buf_str(s, "\r\n");
+
+    url[0] = '/';
+    rnd_text(url + 1, rnd(40), "abcdefghijklmnopqrstuvwxyz0123456789/._-");
+    if (kind == 0) {
+        snprintf(line, sizeof(line), "HEAD %s HTTP/1.1", url);
+        req[0] = HTTP_METHOD_HEAD;
+    } else if (kind == 1) {
+        snprintf(line, sizeof(line), "GET %s HTTP/1.1", url);
+        req[0] = HTTP_METHOD_GET;
+    } else {
+        snprintf(line, sizeof(line), "POST %s HTTP/1.1", url);
+        req[0] = HTTP_METHOD_POST;
+    }
+    buf_str(s, line);
+    buf_str(s, "\r\n");
+    log_event(l, HTTP_EV_REQUEST, url, strlen(url));
+    req[1] = 0;
+
+    put_header(s, l, "Host: 192.168.178.211");
+    if (rnd(4) == 0) {
+        strcpy(line, "X-Random: ");
+        rnd_text(line + 10, rnd(100), bchars);
+        put_header(s, l, line);
+    }
+    if (rnd(8) == 0) {
+        put_header(s, l, "Connection: close");
+        req[1] |= HTTP_F_CLOSE;
+    }
+
+    if (kind < 2) {
+        buf_str(s, "\r\n");
+        log_event(l, HTTP_EV_HEADERS_COMPLETE, req, 2);
+        log_event(l, HTTP_EV_MESSAGE_COMPLETE, NULL, 0);
+        return;
+    }
+
+    if (kind < 4) {
+        /* Raw body */
+        len = rnd_content(content, NULL);
+        buf_put(&body, content, len);
+    } else {
+        /* multipart/form-data, with preamble, transport padding and
+         * epilogue */
+        rnd_text(boundary, 1 + rnd(HTTP_BOUNDARY_MAX), bchars);
+        snprintf(delim, sizeof(delim), "\r\n--%s", boundary);
+        snprintf(line, sizeof(line), rnd(2) ?
+                "Content-Type: multipart/form-data; boundary=%s" :
+                "Content-Type: multipart/form-data; boundary=\"%s\"", boundary);
+        put_header(s, l, line);
+        req[1] |= HTTP_F_MULTIPART;
+        if (rnd(3) == 0) {
+            /* The first delimiter may also be at the start of the body */
+            len = rnd_content(content, delim);
+            if ((len >= strlen(delim) - 2) &&
+                    (memcmp(content, delim + 2, strlen(delim) - 2) == 0))
+                content[0] = 'x';
+            buf_put(&body, content, len);
+            buf_str(&body, "\r\n");
+        }
+        parts = rnd(MAX_PARTS + 1);
+        for (i = 0; i < parts; i++) {
+            buf_str(&body, "--");
+            buf_str(&body, boundary);
+            if (rnd(4) == 0)
+                buf_str(&body, " \t ");
+            buf_str(&body, "\r\n");
+            snprintf(line, sizeof(line),
+                    "Content-Disposition: form-data; name=\"field%d\"", i);
+            buf_str(&body, line);
+            buf_str(&body, "\r\n");
+            log_event(&parts_log, HTTP_EV_PART_HEADER, line, strlen(line));
+            if (rnd(2)) {
+                strcpy(line, "Content-Type: application/octet-stream");
+                buf_str(&body, line);
+                buf_str(&body, "\r\n");
+                log_event(&parts_log, HTTP_EV_PART_HEADER, line, strlen(line));
+            }
+            buf_str(&body, "\r\n");
+            snprintf(line, sizeof(line), "field%d", i);
+            log_event(&parts_log, HTTP_EV_PART_BEGIN, line, strlen(line));
+            len = rnd_content(content, delim);
+            buf_put(&body, content, len);
+            log_event(&parts_log, HTTP_EV_PART_DATA, content, len);
+            log_event(&parts_log, HTTP_EV_PART_END, NULL, 0);
+            buf_str(&body, "\r\n");
+        }
+        buf_str(&body, "--");
+        buf_str(&body, boundary);
+        buf_str(&body, "--");
+        if (rnd(2)) {
+            len = rnd_content(content, NULL);
+            buf_put(&body, content, len);
+        }
+    }
+
+    if (chunked) {
+        put_header(s, l, "Transfer-Encoding: chunked");
+        req[1] |= HTTP_F_CHUNKED;
+    } else {
+        snprintf(line, sizeof(line), "Content-Length: %u", body.len);
+        put_header(s, l, line);
+        req[1] |= HTTP_F_HAS_LENGTH;
+    }
+    buf_str(s, "\r\n");
+    log_event(l, HTTP_EV_HEADERS_COMPLETE, req, 2);
+    if (chunked)
+        put_chunked(s, body.data, body.len);
+    else
+        buf_put(s, body.data, body.len);
+    if (kind < 4) {
+        log_event(l, HTTP_EV_BODY, body.data, body.len);
+    } else {
+        buf_put(&l->b, parts_log.b.data, parts_log.b.len);
+        l->last_ev = -1;
+    }
+    log_event(l, HTTP_EV_MESSAGE_COMPLETE, NULL, 0);
+    free(body.data);
+    free(parts_log.b.data);
+}
+
+/* Parse 'in', cut according to 'mode': 0: one call, 1: single bytes,
+ * 2: 1 to 16 bytes, 3: anywhere. Returns the last value returned by
+ * http_parse(). */
+static int parse(const struct buf *in, int mode, struct event_log *l)
+{
+    struct http_parser p;
+    uint32_t off = 0, n;
+    uint8_t *frag;
+    int ret = 0;
+
+    log_reset(l);
+    http_parser_init(&p, on_event, l);
+    while ((off < in->len) && (ret == 0)) {
+        n = in->len - off;
+        if (mode == 1)
+            n = 1;
+        else if (mode == 2)
+            n = 1 + rnd(16);
+        else if (mode == 3)
+            n = 1 + rnd(n);
+        if (n > in->len - off)
+            n = in->len - off;
+        frag = malloc(n);
+        if (!frag) {
+            perror("malloc");
+            exit(2);
+        }
+        memcpy(frag, in->data + off, n);
+        ret = http_parse(&p, frag, n);
+        free(frag);
+        off += n;
+    }
+    return ret;
+}
+
+static int fail(const char *what, int seed, int test, int mode,
+        const struct event_log *exp, const struct event_log *got, long off)
+{
+    fprintf(stderr, "FAIL: %s (seed %d, test %d, mode %d)\n", what, seed,
+            test, mode);
+    if (off >= 0) {
+        log_print("expected", exp, off);
+        log_print("got     ", got, off);
+    }
+    return 1;
+}
+
+/* Malformed requests, and the error they must cause */
+static const struct {
+    const char *in;
+    int err;
+} bad[] = {
+    { "GET /\r\n\r\n", HTTP_ERR_SYNTAX },
+    { "GET  HTTP/1.1\r\n\r\n", HTTP_ERR_SYNTAX },
+    { "GET /0123456789012345678901234567890123456789012345678901234567890123456789"
+        " HTTP/1.1\r\n\r\n", HTTP_ERR_TOO_LONG },
+    { "POST / HTTP/1.1\r\nContent-Length: x\r\n\r\n", HTTP_ERR_SYNTAX },
+    { "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n",
+        HTTP_ERR_SYNTAX },
+    { "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhelloX\r\n",
+        HTTP_ERR_SYNTAX },
+    { "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "123456789abcdef0123\r\n", HTTP_ERR_TOO_LONG },
+    { "POST / HTTP/1.1\r\nContent-Type: multipart/form-data\r\n\r\n",
+        HTTP_ERR_SYNTAX },
+    { "POST / HTTP/1.1\r\nContent-Type: multipart/form-data; boundary=b\r\n"
+        "Content-Length: 11\r\n\r\n--b\r\n\r\ndata", HTTP_ERR_SYNTAX },
+    { "POST / HTTP/1.1\r\nContent-Type: multipart/form-data; boundary=b\r\n"
+        "Content-Length: 6\r\n\r\n--bxyz", HTTP_ERR_SYNTAX },
+};
+#define N_BAD ((int)(sizeof(bad) / sizeof(bad[0])))
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-s seed] [-n tests] [-r runs]\n", name);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    struct buf in = { 0 };
+    struct event_log exp = { { 0 }, 0, -1 }, got = { { 0 }, 0, -1 };
+    int seed = 1, tests = 2000, runs = 20;
+    int t, r, i, ret, failed = 0;
+    unsigned long bytes = 0;
+    long off;
+
+    while ((i = getopt(argc, argv, "s:n:r:")) != -1) {
+        if (i == 's')
+            seed = atoi(optarg);
+        else if (i == 'n')
+            tests = atoi(optarg);
+        else if (i == 'r')
+            runs = atoi(optarg);
+        else
+            usage(argv[0]);
+    }
+    if ((optind != argc) || (tests < 1) || (runs < 1))
+        usage(argv[0]);
+    rnd_state = (uint32_t)seed * 2654435761U;
+    if (rnd_state == 0)
+        rnd_state = 1;
+
+    for (t = 0; (t < tests) && !failed; t++) {
+        in.len = 0;
+        log_reset(&exp);
+        for (i = 1 + rnd(MAX_REQUESTS); i > 0; i--)
+            gen_request(&in, &exp);
+        bytes += in.len;
+        for (r = 0; (r <= runs) && !failed; r++) {
+            int mode = (r == 0) ? 0 : (r == 1) ? 1 : 2 + (r & 1);
+            ret = parse(&in, mode, &got);
+            if (ret != 0) {
+                fprintf(stderr, "http_parse returned %d\n", ret);
+                failed = fail("parse error", seed, t, mode, &exp, &got, -1);
+            } else if ((off = log_diff(&exp, &got)) >= 0) {
+                failed = fail("events differ", seed, t, mode, &exp, &got, off);
+            }
+        }
+    }
+    for (t = 0; (t < N_BAD) && !failed; t++) {
+        in.len = 0;
+        buf_str(&in, bad[t].in);
+        for (r = 0; (r <= runs) && !failed; r++) {
+            int mode = (r == 0) ? 0 : (r == 1) ? 1 : 2 + (r & 1);
+            ret = parse(&in, mode, &got);
+            if (ret != bad[t].err) {
+                fprintf(stderr, "http_parse returned %d instead of %d\n", ret,
+                        bad[t].err);
+                failed = fail("malformed request", seed, t, mode, &exp, &got, -1);
+            }
+        }
+    }
+    /* Longest header line, CR included in the line buffer, then one more
+     * byte */
+    for (t = 0; (t < 2) && !failed; t++) {
+        char line[HTTP_LINE_MAX + 1];
+        in.len = 0;
+        buf_str(&in, "GET / HTTP/1.1\r\n");
+        memset(line, 'a', sizeof(line));
+        memcpy(line, "X-Long: ", 8);
+        line[HTTP_LINE_MAX - 2 + t] = '\0';
+        buf_str(&in, line);
+        buf_str(&in, "\r\n\r\n");
+        for (r = 0; (r <= runs) && !failed; r++) {
+            int mode = (r == 0) ? 0 : (r == 1) ? 1 : 2 + (r & 1);
+            ret = parse(&in, mode, &got);
+            if (ret != (t ? HTTP_ERR_TOO_LONG : 0)) {
+                fprintf(stderr, "http_parse returned %d for a %d byte line\n",
+                        ret, HTTP_LINE_MAX - 2 + t);
+                failed = fail("line length", seed, t, mode, &exp, &got, -1);
+            }
+        }
+    }
+    free(in.data);
+    free(exp.b.data);
+    free(got.b.data);
+    if (failed)
+        return 1;
+    printf("%d streams (%lu bytes), %d malformed requests, %d fragmentations "
+            "each: OK\n", tests, bytes, N_BAD, runs);
+    return 0;
+}
@@ -0,0 +1,120 @@
+/* alloc_stress.c
+ *
+ * Allocator stress task (ALLOC_STRESS=1)
+ *
+ * Copyright (C) 2019 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "alloc_stress.h"
+#ifdef K64F_STATIC_ALLOC
+#include "slab.h"
+#define stress_alloc(s) slab_alloc(s)
+#define stress_free(p)  slab_free(p)
+#else
+#define stress_alloc(s) pvPortMalloc(s)
+#define stress_free(p)  vPortFree(p)
+#endif
+
+#define STRESS_SLOTS        48
+#define STRESS_LIVE_MAX     (48 * 1024)
+#define STRESS_TASK_STACK   256
+
+static struct {
+    void *ptr;
+    uint32_t size;
+} slots[STRESS_SLOTS];
+
+static struct alloc_stress_stats stats;
+
+/* xorshift32: independent of the RNG used by the stacks */
+static uint32_t stress_rand(void)
+{
+    static uint32_t x = 0x2545F491;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+/* 60% small objects (16-256), 30% Ethernet frames (1500-1600),
+ * 10% TLS records (2K-12K) */
+static uint32_t stress_size(void)
+{
+    uint32_t r = stress_rand();
+    uint32_t pick = r % 10;
+    r >>= 8;
+    if (pick < 6)
+        return 16 + r % 241;
+    if (pick < 9)
+        return 1500 + r % 101;
+    return 2048 + r % (10 * 1024 + 1);
+}
+
+static void AllocStressTask(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        int i = stress_rand() % STRESS_SLOTS;
+        if (slots[i].ptr) {
+            stress_free(slots[i].ptr);
+            stats.live_bytes -= slots[i].size;
+            slots[i].ptr = NULL;
+        } else {
+            uint32_t size = stress_size();
+            if (stats.live_bytes + size <= STRESS_LIVE_MAX) {
+                slots[i].ptr = stress_alloc(size);
+                if (slots[i].ptr) {
+                    /* Touch the whole block */
+                    memset(slots[i].ptr, i, size);
+                    slots[i].size = size;
+                    stats.live_bytes += size;
+                    if (stats.live_bytes > stats.live_max)
+                        stats.live_max = stats.live_bytes;
+                } else {
+                    stats.failures++;
+                }
+            }
+        }
+        if ((++stats.iterations % 32) == 0)
+            vTaskDelay(1);
+    }
+}
+
+#ifdef K64F_STATIC_ALLOC
+static StackType_t stress_task_stack[STRESS_TASK_STACK];
+static StaticTask_t stress_task_tcb;
+#endif
+
+void alloc_stress_start(void)
+{
+#ifdef K64F_STATIC_ALLOC
+    xTaskCreateStatic(AllocStressTask, "Stress", STRESS_TASK_STACK, NULL,
+            tskIDLE_PRIORITY, stress_task_stack, &stress_task_tcb);
+#else
+    xTaskCreate(AllocStressTask, "Stress", STRESS_TASK_STACK, NULL,
+            tskIDLE_PRIORITY, NULL);
+#endif
+}
+
+const struct alloc_stress_stats *alloc_stress_stats(void)
+{
+    return &stats;
+}
@@ -0,0 +1,46 @@
+/* alloc_stress.h
+ *
+ * Allocator stress task (ALLOC_STRESS=1)
+ *
+ * Copyright (C) 2019 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+#ifndef ALLOC_STRESS_H
+#define ALLOC_STRESS_H
+#include <stdint.h>
+
+struct alloc_stress_stats {
+    uint32_t iterations;
+    uint32_t failures;      /* Allocations that returned NULL */
+    uint32_t live_bytes;
+    uint32_t live_max;
+};
+
+#ifdef ALLOC_STRESS
+/* Start the stress task, at idle priority. It runs forever, allocating
+ * and freeing blocks with the size mix of the network stacks, through
+ * the same allocator as wolfSSL (slab pools with STATIC_ALLOC=1, heap_5
+ * otherwise).
+ */
+void alloc_stress_start(void);
+const struct alloc_stress_stats *alloc_stress_stats(void);
+#else
+#define alloc_stress_start() do{}while(0)
+#endif
+
+#endif /* ALLOC_STRESS_H */
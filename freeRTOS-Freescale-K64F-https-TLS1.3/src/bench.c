@@ -0,0 +1,401 @@
+/* bench.c
+ *
+ * On-target crypto benchmarks for the K64F HTTPS server
+ *
+ * Compiled in with BENCH=1. The benchmark task runs once at boot, at a
+ * priority higher than the network tasks so that it completes before
+ * the server starts allocating, and its results are served by the HTTPS
+ * server at /bench. Time is measured with the DWT cycle counter. The heap
+ * figure is the peak heap usage of the run, from heap_5 statistics.
+ *
+ * Copyright (C) 2019 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "MK64F12.h"
+#include "wolfssl/wolfcrypt/settings.h"
+#include "wolfssl/wolfcrypt/ecc.h"
+#include "wolfssl/wolfcrypt/random.h"
+#include "wolfssl/wolfcrypt/sha256.h"
+#include "wolfssl/wolfcrypt/aes.h"
+#include "wolfssl/ssl.h"
+#include "certs.h"
+#include "bench.h"
+#include "hw_rng.h"
+
+#ifdef K64F_MMCAU
+#   define BENCH_SYM " sym:mmcau"
+#else
+#   define BENCH_SYM " sym:software"
+#endif
+
+const char *bench_config(void)
+{
+#if defined(ECC_FLASH_TABLES)
+    return "ecc:sp+flash-tables" BENCH_SYM;
+#elif defined(WOLFSSL_SP_SMALL)
+    return "ecc:sp-small" BENCH_SYM;
+#else
+    return "ecc:sp" BENCH_SYM;
+#endif
+}
+
+#ifdef HTTPS_BENCH
+
+#define BENCH_ECC_ROUNDS    5
+#define BENCH_BLOCK_SZ      1024
+#define BENCH_SYM_BYTES     (256 * 1024)
+#define BENCH_TLS_CHUNK     4096
+#define BENCH_TLS_BYTES     (128 * 1024)
+#define BENCH_PIPE_SZ       (BENCH_TLS_CHUNK + 512)
+#define BENCH_RNG_BYTES     (16 * 1024)
+
+static struct bench_result results[BENCH_MAX_RESULTS];
+static volatile int n_results;
+
+static void cycles_init(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+static uint32_t cycles_to_us(uint32_t cycles)
+{
+    return cycles / (SystemCoreClock / 1000000);
+}
+
+static struct bench_result *bench_begin(const char *name, size_t *heap_free,
+        uint32_t *t0)
+{
+    struct bench_result *r;
+    if (n_results >= BENCH_MAX_RESULTS)
+        return NULL;
+    r = &results[n_results];
+    memset(r, 0, sizeof(*r));
+    r->name = name;
+    *heap_free = xPortGetFreeHeapSize();
+    *t0 = DWT->CYCCNT;
+    return r;
+}
+
+static void bench_end(struct bench_result *r, size_t heap_free, uint32_t t0)
+{
+    r->us = cycles_to_us(DWT->CYCCNT - t0);
+    r->heap = heap_free - xPortGetMinimumEverFreeHeapSize();
+    n_results++;
+}
+
+/* Server side of a TLS 1.3 ECDHE-ECDSA handshake: ephemeral key
+ * generation, shared secret with the client share, CertificateVerify
+ * signature with the server key. */
+static void bench_ecc(WC_RNG *rng)
+{
+    struct bench_result *r;
+    ecc_key srv, eph, peer;
+    uint8_t secret[32], hash[32], sig[80];
+    word32 len, idx = 0;
+    size_t heap_free;
+    uint32_t t0, t_keygen = 0, t_ecdh = 0, t_sign = 0, t;
+    int i;
+
+    wc_ecc_init(&srv);
+    wc_ecc_init(&peer);
+    if (wc_EccPrivateKeyDecode(server_key, &idx, &srv, server_key_len) != 0)
+        return;
+    if (wc_ecc_make_key_ex(rng, 32, &peer, ECC_SECP256R1) != 0)
+        return;
+    memset(hash, 0x5A, sizeof(hash));
+
+    r = bench_begin("tls13-server-handshake-ecc", &heap_free, &t0);
+    if (!r)
+        return;
+    for (i = 0; i < BENCH_ECC_ROUNDS; i++) {
+        wc_ecc_init(&eph);
+        t = DWT->CYCCNT;
+        wc_ecc_make_key_ex(rng, 32, &eph, ECC_SECP256R1);
+        t_keygen += DWT->CYCCNT - t;
+#if defined(ECC_TIMING_RESISTANT) && (LIBWOLFSSL_VERSION_HEX >= 0x04005000)
+        wc_ecc_set_rng(&eph, rng);
+#endif
+        t = DWT->CYCCNT;
+        len = sizeof(secret);
+        wc_ecc_shared_secret(&eph, &peer, secret, &len);
+        t_ecdh += DWT->CYCCNT - t;
+        t = DWT->CYCCNT;
+        len = sizeof(sig);
+        wc_ecc_sign_hash(hash, sizeof(hash), sig, &len, rng, &srv);
+        t_sign += DWT->CYCCNT - t;
+        wc_ecc_free(&eph);
+    }
+    r->count = BENCH_ECC_ROUNDS;
+    bench_end(r, heap_free, t0);
+
+    /* Breakdown, same runs */
+    if (n_results + 3 <= BENCH_MAX_RESULTS) {
+        results[n_results].name = "ecc-p256-keygen";
+        results[n_results].count = BENCH_ECC_ROUNDS;
+        results[n_results].us = cycles_to_us(t_keygen);
+        n_results++;
+        results[n_results].name = "ecc-p256-ecdh";
+        results[n_results].count = BENCH_ECC_ROUNDS;
+        results[n_results].us = cycles_to_us(t_ecdh);
+        n_results++;
+        results[n_results].name = "ecc-p256-sign";
+        results[n_results].count = BENCH_ECC_ROUNDS;
+        results[n_results].us = cycles_to_us(t_sign);
+        n_results++;
+    }
+    wc_ecc_free(&peer);
+    wc_ecc_free(&srv);
+}
+
+static uint8_t bench_block[BENCH_TLS_CHUNK];
+
+static void bench_sha256(void)
+{
+    struct bench_result *r;
+    wc_Sha256 sha;
+    uint8_t digest[WC_SHA256_DIGEST_SIZE];
+    size_t heap_free;
+    uint32_t t0, done;
+
+    r = bench_begin("sha256", &heap_free, &t0);
+    if (!r)
+        return;
+    wc_InitSha256(&sha);
+    for (done = 0; done < BENCH_SYM_BYTES; done += BENCH_BLOCK_SZ)
+        wc_Sha256Update(&sha, bench_block, BENCH_BLOCK_SZ);
+    wc_Sha256Final(&sha, digest);
+    r->count = BENCH_SYM_BYTES / BENCH_BLOCK_SZ;
+    r->bytes = BENCH_SYM_BYTES;
+    bench_end(r, heap_free, t0);
+}
+
+static void bench_aesgcm(void)
+{
+    struct bench_result *r;
+    Aes aes;
+    uint8_t key[16], iv[12], tag[16], aad[13];
+    size_t heap_free;
+    uint32_t t0, done;
+
+    memset(key, 0x11, sizeof(key));
+    memset(iv, 0x22, sizeof(iv));
+    memset(aad, 0x33, sizeof(aad));
+    wc_AesGcmSetKey(&aes, key, sizeof(key));
+    r = bench_begin("aes128-gcm-encrypt", &heap_free, &t0);
+    if (!r)
+        return;
+    for (done = 0; done < BENCH_SYM_BYTES; done += BENCH_BLOCK_SZ) {
+        wc_AesGcmEncrypt(&aes, bench_block, bench_block, BENCH_BLOCK_SZ,
+                iv, sizeof(iv), tag, sizeof(tag), aad, sizeof(aad));
+    }
+    r->count = BENCH_SYM_BYTES / BENCH_BLOCK_SZ;
+    r->bytes = BENCH_SYM_BYTES;
+    bench_end(r, heap_free, t0);
+}
+
+/* Random bytes for wolfSSL: the previous byte at a time fill (one
+ * 32-bit word drawn per output byte, as rnd_custom_generate_block() did
+ * with pico_rand()), then the RNGA block fill. */
+static void bench_rng(void)
+{
+    struct bench_result *r;
+    size_t heap_free;
+    uint32_t t0, done, i;
+
+    r = bench_begin("rng-bytewise", &heap_free, &t0);
+    if (!r)
+        return;
+    for (done = 0; done < BENCH_RNG_BYTES; done += BENCH_BLOCK_SZ) {
+        for (i = 0; i < BENCH_BLOCK_SZ; i++)
+            bench_block[i] = (uint8_t)hw_rng_word();
+    }
+    r->count = BENCH_RNG_BYTES / BENCH_BLOCK_SZ;
+    r->bytes = BENCH_RNG_BYTES;
+    bench_end(r, heap_free, t0);
+
+    r = bench_begin("rng-block", &heap_free, &t0);
+    if (!r)
+        return;
+    for (done = 0; done < BENCH_RNG_BYTES; done += BENCH_BLOCK_SZ)
+        hw_rng_block(bench_block, BENCH_BLOCK_SZ);
+    r->count = BENCH_RNG_BYTES / BENCH_BLOCK_SZ;
+    r->bytes = BENCH_RNG_BYTES;
+    bench_end(r, heap_free, t0);
+}
+
+/* TLS record throughput: a TLS 1.3 client and server connected through
+ * two memory pipes. The client writes BENCH_TLS_CHUNK byte records, the
+ * server reads and decrypts them, with the cipher suite negotiated by
+ * default (AES-GCM). */
+struct bench_pipe {
+    uint8_t buf[BENCH_PIPE_SZ];
+    uint32_t len;
+};
+
+static struct bench_pipe pipe_c2s, pipe_s2c;
+
+static int pipe_send(WOLFSSL *ssl, char *buf, int sz, void *ctx)
+{
+    struct bench_pipe *p = (struct bench_pipe *)ctx;
+    (void)ssl;
+    if (sz > (int)(BENCH_PIPE_SZ - p->len))
+        sz = BENCH_PIPE_SZ - p->len;
+    if (sz == 0)
+        return WOLFSSL_CBIO_ERR_WANT_WRITE;
+    memcpy(p->buf + p->len, buf, sz);
+    p->len += sz;
+    return sz;
+}
+
+static int pipe_recv(WOLFSSL *ssl, char *buf, int sz, void *ctx)
+{
+    struct bench_pipe *p = (struct bench_pipe *)ctx;
+    (void)ssl;
+    if (p->len == 0)
+        return WOLFSSL_CBIO_ERR_WANT_READ;
+    if (sz > (int)p->len)
+        sz = p->len;
+    memcpy(buf, p->buf, sz);
+    memmove(p->buf, p->buf + sz, p->len - sz);
+    p->len -= sz;
+    return sz;
+}
+
+static void bench_tls_records(void)
+{
+    struct bench_result *r;
+    WOLFSSL_CTX *cctx = NULL, *sctx = NULL;
+    WOLFSSL *cli = NULL, *srv = NULL;
+    size_t heap_free;
+    uint32_t t0, sent = 0, recvd;
+    int rc = 0, rs = 0, i, ret;
+
+    cctx = wolfSSL_CTX_new(wolfTLSv1_3_client_method());
+    sctx = wolfSSL_CTX_new(wolfTLSv1_3_server_method());
+    if (!cctx || !sctx)
+        goto out;
+    wolfSSL_CTX_set_verify(cctx, WOLFSSL_VERIFY_NONE, NULL);
+    if ((wolfSSL_CTX_use_certificate_buffer(sctx, server_cert, server_cert_len,
+                    SSL_FILETYPE_ASN1) != SSL_SUCCESS) ||
+            (wolfSSL_CTX_use_PrivateKey_buffer(sctx, server_key, server_key_len,
+                    SSL_FILETYPE_ASN1) != SSL_SUCCESS))
+        goto out;
+    wolfSSL_CTX_SetIORecv(cctx, pipe_recv);
+    wolfSSL_CTX_SetIOSend(cctx, pipe_send);
+    wolfSSL_CTX_SetIORecv(sctx, pipe_recv);
+    wolfSSL_CTX_SetIOSend(sctx, pipe_send);
+    cli = wolfSSL_new(cctx);
+    srv = wolfSSL_new(sctx);
+    if (!cli || !srv)
+        goto out;
+    pipe_c2s.len = 0;
+    pipe_s2c.len = 0;
+    wolfSSL_SetIOWriteCtx(cli, &pipe_c2s);
+    wolfSSL_SetIOReadCtx(cli, &pipe_s2c);
+    wolfSSL_SetIOWriteCtx(srv, &pipe_s2c);
+    wolfSSL_SetIOReadCtx(srv, &pipe_c2s);
+
+    for (i = 0; (i < 32) && ((rc != SSL_SUCCESS) || (rs != SSL_SUCCESS)); i++) {
+        if (rc != SSL_SUCCESS)
+            rc = wolfSSL_connect(cli);
+        if (rs != SSL_SUCCESS)
+            rs = wolfSSL_accept(srv);
+    }
+    if ((rc != SSL_SUCCESS) || (rs != SSL_SUCCESS))
+        goto out;
+
+    r = bench_begin("tls13-record-write+read", &heap_free, &t0);
+    if (!r)
+        goto out;
+    while (sent < BENCH_TLS_BYTES) {
+        if (wolfSSL_write(cli, bench_block, BENCH_TLS_CHUNK) != BENCH_TLS_CHUNK)
+            break;
+        recvd = 0;
+        while (recvd < BENCH_TLS_CHUNK) {
+            ret = wolfSSL_read(srv, bench_block, BENCH_TLS_CHUNK - recvd);
+            if (ret <= 0)
+                break;
+            recvd += ret;
+        }
+        if (recvd < BENCH_TLS_CHUNK)
+            break;
+        sent += BENCH_TLS_CHUNK;
+    }
+    r->count = sent / BENCH_TLS_CHUNK;
+    r->bytes = sent;
+    bench_end(r, heap_free, t0);
+
+out:
+    if (cli)
+        wolfSSL_free(cli);
+    if (srv)
+        wolfSSL_free(srv);
+    if (cctx)
+        wolfSSL_CTX_free(cctx);
+    if (sctx)
+        wolfSSL_CTX_free(sctx);
+}
+
+static void BenchTask(void *pv)
+{
+    WC_RNG rng;
+    (void)pv;
+    wolfSSL_Init();
+    cycles_init();
+    memset(bench_block, 0xA5, sizeof(bench_block));
+    bench_sha256();
+    bench_aesgcm();
+    bench_rng();
+    if (wc_InitRng(&rng) == 0) {
+        bench_ecc(&rng);
+        wc_FreeRng(&rng);
+    }
+    bench_tls_records();
+    vTaskDelete(NULL);
+}
+
+#define BENCH_TASK_STACK 1024
+#ifdef K64F_STATIC_ALLOC
+static StackType_t bench_task_stack[BENCH_TASK_STACK];
+static StaticTask_t bench_task_tcb;
+#endif
+
+void bench_start(void)
+{
+    n_results = 0;
+#ifdef K64F_STATIC_ALLOC
+    xTaskCreateStatic(BenchTask, "Bench", BENCH_TASK_STACK, NULL,
+            tskIDLE_PRIORITY + 1, bench_task_stack, &bench_task_tcb);
+#else
+    xTaskCreate(BenchTask, "Bench", BENCH_TASK_STACK, NULL,
+            tskIDLE_PRIORITY + 1, NULL);
+#endif
+}
+
+int bench_results(const struct bench_result **res)
+{
+    *res = results;
+    return n_results;
+}
+
+#endif /* HTTPS_BENCH */
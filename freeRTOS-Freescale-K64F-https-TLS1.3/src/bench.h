@@ -0,0 +1,51 @@
+/* bench.h
+ *
+ * On-target crypto benchmarks for the K64F HTTPS server
+ *
+ * Copyright (C) 2019 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+#ifndef BENCH_H
+#define BENCH_H
+#include <stdint.h>
+
+#define BENCH_MAX_RESULTS 16
+
+struct bench_result {
+    const char *name;
+    uint32_t count;     /* Operations performed */
+    uint32_t bytes;     /* Bytes processed (0 for public key operations) */
+    uint32_t us;        /* Total time */
+    uint32_t heap;      /* Peak heap used during the run, in bytes */
+};
+
+/* Name of the build configuration being measured */
+const char *bench_config(void);
+
+#ifdef HTTPS_BENCH
+/* Start the benchmark task. Results are available once it completes. */
+void bench_start(void);
+
+/* Returns the number of results available, and a pointer to the table */
+int bench_results(const struct bench_result **res);
+#else
+#define bench_start() do{}while(0)
+#define bench_results(res) (0)
+#endif
+
+#endif /* BENCH_H */
@@ -0,0 +1,200 @@
+/* fw_update.c
+ *
+ * Update partition writer for the K64F HTTPS firmware update demo
+ *
+ * Incoming image data is staged in a buffer of WOLFBOOT_SECTOR_SIZE
+ * bytes. Each sector is erased ahead of time: as soon as a sector has
+ * been programmed, the erase of the next one is launched on the FTFE
+ * without waiting for completion, and runs while the next sector's data
+ * is being received. The update partition sits in the second program
+ * flash block (0x80000-0xFFFFF), so the CPU keeps fetching code from the
+ * first block while the erase is in progress.
+ *
+ * Copyright (C) 2019 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "MK64F12.h"
+#include "hal.h"
+#include "wolfboot/wolfboot.h"
+#include "fw_update.h"
+
+#define FTFE_CMD_ERASE_SECTOR   0x09
+#define FTFE_FSTAT_ERRORS       (FTFE_FSTAT_ACCERR_MASK | FTFE_FSTAT_FPVIOL_MASK | \
+                                 FTFE_FSTAT_MGSTAT0_MASK)
+
+static uint8_t fw_buffer[WOLFBOOT_SECTOR_SIZE];
+
+static struct fw_writer {
+    uint32_t off;           /* Bytes already programmed */
+    uint32_t buf_off;       /* Bytes staged in fw_buffer */
+    uint32_t size;          /* Expected size (header + image), 0 until known */
+    uint32_t erased;        /* End of the erased (or being erased) area */
+    TickType_t start;
+    int erase_pending;
+    int active;
+} fw;
+
+static struct fw_update_stats stats = { 0, 0, 0, -1 };
+
+/* Launch a sector erase and return immediately. */
+static void ftfe_erase_start(uint32_t address)
+{
+    FTFE->FSTAT = FTFE_FSTAT_ACCERR_MASK | FTFE_FSTAT_FPVIOL_MASK;
+    FTFE->FCCOB0 = FTFE_CMD_ERASE_SECTOR;
+    FTFE->FCCOB1 = (uint8_t)(address >> 16);
+    FTFE->FCCOB2 = (uint8_t)(address >> 8);
+    FTFE->FCCOB3 = (uint8_t)(address);
+    FTFE->FSTAT = FTFE_FSTAT_CCIF_MASK;
+}
+
+/* Wait for a pending erase. The task blocks for one tick between polls:
+ * taskYIELD() only lets tasks of the same priority run, so with MAIN_PRIO
+ * above PICO_PRIO the network stack would stall for the whole erase. */
+static int ftfe_erase_wait(void)
+{
+    uint8_t fstat;
+    if (!fw.erase_pending)
+        return 0;
+    while (((fstat = FTFE->FSTAT) & FTFE_FSTAT_CCIF_MASK) == 0)
+        vTaskDelay(1);
+    fw.erase_pending = 0;
+    /* Drop stale lines from the flash controller cache */
+    FMC->PFB0CR |= FMC_PFB0CR_CINV_WAY_MASK;
+    return (fstat & FTFE_FSTAT_ERRORS) ? -1 : 0;
+}
+
+static void erase_ahead(void)
+{
+    uint32_t end = fw.size ? fw.size : WOLFBOOT_PARTITION_SIZE;
+    if (fw.erase_pending || (fw.erased >= end) ||
+            (fw.erased >= WOLFBOOT_PARTITION_SIZE))
+        return;
+    ftfe_erase_start(WOLFBOOT_PARTITION_UPDATE_ADDRESS + fw.erased);
+    fw.erase_pending = 1;
+    fw.erased += WOLFBOOT_SECTOR_SIZE;
+}
+
+static int fw_flush(void)
+{
+    if (fw.buf_off == 0)
+        return 0;
+    if (ftfe_erase_wait() < 0)
+        return -1;
+    if (fw.erased <= fw.off) {
+        /* Not erased ahead (e.g. erase error recovery): do it now */
+        hal_flash_erase(WOLFBOOT_PARTITION_UPDATE_ADDRESS + fw.off, WOLFBOOT_SECTOR_SIZE);
+        fw.erased = fw.off + WOLFBOOT_SECTOR_SIZE;
+    }
+    if (fw.buf_off < WOLFBOOT_SECTOR_SIZE)
+        memset(fw_buffer + fw.buf_off, 0xFF, WOLFBOOT_SECTOR_SIZE - fw.buf_off);
+    if (hal_flash_write(WOLFBOOT_PARTITION_UPDATE_ADDRESS + fw.off, fw_buffer,
+                WOLFBOOT_SECTOR_SIZE) < 0)
+        return -1;
+    fw.off += fw.buf_off;
+    fw.buf_off = 0;
+    /* Next sector is erased while its data is being received */
+    erase_ahead();
+    return 0;
+}
+
+static void fw_stats_update(int result)
+{
+    stats.bytes = fw.off + fw.buf_off;
+    stats.ms = (xTaskGetTickCount() - fw.start) * portTICK_PERIOD_MS;
+    /* bytes/ms is (almost) KB/s: 1000/1024 */
+    stats.kbps = stats.ms ? (uint32_t)(((uint64_t)stats.bytes * 1000) / (1024 * stats.ms)) : 0;
+    stats.result = result;
+}
+
+void fw_update_begin(void)
+{
+    if (fw.active)
+        fw_update_abort();
+    memset(&fw, 0, sizeof(fw));
+    fw.active = 1;
+    fw.start = xTaskGetTickCount();
+    stats.result = -1;
+    hal_flash_unlock();
+    erase_ahead();
+}
+
+int fw_update_write(const uint8_t *data, uint32_t len)
+{
+    uint32_t n;
+    while (len > 0) {
+        n = WOLFBOOT_SECTOR_SIZE - fw.buf_off;
+        if (n > len)
+            n = len;
+        memcpy(fw_buffer + fw.buf_off, data, n);
+        fw.buf_off += n;
+        data += n;
+        len -= n;
+        if ((fw.size == 0) && (fw.off == 0) && (fw.buf_off >= 8)) {
+            uint32_t fw_siz = fw_buffer[4] + (fw_buffer[5] << 8) +
+                (fw_buffer[6] << 16) + (fw_buffer[7] << 24);
+            if ((memcmp(fw_buffer, "WOLF", 4) != 0) ||
+                    (fw_siz > WOLFBOOT_PARTITION_SIZE) ||
+                    (fw_siz < WOLFBOOT_SECTOR_SIZE))
+                return -1;
+            fw.size = fw_siz + IMAGE_HEADER_SIZE;
+        }
+        if (fw.size && (fw.off + fw.buf_off > fw.size))
+            return -1;
+        if ((fw.buf_off == WOLFBOOT_SECTOR_SIZE) && (fw_flush() < 0))
+            return -1;
+    }
+    return 0;
+}
+
+int fw_update_end(void)
+{
+    int ret = 0;
+    if (!fw.active)
+        return -1;
+    if (fw_flush() < 0)
+        ret = -1;
+    if (ftfe_erase_wait() < 0)
+        ret = -1;
+    if ((fw.size == 0) || (fw.off != fw.size))
+        ret = -1;
+    fw.active = 0;
+    fw_stats_update(ret);
+    return ret;
+}
+
+void fw_update_abort(void)
+{
+    if (!fw.active)
+        return;
+    ftfe_erase_wait();
+    fw.active = 0;
+    fw_stats_update(-1);
+}
+
+int fw_update_active(void)
+{
+    return fw.active;
+}
+
+const struct fw_update_stats *fw_update_stats(void)
+{
+    return &stats;
+}
@@ -0,0 +1,55 @@
+/* fw_update.h
+ *
+ * Update partition writer for the K64F HTTPS firmware update demo
+ *
+ * Copyright (C) 2019 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+#ifndef FW_UPDATE_H
+#define FW_UPDATE_H
+#include <stdint.h>
+
+#ifndef IMAGE_HEADER_SIZE
+#define IMAGE_HEADER_SIZE 0x100
+#endif
+
+struct fw_update_stats {
+    uint32_t bytes;     /* Bytes received in the last upload */
+    uint32_t ms;        /* Duration of the last upload */
+    uint32_t kbps;      /* Throughput of the last upload, in KB/s */
+    int result;         /* 0: image complete, -1: failed or in progress */
+};
+
+/* Start a new upload: unlock the flash and erase the first sector. */
+void fw_update_begin(void);
+
+/* Append image data. Returns -1 if the data does not look like a signed
+ * image, or if it exceeds the size announced in its header.
+ */
+int fw_update_write(const uint8_t *data, uint32_t len);
+
+/* Flush the last sector. Returns 0 if the image is complete. */
+int fw_update_end(void);
+
+/* Abort an upload in progress */
+void fw_update_abort(void);
+
+int fw_update_active(void);
+const struct fw_update_stats *fw_update_stats(void);
+
+#endif /* FW_UPDATE_H */
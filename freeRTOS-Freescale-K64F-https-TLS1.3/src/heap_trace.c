@@ -0,0 +1,84 @@
+/* heap_trace.c
+ *
+ * Allocation trace of the FreeRTOS heap (HEAP_TRACE=n)
+ *
+ * Copyright (C) 2019 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+#include "FreeRTOS.h"
+#include "task.h"
+#include "heap_trace.h"
+
+/* The last K64F_HEAP_TRACE calls to pvPortMalloc()/vPortFree() are kept in
+ * a ring. The hooks run with the scheduler suspended, and the heap is not
+ * used from interrupts, so there is a single writer at a time and it needs
+ * no lock. The reader runs in a task and can be preempted by the writer:
+ * each record carries its position in the trace, invalidated while it is
+ * being written, so that the reader detects records overwritten under it.
+ */
+#define HEAP_TRACE_LEN      K64F_HEAP_TRACE
+#define HEAP_TRACE_INVALID  0xFFFFFFFFUL
+#define barrier()           __asm volatile ("" ::: "memory")
+
+static struct heap_trace_rec ring[HEAP_TRACE_LEN];
+static volatile uint32_t ring_head;     /* Records written since boot */
+static uint32_t ring_tail;              /* Next record to read */
+
+void heap_trace_record(int op, void *addr, size_t size, void *caller)
+{
+    uint32_t seq = ring_head;
+    struct heap_trace_rec *r = &ring[seq % HEAP_TRACE_LEN];
+
+    r->seq = HEAP_TRACE_INVALID;
+    barrier();
+    r->addr = (uint32_t)(uintptr_t)addr;
+    r->size = (uint32_t)size | ((op == 'f') ? HEAP_TRACE_FREE : 0);
+    r->caller = (uint32_t)(uintptr_t)caller & ~1UL;
+    r->ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    barrier();
+    r->seq = seq;
+    barrier();
+    ring_head = seq + 1;
+}
+
+int heap_trace_read(struct heap_trace_rec *out, int max, uint32_t *lost,
+        uint32_t *pending)
+{
+    uint32_t head = ring_head;
+    int n = 0;
+
+    *lost = 0;
+    if (head - ring_tail > HEAP_TRACE_LEN) {
+        *lost = head - HEAP_TRACE_LEN - ring_tail;
+        ring_tail = head - HEAP_TRACE_LEN;
+    }
+    while ((n < max) && (ring_tail != head)) {
+        const struct heap_trace_rec *r = &ring[ring_tail % HEAP_TRACE_LEN];
+        out[n] = *r;
+        barrier();
+        if ((out[n].seq != ring_tail) || (r->seq != ring_tail)) {
+            /* Overwritten while reading */
+            (*lost)++;
+        } else {
+            n++;
+        }
+        ring_tail++;
+    }
+    *pending = ring_head - ring_tail;
+    return n;
+}
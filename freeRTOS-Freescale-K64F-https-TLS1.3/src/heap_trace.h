@@ -0,0 +1,50 @@
+/* heap_trace.h
+ *
+ * Allocation trace of the FreeRTOS heap (HEAP_TRACE=n)
+ *
+ * Copyright (C) 2019 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+#ifndef HEAP_TRACE_H
+#define HEAP_TRACE_H
+#include <stdint.h>
+#include <stddef.h>
+
+/* One pvPortMalloc() or vPortFree() call */
+struct heap_trace_rec {
+    uint32_t seq;           /* Position in the trace */
+    uint32_t addr;          /* Block returned or freed, 0 if the allocation failed */
+    uint32_t size;          /* Block size, including the heap header; HEAP_TRACE_FREE for frees */
+    uint32_t caller;        /* Return address of the call */
+    uint32_t ms;            /* Uptime */
+};
+#define HEAP_TRACE_FREE     0x80000000UL
+/* heap_5 block header (BlockLink_t) on Cortex-M */
+#define HEAP_TRACE_HDR      8
+
+/* Called by the traceMALLOC()/traceFREE() hooks, see FreeRTOSConfig.h */
+void heap_trace_record(int op, void *addr, size_t size, void *caller);
+
+/* Copy up to 'max' records not read yet, oldest first. '*lost' is set to
+ * the number of records overwritten before they could be read, '*pending'
+ * to the number left after this call. Returns the number of records copied.
+ */
+int heap_trace_read(struct heap_trace_rec *out, int max, uint32_t *lost,
+        uint32_t *pending);
+
+#endif /* HEAP_TRACE_H */
@@ -0,0 +1,516 @@
+/* http_parser.c
+ *
+ * Incremental HTTP/1.1 request parser with multipart/form-data support
+ *
+ * Copyright (C) 2019 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+#include <string.h>
+#include "http_parser.h"
+
+/* Request states */
+#define ST_REQ_LINE        0
+#define ST_HEADERS         1
+#define ST_BODY            2
+
+/* Chunked body states */
+#define BODY_CHUNK_SIZE    0
+#define BODY_CHUNK_DATA    1
+#define BODY_CHUNK_CRLF    2
+#define BODY_TRAILERS      3
+
+/* Multipart states */
+#define MP_PREAMBLE        0
+#define MP_AFTER_DELIM     1
+#define MP_PART_HEADERS    2
+#define MP_DATA            3
+#define MP_EPILOGUE        4
+
+#define EMIT(p, ev, d, l) \
+    do { \
+        int cb_ret = (p)->cb((p), (ev), (const uint8_t *)(d), (l)); \
+        if (cb_ret != 0) \
+            return cb_ret; \
+    } while (0)
+
+static char lc(char c)
+{
+    if (c >= 'A' && c <= 'Z')
+        return c + ('a' - 'A');
+    return c;
+}
+
+static int ci_prefix(const char *s, const char *prefix)
+{
+    while (*prefix) {
+        if (lc(*s) != lc(*prefix))
+            return 0;
+        s++;
+        prefix++;
+    }
+    return 1;
+}
+
+static const char *ci_find(const char *s, const char *needle)
+{
+    while (*s) {
+        if (ci_prefix(s, needle))
+            return s;
+        s++;
+    }
+    return NULL;
+}
+
+const char *http_header_value(const char *line, const char *name)
+{
+    if (!ci_prefix(line, name))
+        return NULL;
+    line += strlen(name);
+    if (*line != ':')
+        return NULL;
+    line++;
+    while (*line == ' ' || *line == '\t')
+        line++;
+    return line;
+}
+
+/* Accumulate bytes into 'line' up to and including the next LF.
+ * Returns 1 when a full line is available (NUL-terminated, CRLF removed),
+ * 0 when more data is needed, HTTP_ERR_TOO_LONG on overflow.
+ * '*used' is set to the number of bytes consumed from 'buf'.
+ */
+static int line_feed(char *line, uint16_t *line_len, uint16_t max,
+        const uint8_t *buf, uint32_t len, uint32_t *used)
+{
+    uint32_t i = 0;
+    while (i < len) {
+        char c = (char)buf[i++];
+        if (c == '\n') {
+            if ((*line_len > 0) && (line[*line_len - 1] == '\r'))
+                (*line_len)--;
+            line[*line_len] = '\0';
+            *used = i;
+            return 1;
+        }
+        if (*line_len >= max - 1) {
+            *used = i;
+            return HTTP_ERR_TOO_LONG;
+        }
+        line[(*line_len)++] = c;
+    }
+    *used = i;
+    return 0;
+}
+
+static int parse_request_line(struct http_parser *p)
+{
+    char *s = p->line;
+    int i;
+    if (strncmp(s, "GET ", 4) == 0) {
+        p->method = HTTP_METHOD_GET;
+        s += 4;
+    } else if (strncmp(s, "HEAD ", 5) == 0) {
+        p->method = HTTP_METHOD_HEAD;
+        s += 5;
+    } else if (strncmp(s, "POST ", 5) == 0) {
+        p->method = HTTP_METHOD_POST;
+        s += 5;
+    } else {
+        p->method = HTTP_METHOD_UNKNOWN;
+        s = strchr(s, ' ');
+        if (!s)
+            return HTTP_ERR_SYNTAX;
+        s++;
+    }
+    for (i = 0; (s[i] != ' ') && (s[i] != '\0'); i++) {
+        if (i >= HTTP_URL_MAX - 1)
+            return HTTP_ERR_TOO_LONG;
+        p->url[i] = s[i];
+    }
+    p->url[i] = '\0';
+    if ((i == 0) || (s[i] != ' ') || (strncmp(s + i + 1, "HTTP/1.", 7) != 0))
+        return HTTP_ERR_SYNTAX;
+    if (s[i + 8] == '0')
+        p->flags |= HTTP_F_CLOSE;
+    return 0;
+}
+
+static int parse_boundary(struct http_parser *p, const char *ctype)
+{
+    const char *b;
+    int len = 0;
+    if (!ci_prefix(ctype, "multipart/"))
+        return 0;
+    b = ci_find(ctype, "boundary=");
+    if (!b)
+        return HTTP_ERR_SYNTAX;
+    b += 9;
+    if (*b == '"')
+        b++;
+    memcpy(p->delim, "\r\n--", 4);
+    while ((b[len] != '\0') && (b[len] != '"') && (b[len] != ';') &&
+            (b[len] != ' ')) {
+        if (len >= HTTP_BOUNDARY_MAX)
+            return HTTP_ERR_TOO_LONG;
+        p->delim[4 + len] = b[len];
+        len++;
+    }
+    if (len == 0)
+        return HTTP_ERR_SYNTAX;
+    p->delim_len = 4 + len;
+    p->flags |= HTTP_F_MULTIPART;
+    return 0;
+}
+
+static int parse_header(struct http_parser *p)
+{
+    const char *v;
+    if ((v = http_header_value(p->line, "Content-Length")) != NULL) {
+        uint32_t n = 0;
+        if ((*v < '0') || (*v > '9'))
+            return HTTP_ERR_SYNTAX;
+        while ((*v >= '0') && (*v <= '9')) {
+            if (n > 0x0FFFFFFF)
+                return HTTP_ERR_TOO_LONG;
+            n = n * 10 + (*v - '0');
+            v++;
+        }
+        p->content_length = n;
+        p->flags |= HTTP_F_HAS_LENGTH;
+    } else if ((v = http_header_value(p->line, "Transfer-Encoding")) != NULL) {
+        if (ci_find(v, "chunked"))
+            p->flags |= HTTP_F_CHUNKED;
+    } else if ((v = http_header_value(p->line, "Content-Type")) != NULL) {
+        return parse_boundary(p, v);
+    } else if ((v = http_header_value(p->line, "Connection")) != NULL) {
+        if (ci_prefix(v, "close"))
+            p->flags |= HTTP_F_CLOSE;
+        else if (ci_prefix(v, "keep-alive"))
+            p->flags &= ~HTTP_F_CLOSE;
+    }
+    return 0;
+}
+
+/* Extract name="..." from a Content-Disposition part header. */
+static void parse_part_header(struct http_parser *p)
+{
+    const char *v = http_header_value(p->line, "Content-Disposition");
+    const char *n;
+    int i = 0;
+    if (!v)
+        return;
+    n = v;
+    while ((n = ci_find(n, "name=\"")) != NULL) {
+        if ((n > v) && ((n[-1] == ' ') || (n[-1] == ';')))
+            break;
+        n++;
+    }
+    if (!n)
+        return;
+    n += 6;
+    while ((n[i] != '"') && (n[i] != '\0') && (i < (int)sizeof(p->part_name) - 1)) {
+        p->part_name[i] = n[i];
+        i++;
+    }
+    p->part_name[i] = '\0';
+}
+
+static void reset_request(struct http_parser *p)
+{
+    p->method = HTTP_METHOD_UNKNOWN;
+    p->url[0] = '\0';
+    p->flags = 0;
+    p->content_length = 0;
+    p->body_read = 0;
+    p->part_name[0] = '\0';
+    p->state = ST_REQ_LINE;
+    p->body_state = BODY_CHUNK_SIZE;
+    p->mp_state = MP_PREAMBLE;
+    p->line_len = 0;
+    p->chunk_line_len = 0;
+    p->chunk_left = 0;
+    p->delim_len = 0;
+    /* The first boundary in the body is not preceded by CRLF: start as if
+     * the CRLF had already been matched. */
+    p->delim_match = 2;
+    p->delim_in_buf = 0;
+}
+
+void http_parser_init(struct http_parser *p, http_cb cb, void *arg)
+{
+    p->cb = cb;
+    p->arg = arg;
+    reset_request(p);
+}
+
+static int message_complete(struct http_parser *p)
+{
+    if ((p->flags & HTTP_F_MULTIPART) && (p->mp_state != MP_EPILOGUE))
+        return HTTP_ERR_SYNTAX;
+    EMIT(p, HTTP_EV_MESSAGE_COMPLETE, NULL, 0);
+    reset_request(p);
+    return 0;
+}
+
+/* Multipart decoder. Boundaries are matched byte by byte, so the
+ * delimiter may straddle any number of fragments. Part data is reported
+ * as runs pointing into 'data'; bytes that looked like the start of a
+ * delimiter in a previous fragment but turned out not to be one are
+ * reported from p->delim itself, which holds exactly those bytes.
+ * Boundary characters never include CR (RFC 2046), so after a mismatch
+ * the only possible restart is at the current byte.
+ */
+static int multipart_feed(struct http_parser *p, const uint8_t *data, uint32_t n)
+{
+    const uint8_t *run = data;
+    uint32_t mstart = 0;
+    uint32_t i = 0;
+    uint32_t used;
+    int ret;
+
+    while (i < n) {
+        uint8_t c;
+        switch (p->mp_state) {
+            case MP_PREAMBLE:
+            case MP_DATA:
+                c = data[i];
+                if (p->delim_match > 0) {
+                    if (c == (uint8_t)p->delim[p->delim_match]) {
+                        p->delim_match++;
+                        i++;
+                        if (p->delim_match == p->delim_len) {
+                            if (p->mp_state == MP_DATA) {
+                                if (p->delim_in_buf && (&data[mstart] > run))
+                                    EMIT(p, HTTP_EV_PART_DATA, run, &data[mstart] - run);
+                                EMIT(p, HTTP_EV_PART_END, NULL, 0);
+                            }
+                            p->delim_match = 0;
+                            p->delim_in_buf = 0;
+                            p->line_len = 0;
+                            p->mp_state = MP_AFTER_DELIM;
+                        }
+                        break;
+                    }
+                    /* Not a delimiter after all */
+                    if (!p->delim_in_buf) {
+                        if (p->mp_state == MP_DATA)
+                            EMIT(p, HTTP_EV_PART_DATA, p->delim, p->delim_match);
+                        run = &data[i];
+                    }
+                    p->delim_match = 0;
+                    p->delim_in_buf = 0;
+                }
+                if (c == '\r') {
+                    p->delim_match = 1;
+                    p->delim_in_buf = 1;
+                    mstart = i;
+                }
+                i++;
+                break;
+
+            case MP_AFTER_DELIM:
+                /* Either "--" (close delimiter) or transport padding + CRLF */
+                c = data[i++];
+                if (c == '-') {
+                    if (p->line_len == 1)
+                        p->mp_state = MP_EPILOGUE;
+                    else
+                        p->line_len = 1;
+                } else if (c == '\n') {
+                    p->line_len = 0;
+                    p->part_name[0] = '\0';
+                    p->mp_state = MP_PART_HEADERS;
+                } else if ((c != '\r') && (c != ' ') && (c != '\t')) {
+                    return HTTP_ERR_SYNTAX;
+                }
+                break;
+
+            case MP_PART_HEADERS:
+                ret = line_feed(p->line, &p->line_len, HTTP_LINE_MAX,
+                        data + i, n - i, &used);
+                i += used;
+                if (ret < 0)
+                    return ret;
+                if (ret == 0)
+                    break;
+                if (p->line_len == 0) {
+                    EMIT(p, HTTP_EV_PART_BEGIN, p->part_name, strlen(p->part_name));
+                    p->mp_state = MP_DATA;
+                    p->delim_match = 0;
+                    p->delim_in_buf = 0;
+                    run = &data[i];
+                } else {
+                    parse_part_header(p);
+                    EMIT(p, HTTP_EV_PART_HEADER, p->line, p->line_len);
+                }
+                p->line_len = 0;
+                break;
+
+            case MP_EPILOGUE:
+            default:
+                i = n;
+                break;
+        }
+    }
+
+    /* End of fragment: flush the data run, holding back a partial
+     * delimiter match if there is one. */
+    if (p->mp_state == MP_DATA) {
+        const uint8_t *end = &data[n];
+        if (p->delim_match > 0)
+            end = p->delim_in_buf ? &data[mstart] : run;
+        if (end > run)
+            EMIT(p, HTTP_EV_PART_DATA, run, end - run);
+    }
+    p->delim_in_buf = 0;
+    return 0;
+}
+
+static int body_data(struct http_parser *p, const uint8_t *data, uint32_t n)
+{
+    if (n == 0)
+        return 0;
+    if (p->flags & HTTP_F_MULTIPART)
+        return multipart_feed(p, data, n);
+    EMIT(p, HTTP_EV_BODY, data, n);
+    return 0;
+}
+
+static int chunk_size(const char *line, uint32_t *size)
+{
+    uint32_t n = 0;
+    int digits = 0;
+    for (;; line++) {
+        char c = lc(*line);
+        if ((c >= '0') && (c <= '9'))
+            c = c - '0';
+        else if ((c >= 'a') && (c <= 'f'))
+            c = c - 'a' + 10;
+        else
+            break;
+        if (n > 0x0FFFFFFF)
+            return HTTP_ERR_TOO_LONG;
+        n = (n << 4) | (uint32_t)c;
+        digits++;
+    }
+    if ((digits == 0) || ((*line != '\0') && (*line != ';') && (*line != ' ')))
+        return HTTP_ERR_SYNTAX;
+    *size = n;
+    return 0;
+}
+
+static int body_feed(struct http_parser *p, const uint8_t *buf, uint32_t len,
+        uint32_t *used)
+{
+    uint32_t n;
+    int ret;
+
+    *used = 0;
+    if (!(p->flags & HTTP_F_CHUNKED)) {
+        n = p->content_length - p->body_read;
+        if (n > len)
+            n = len;
+        p->body_read += n;
+        *used = n;
+        ret = body_data(p, buf, n);
+        if (ret != 0)
+            return ret;
+        if (p->body_read == p->content_length)
+            return message_complete(p);
+        return 0;
+    }
+
+    switch (p->body_state) {
+        case BODY_CHUNK_DATA:
+            n = p->chunk_left;
+            if (n > len)
+                n = len;
+            p->chunk_left -= n;
+            p->body_read += n;
+            *used = n;
+            if (p->chunk_left == 0)
+                p->body_state = BODY_CHUNK_CRLF;
+            return body_data(p, buf, n);
+
+        case BODY_CHUNK_SIZE:
+        case BODY_CHUNK_CRLF:
+        case BODY_TRAILERS:
+        default:
+            ret = line_feed(p->chunk_line, &p->chunk_line_len,
+                    sizeof(p->chunk_line), buf, len, used);
+            if (ret <= 0)
+                return ret;
+            p->chunk_line_len = 0;
+            if (p->body_state == BODY_CHUNK_CRLF) {
+                if (p->chunk_line[0] != '\0')
+                    return HTTP_ERR_SYNTAX;
+                p->body_state = BODY_CHUNK_SIZE;
+            } else if (p->body_state == BODY_CHUNK_SIZE) {
+                ret = chunk_size(p->chunk_line, &p->chunk_left);
+                if (ret != 0)
+                    return ret;
+                p->body_state = (p->chunk_left == 0) ? BODY_TRAILERS : BODY_CHUNK_DATA;
+            } else if (p->chunk_line[0] == '\0') {
+                return message_complete(p);
+            }
+            return 0;
+    }
+}
+
+int http_parse(struct http_parser *p, const uint8_t *buf, uint32_t len)
+{
+    uint32_t used;
+    int ret;
+
+    while (len > 0) {
+        if (p->state == ST_BODY) {
+            ret = body_feed(p, buf, len, &used);
+        } else {
+            ret = line_feed(p->line, &p->line_len, HTTP_LINE_MAX, buf, len, &used);
+            if (ret > 0) {
+                ret = 0;
+                p->line_len = 0;
+                if (p->state == ST_REQ_LINE) {
+                    /* Tolerate empty lines before the request line */
+                    if (p->line[0] != '\0') {
+                        ret = parse_request_line(p);
+                        if (ret == 0) {
+                            p->state = ST_HEADERS;
+                            EMIT(p, HTTP_EV_REQUEST, p->url, strlen(p->url));
+                        }
+                    }
+                } else if (p->line[0] != '\0') {
+                    ret = parse_header(p);
+                    if (ret == 0)
+                        EMIT(p, HTTP_EV_HEADER, p->line, strlen(p->line));
+                } else {
+                    EMIT(p, HTTP_EV_HEADERS_COMPLETE, NULL, 0);
+                    if ((p->flags & HTTP_F_CHUNKED) || (p->content_length > 0))
+                        p->state = ST_BODY;
+                    else
+                        ret = message_complete(p);
+                }
+            }
+        }
+        if (ret != 0)
+            return ret;
+        buf += used;
+        len -= used;
+    }
+    return 0;
+}
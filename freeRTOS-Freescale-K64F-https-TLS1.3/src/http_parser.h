@@ -0,0 +1,121 @@
+/* http_parser.h
+ *
+ * Incremental HTTP/1.1 request parser with multipart/form-data support
+ *
+ * The parser is fed with whatever comes out of wolfSSL_read(), one
+ * fragment at a time, and keeps its state across calls: request line,
+ * headers, chunk size lines and multipart boundaries may be split at any
+ * byte. Header lines are collected in a small line buffer; body and
+ * file part data are never copied and are passed to the callback as
+ * pointers into the caller's buffer.
+ *
+ * Copyright (C) 2019 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+#include <stdint.h>
+
+#ifndef HTTP_LINE_MAX
+#define HTTP_LINE_MAX      256
+#endif
+#define HTTP_URL_MAX       64
+#define HTTP_BOUNDARY_MAX  72   /* RFC 2046, section 5.1.1 */
+
+enum http_method {
+    HTTP_METHOD_UNKNOWN = 0,
+    HTTP_METHOD_GET,
+    HTTP_METHOD_HEAD,
+    HTTP_METHOD_POST
+};
+
+/* Events passed to the callback. For HTTP_EV_HEADER and
+ * HTTP_EV_PART_HEADER, 'data' points to the full header line
+ * ("Name: value"), NUL-terminated. For HTTP_EV_BODY and HTTP_EV_PART_DATA
+ * 'data' points into the buffer passed to http_parse().
+ */
+enum http_event {
+    HTTP_EV_REQUEST,          /* Request line parsed: method, url set     */
+    HTTP_EV_HEADER,           /* One request header line                  */
+    HTTP_EV_HEADERS_COMPLETE, /* Empty line after the headers             */
+    HTTP_EV_BODY,             /* Body data (non-multipart requests)       */
+    HTTP_EV_PART_HEADER,      /* One header line of a multipart part      */
+    HTTP_EV_PART_BEGIN,       /* Part headers done: part_name set         */
+    HTTP_EV_PART_DATA,        /* Part content                             */
+    HTTP_EV_PART_END,         /* Boundary found after part content        */
+    HTTP_EV_MESSAGE_COMPLETE  /* Whole request received                   */
+};
+
+#define HTTP_ERR_SYNTAX     (-1)
+#define HTTP_ERR_TOO_LONG   (-2)
+#define HTTP_ERR_ABORTED    (-3)
+
+#define HTTP_F_CHUNKED      0x01
+#define HTTP_F_MULTIPART    0x02
+#define HTTP_F_CLOSE        0x04
+#define HTTP_F_HAS_LENGTH   0x08
+
+struct http_parser;
+
+/* Returning non-zero from the callback stops the parser, and the value is
+ * returned by http_parse(). */
+typedef int (*http_cb)(struct http_parser *p, enum http_event ev,
+        const uint8_t *data, uint32_t len);
+
+struct http_parser {
+    /* Request */
+    enum http_method method;
+    char url[HTTP_URL_MAX];
+    uint32_t flags;
+    uint32_t content_length;
+    uint32_t body_read;       /* Raw body bytes consumed so far */
+    char part_name[32];
+
+    /* Internal state */
+    uint8_t state;
+    uint8_t body_state;
+    uint8_t mp_state;
+    uint16_t line_len;
+    uint16_t chunk_line_len;
+    uint32_t chunk_left;
+    uint16_t delim_len;
+    uint16_t delim_match;
+    uint8_t delim_in_buf;
+    char delim[HTTP_BOUNDARY_MAX + 4];   /* "\r\n--" boundary */
+    char line[HTTP_LINE_MAX];
+    char chunk_line[20];
+
+    http_cb cb;
+    void *arg;
+};
+
+void http_parser_init(struct http_parser *p, http_cb cb, void *arg);
+
+/* Feed 'len' bytes. Returns 0 when all the bytes have been consumed, or
+ * a negative HTTP_ERR_* / the callback's non-zero return value.
+ * After HTTP_EV_MESSAGE_COMPLETE the parser is ready for the next request
+ * on the same connection.
+ */
+int http_parse(struct http_parser *p, const uint8_t *buf, uint32_t len);
+
+/* Case-insensitive match of a header line name. Returns a pointer to the
+ * value (leading whitespace skipped) or NULL.
+ */
+const char *http_header_value(const char *line, const char *name);
+
+#endif /* HTTP_PARSER_H */
@@ -0,0 +1,117 @@
+/* http_response.c
+ *
+ * Allocation-free HTTP response builder
+ *
+ * Copyright (C) 2019 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+#include <string.h>
+#include "http_response.h"
+
+void http_buf_init(struct http_buf *b, char *buf, uint32_t size)
+{
+    b->buf = buf;
+    b->size = size;
+    b->len = 0;
+    b->overflow = 0;
+}
+
+void http_buf_mem(struct http_buf *b, const void *data, uint32_t len)
+{
+    if (len > b->size - b->len) {
+        len = b->size - b->len;
+        b->overflow = 1;
+    }
+    memcpy(b->buf + b->len, data, len);
+    b->len += len;
+}
+
+void http_buf_str(struct http_buf *b, const char *s)
+{
+    http_buf_mem(b, s, strlen(s));
+}
+
+void http_buf_dec(struct http_buf *b, uint32_t v)
+{
+    char tmp[10];
+    char out[10];
+    int i = 0, j = 0;
+    do {
+        tmp[i++] = '0' + (v % 10);
+        v /= 10;
+    } while (v);
+    while (i > 0)
+        out[j++] = tmp[--i];
+    http_buf_mem(b, out, j);
+}
+
+void http_buf_int(struct http_buf *b, int32_t v)
+{
+    if (v < 0) {
+        http_buf_mem(b, "-", 1);
+        http_buf_dec(b, (uint32_t)0 - (uint32_t)v);
+    } else {
+        http_buf_dec(b, (uint32_t)v);
+    }
+}
+
+void http_buf_hex(struct http_buf *b, uint32_t v, int digits)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    char out[8];
+    int i;
+    if (digits > 8)
+        digits = 8;
+    for (i = digits - 1; i >= 0; i--) {
+        out[i] = hex[v & 0x0F];
+        v >>= 4;
+    }
+    http_buf_mem(b, out, digits);
+}
+
+int http_response_render(struct http_buf *out, const char *status,
+        const char *ctype, const char *etag, const char *extra_hdrs,
+        const char *body, uint32_t body_len, uint32_t *hdr_len)
+{
+    http_buf_str(out, "HTTP/1.1 ");
+    http_buf_str(out, status);
+    http_buf_str(out, "\r\n");
+    if (ctype) {
+        http_buf_str(out, "Content-Type: ");
+        http_buf_str(out, ctype);
+        http_buf_str(out, "\r\n");
+    }
+    http_buf_str(out, "Content-Length: ");
+    http_buf_dec(out, body_len);
+    http_buf_str(out, "\r\n");
+    if (etag) {
+        http_buf_str(out, "ETag: ");
+        http_buf_str(out, etag);
+        http_buf_str(out, "\r\n");
+    }
+    if (extra_hdrs)
+        http_buf_str(out, extra_hdrs);
+    http_buf_str(out, "\r\n");
+    if (hdr_len)
+        *hdr_len = out->len;
+    if (body_len)
+        http_buf_mem(out, body, body_len);
+    if (out->overflow)
+        return -1;
+    return (int)out->len;
+}
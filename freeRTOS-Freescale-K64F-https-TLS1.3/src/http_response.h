@@ -0,0 +1,56 @@
+/* http_response.h
+ *
+ * Allocation-free HTTP response builder
+ *
+ * Responses are rendered into caller-provided static buffers, so that a
+ * complete response (headers and body) can be handed to wolfSSL_write()
+ * in a single call and sent as a single TLS record.
+ *
+ * Copyright (C) 2019 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+#ifndef HTTP_RESPONSE_H
+#define HTTP_RESPONSE_H
+#include <stdint.h>
+
+struct http_buf {
+    char *buf;
+    uint32_t size;
+    uint32_t len;
+    int overflow;       /* Set if anything was truncated */
+};
+
+void http_buf_init(struct http_buf *b, char *buf, uint32_t size);
+void http_buf_mem(struct http_buf *b, const void *data, uint32_t len);
+void http_buf_str(struct http_buf *b, const char *s);
+void http_buf_dec(struct http_buf *b, uint32_t v);
+void http_buf_int(struct http_buf *b, int32_t v);
+/* Fixed-width, upper case hexadecimal */
+void http_buf_hex(struct http_buf *b, uint32_t v, int digits);
+
+/* Render a complete response into 'out': status line, Content-Type,
+ * Content-Length, optional ETag and extra header lines (each terminated
+ * by CRLF), then the body. Returns the length of the response, or -1 if
+ * it does not fit. The offset of the body is stored in '*hdr_len' if not
+ * NULL, so that HEAD requests can send the headers only.
+ */
+int http_response_render(struct http_buf *out, const char *status,
+        const char *ctype, const char *etag, const char *extra_hdrs,
+        const char *body, uint32_t body_len, uint32_t *hdr_len);
+
+#endif /* HTTP_RESPONSE_H */
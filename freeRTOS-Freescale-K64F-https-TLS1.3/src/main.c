@@ -32,6 +32,7 @@
 #include "pico_ipv4.h"
 #include "pico_socket.h"
 #include "pico_enet_kinetis.h"
+#include "hw_rng.h"
 #include "board.h"
 #include "pin_mux.h"
 #include "clock_config.h"
@@ -40,7 +41,20 @@
 #include "wolfssl/ssl.h"
 #include "certs.h"
 #include "semphr.h"
+#include "event_groups.h"
 #include "wolfboot/wolfboot.h"
+#include "http_parser.h"
+#include "fw_update.h"
+#include "tls_ticket.h"
+#include "bench.h"
+#include "http_response.h"
+#include "alloc_stress.h"
+#ifdef K64F_HEAP_TRACE
+#include "heap_trace.h"
+#endif
+#ifdef K64F_STATIC_ALLOC
+#include "slab.h"
+#endif
 
 extern unsigned int _stored_data;
 extern unsigned int _start_data;
@@ -50,9 +64,8 @@ extern unsigned int _end_bss;
 extern unsigned int _end_stack;
 extern unsigned int _start_heap;
 
-static volatile struct pico_socket *cli = NULL;
 static SemaphoreHandle_t *picotcp_started;
-static SemaphoreHandle_t *picotcp_rx_data;
+static EventGroupHandle_t https_events;
 
 static void reboot(void)
 {
@@ -95,7 +108,14 @@ void init_data_bss(void)
 #include "task.h"
 
 static __attribute__ ((used,section(".noinit.$SRAM_LOWER_Heap5"))) uint8_t heap_sram_lower[16*1024]; /* placed in in no_init section inside SRAM_LOWER */
-static __attribute__ ((used,section(".noinit_Heap5"))) uint8_t heap_sram_upper[128*1024]; /* placed in in no_init section inside SRAM_UPPER */
+#ifdef K64F_STATIC_ALLOC
+/* Task stacks, kernel objects and the slab pools (src/slab.c) are static,
+ * the heap only serves the large allocations */
+#define HEAP_UPPER_SIZE (72*1024)
+#else
+#define HEAP_UPPER_SIZE (128*1024)
+#endif
+static __attribute__ ((used,section(".noinit_Heap5"))) uint8_t heap_sram_upper[HEAP_UPPER_SIZE]; /* placed in in no_init section inside SRAM_UPPER */
 
 static HeapRegion_t xHeapRegions[] =
 {
@@ -104,52 +124,331 @@ static HeapRegion_t xHeapRegions[] =
   { NULL, 0 } //  << Terminates the array.
 };
 
-int pico_send(void *ssl, char *buf, int len, void *ctx)
+/* HTTPS connection pool. Connections are accepted from the picoTCP
+ * socket callback into a free slot, then served by MainTask through a
+ * per-connection state machine.
+ */
+/* Task priorities above idle, see PICO_PRIO/MAIN_PRIO in the Makefile */
+#ifndef PICO_TASK_PRIO
+#define PICO_TASK_PRIO 0
+#endif
+#ifndef MAIN_TASK_PRIO
+#define MAIN_TASK_PRIO 0
+#endif
+#if (tskIDLE_PRIORITY + PICO_TASK_PRIO >= configMAX_PRIORITIES) || \
+    (tskIDLE_PRIORITY + MAIN_TASK_PRIO >= configMAX_PRIORITIES)
+#error "PICO_PRIO and MAIN_PRIO must be below configMAX_PRIORITIES"
+#endif
+
+#define PICO_TASK_STACK 400
+#define MAIN_TASK_STACK 1200
+
+#ifdef K64F_STATIC_ALLOC
+static StackType_t pico_task_stack[PICO_TASK_STACK];
+static StaticTask_t pico_task_tcb;
+static StackType_t main_task_stack[MAIN_TASK_STACK];
+static StaticTask_t main_task_tcb;
+static StaticSemaphore_t picotcp_started_buf;
+static StaticEventGroup_t https_events_buf;
+
+/* Kernel task memory, required by configSUPPORT_STATIC_ALLOCATION */
+void vApplicationGetIdleTaskMemory(StaticTask_t **tcb, StackType_t **stack,
+        uint32_t *stack_size)
 {
-    struct pico_socket *s = (struct pico_socket *)ctx;
-    int r;
-    r = pico_socket_write(s, buf, len);
-    if (r > 0)
-        return r;
-    else
-        return WOLFSSL_CBIO_ERR_WANT_WRITE;
+    static StaticTask_t idle_tcb;
+    static StackType_t idle_stack[configMINIMAL_STACK_SIZE];
+    *tcb = &idle_tcb;
+    *stack = idle_stack;
+    *stack_size = configMINIMAL_STACK_SIZE;
 }
 
-int pico_recv(void *ssl, char *buf, int len, void *ctx)
+void vApplicationGetTimerTaskMemory(StaticTask_t **tcb, StackType_t **stack,
+        uint32_t *stack_size)
 {
-    struct pico_socket *s = (struct pico_socket *)ctx;
-    int r;
-    r = pico_socket_read(s, buf, len);
-    if (r > 0)
-        return r;
-    else
-        return WOLFSSL_CBIO_ERR_WANT_READ;
+    static StaticTask_t timer_tcb;
+    static StackType_t timer_stack[configTIMER_TASK_STACK_DEPTH];
+    *tcb = &timer_tcb;
+    *stack = timer_stack;
+    *stack_size = configTIMER_TASK_STACK_DEPTH;
+}
+#endif
+
+#ifndef HTTPS_MAX_CONN
+#define HTTPS_MAX_CONN              3
+#endif
+#define HTTPS_HANDSHAKE_TIMEOUT_MS  20000
+#define HTTPS_IDLE_TIMEOUT_MS       30000
+#define HTTPS_READ_BUDGET           8
+#define HTTPS_EARLY_DATA_MAX        512
+#define HTTPS_DRAIN_TIMEOUT_MS      1000
+#define HTTPS_POLL_MS               1000    /* Timeout checks */
+
+/* MainTask wake-up events, set by socket_cb() in the PicoTask context.
+ * Bits 0-1 are for the listening socket and for MainTask itself, then
+ * each connection slot owns three bits (24 bits available).
+ */
+#define HTTPS_EV_ACCEPT     (1 << 0)
+#define HTTPS_EV_KICK       (1 << 1)    /* More work pending: don't sleep */
+#define CONN_EV_RD          1
+#define CONN_EV_WR          2
+#define CONN_EV_CLOSE       4
+#define CONN_EV(i, ev)      ((EventBits_t)(ev) << (2 + 3 * (i)))
+
+#if HTTPS_MAX_CONN > 7
+#error "HTTPS_MAX_CONN: not enough event bits"
+#endif
+
+#define CONN_FREE       0
+#define CONN_ACCEPTED   1
+#define CONN_HANDSHAKE  2
+#define CONN_HTTP       3
+
+struct https_conn {
+    volatile uint8_t state;
+    volatile uint8_t peer_closed;
+    uint8_t close_after;
+    uint8_t early;              /* Parsing 0-RTT data */
+    uint8_t not_modified;       /* If-None-Match matched the index ETag */
+    volatile uint8_t writable;  /* PICO_SOCK_EV_WR since the last write */
+    struct pico_socket *sock;
+    WOLFSSL *ssl;
+    TickType_t last_activity;
+    TickType_t hs_start;
+    volatile uint32_t rd_stamp; /* Cycle count at the first unread PICO_SOCK_EV_RD */
+    const void *tx_buf;         /* Response waiting for the TCP send queue */
+    int tx_len;
+#ifdef HTTPS_BENCH
+    uint32_t stream_left;       /* Bytes of /bench/download still to send */
+#endif
+    struct http_parser req;
+#ifdef WOLFSSL_EARLY_DATA
+    uint16_t early_len;         /* 0-RTT bytes received */
+#endif
+};
+
+static struct https_conn conn_pool[HTTPS_MAX_CONN];
+static struct https_conn *upload_conn = NULL;
+
+/* TLS handshake statistics */
+static struct hs_stats {
+    uint32_t full;
+    uint32_t resumed;
+    uint32_t early_data;
+    uint32_t full_ms;       /* Cumulative time of full handshakes */
+    uint32_t resumed_ms;    /* Cumulative time of resumed handshakes */
+} hs_stats;
+
+/* I/O statistics */
+static struct io_stats {
+    uint32_t want_write;    /* Writes deferred because the TCP send queue was full */
+    uint32_t wake_n;        /* Socket readable to data read by MainTask */
+    uint32_t wake_us;
+    uint32_t wake_us_max;
+    uint32_t dl_bytes;      /* Last /bench/download */
+    uint32_t dl_ms;
+} io_stats;
+
+static TaskHandle_t pico_task = NULL;
+static TaskHandle_t main_task = NULL;
+
+static struct https_conn *conn_find(struct pico_socket *s)
+{
+    int i;
+    for (i = 0; i < HTTPS_MAX_CONN; i++) {
+        if ((conn_pool[i].state != CONN_FREE) && (conn_pool[i].sock == s))
+            return &conn_pool[i];
+    }
+    return NULL;
 }
 
 static void socket_cb(uint16_t ev, struct pico_socket *s)
 {
     struct pico_ip4 client_addr;
     uint16_t client_port;
+    struct https_conn *c;
+    int i;
     if (ev & PICO_SOCK_EV_CONN) {
-        cli = pico_socket_accept(s, &client_addr, &client_port);
+        struct pico_socket *cs = pico_socket_accept(s, &client_addr, &client_port);
+        if (!cs)
+            return;
+        for (i = 0; i < HTTPS_MAX_CONN; i++) {
+            if (conn_pool[i].state == CONN_FREE)
+                break;
+        }
+        if (i == HTTPS_MAX_CONN) {
+            /* Pool exhausted */
+            pico_socket_close(cs);
+            return;
+        }
+        conn_pool[i].sock = cs;
+        conn_pool[i].peer_closed = 0;
+        conn_pool[i].state = CONN_ACCEPTED;
+        xEventGroupSetBits(https_events, HTTPS_EV_ACCEPT);
         return;
     }
+    c = conn_find(s);
+    if (!c)
+        return;
+    i = c - conn_pool;
+    if (ev & (PICO_SOCK_EV_FIN | PICO_SOCK_EV_CLOSE | PICO_SOCK_EV_ERR)) {
+        c->peer_closed = 1;
+        xEventGroupSetBits(https_events, CONN_EV(i, CONN_EV_CLOSE));
+    }
+    if (ev & PICO_SOCK_EV_WR) {
+        c->writable = 1;
+        xEventGroupSetBits(https_events, CONN_EV(i, CONN_EV_WR));
+    }
     if (ev & PICO_SOCK_EV_RD) {
-        xSemaphoreGive(picotcp_rx_data);
+        if (!c->rd_stamp)
+            c->rd_stamp = DWT->CYCCNT | 1;
+        xEventGroupSetBits(https_events, CONN_EV(i, CONN_EV_RD));
     }
+}
+
+/* Events MainTask needs to wait for, given the state of each connection */
+static EventBits_t https_wait_mask(void)
+{
+    EventBits_t mask = HTTPS_EV_ACCEPT | HTTPS_EV_KICK;
+    int i;
+    for (i = 0; i < HTTPS_MAX_CONN; i++) {
+        switch (conn_pool[i].state) {
+            case CONN_HANDSHAKE:
+                mask |= CONN_EV(i, CONN_EV_RD | CONN_EV_WR | CONN_EV_CLOSE);
+                break;
+            case CONN_HTTP:
+                if (conn_pool[i].tx_len > 0)
+                    mask |= CONN_EV(i, CONN_EV_WR | CONN_EV_CLOSE);
+                else
+                    mask |= CONN_EV(i, CONN_EV_RD | CONN_EV_CLOSE);
+                break;
+            default:
+                break;
+        }
+    }
+    return mask;
+}
+
+/* Time from PICO_SOCK_EV_RD to the data being read by MainTask */
+static void https_wake_latency(struct https_conn *c)
+{
+    uint32_t us;
+    if (!c->rd_stamp)
+        return;
+    us = (DWT->CYCCNT - c->rd_stamp) / (SystemCoreClock / 1000000);
+    c->rd_stamp = 0;
+    io_stats.wake_n++;
+    io_stats.wake_us += us;
+    if (us > io_stats.wake_us_max)
+        io_stats.wake_us_max = us;
+}
+
+/* wolfSSL I/O callbacks. The I/O context is the connection: records are
+ * read from the picoTCP socket queue directly into wolfSSL's input buffer,
+ * and written from wolfSSL's output buffer directly into the TCP send
+ * queue, without any intermediate buffer.
+ */
+int pico_send(void *ssl, char *buf, int len, void *ctx)
+{
+    struct https_conn *c = (struct https_conn *)ctx;
+    int r;
+    r = pico_socket_write(c->sock, buf, len);
+    if (r > 0)
+        return r;
+    if (r < 0)
+        return WOLFSSL_CBIO_ERR_GENERAL;
+    io_stats.want_write++;
+    return WOLFSSL_CBIO_ERR_WANT_WRITE;
+}
+
+int pico_recv(void *ssl, char *buf, int len, void *ctx)
+{
+    struct https_conn *c = (struct https_conn *)ctx;
+    int r;
+    r = pico_socket_read(c->sock, buf, len);
+    if (r > 0)
+        return r;
+    if (r < 0)
+        return WOLFSSL_CBIO_ERR_GENERAL;
+    if (c->peer_closed)
+        return WOLFSSL_CBIO_ERR_CONN_CLOSE;
+    return WOLFSSL_CBIO_ERR_WANT_READ;
+}
 
+static int https_conn_want_io(struct https_conn *c, int res)
+{
+    int err = wolfSSL_get_error(c->ssl, res);
+    return (err == SSL_ERROR_WANT_READ) || (err == SSL_ERROR_WANT_WRITE);
 }
 
-static const char http_html_transfer_complete[] = "HTTP/1.1 200 OK\r\nContent-type: text/html\r\nContent-Length: 170\r\n\r\n<html><meta http-equiv='refresh' content='30'/><body><p>Firmware transfer successful.</p><p>Update verification in progress. Please wait 30 seconds...</p></body></html>\r\n";
-static const char http_html_internal_error[] = "HTTP/1.1 500 Server Error\r\n";
-static const char http_html_hdr[] = "HTTP/1.1 200 OK\r\nContent-type: text/html\r\nContent-Length: ";
+/* Retry a deferred response. Returns 1 while it is still pending. */
+static int https_conn_flush(struct https_conn *c)
+{
+    int res;
+    if (c->tx_len == 0)
+        return 0;
+    c->writable = 0;
+    res = wolfSSL_write(c->ssl, c->tx_buf, c->tx_len);
+    if ((res <= 0) && https_conn_want_io(c, res))
+        return 1;
+    if (res <= 0)
+        c->close_after = 1;
+    c->tx_len = 0;
+    return 0;
+}
+
+/* Wait until a deferred response is in the TCP send queue */
+static void https_conn_drain(struct https_conn *c, uint32_t ms)
+{
+    TickType_t start = xTaskGetTickCount();
+    EventBits_t ev = CONN_EV(c - conn_pool, CONN_EV_WR | CONN_EV_CLOSE);
+    while (https_conn_flush(c) && !c->peer_closed &&
+            ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(ms))) {
+        xEventGroupWaitBits(https_events, ev, pdTRUE, pdFALSE, pdMS_TO_TICKS(10));
+    }
+}
+
+/* Send a response. Responses fit in one TLS record, which wolfSSL
+ * encrypts into its output buffer at once: if the TCP send queue is full,
+ * the connection keeps the pending write and retries it when picoTCP
+ * reports the socket as writable, instead of spinning here. The caller's
+ * buffer can be reused in the meantime.
+ */
+static void https_conn_write(struct https_conn *c, const void *buf, int len)
+{
+    int res;
+    if (c->tx_len > 0) {
+        /* Pipelined request: wait for the previous response */
+        https_conn_drain(c, HTTPS_DRAIN_TIMEOUT_MS);
+        if (c->tx_len > 0) {
+            c->close_after = 1;
+            return;
+        }
+    }
+    c->writable = 0;
+    res = wolfSSL_write(c->ssl, buf, len);
+    if (res == len)
+        return;
+    if ((res <= 0) && https_conn_want_io(c, res)) {
+        c->tx_buf = buf;
+        c->tx_len = len;
+        return;
+    }
+    c->close_after = 1;
+}
 
+static const char http_html_transfer_complete[] = "<html><meta http-equiv='refresh' content='30'/><body><p>Firmware transfer successful.</p>";
+static const char http_html_transfer_wait[] = "<p>Update verification in progress. Please wait 30 seconds...</p></body></html>\r\n";
+static const char http_html_internal_error[] = "HTTP/1.1 500 Server Error\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char http_html_too_early[] = "HTTP/1.1 425 Too Early\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char http_html_busy[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char http_not_found[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
 
-static char http_index_html[] = "<html><head><title>wolfSSL Firmware Update</title></head>"
+static const char http_index_head[] = "<html><head><title>wolfSSL Firmware Update</title></head>"
     "<body><img src='https://www.wolfssl.com/wordpress/wp-content/uploads/2019/01/wolfssl_logo-branding-1.png' alt='wolfSSL logo'></img>&nbsp;&nbsp;&nbsp;&nbsp;"
     "<img src='https://blog.mozilla.org/security/files/2018/08/TLS1.3-Badge-Color-512px-252x236.png' height='118' width='126' alt='tls 1.3 badge'></img><br>"
     "<h1>wolfSSL firmware update page</h1></br>"
-    "Current version: 0x00000000<br>"
+    "Current version: 0x";
+static const char http_index_tail[] = "<br>"
     "<p><form enctype='multipart/form-data' action='/update.cgi' method='POST'>"
    "Firmware: <input type='FILE' name='file'/>"
    "<input type='submit' name='Update' value='Update' />"
@@ -157,143 +456,874 @@ static char http_index_html[] = "<html><head><title>wolfSSL Firmware Update</tit
    "</body>\r\n"
    "</html>\r\n\r\n";
 
-uint8_t fw_buffer[2048];
+/* Worst case length of /status.json, every number at 10 digits: the
+ * fields always present, then each optional section built in */
+#define STATUS_JSON_BASE        1200
+#if K64F_HEAP == 6
+#define STATUS_HEAP_CLASSES     8
+#define STATUS_JSON_CLASSES     (16 + (STATUS_HEAP_CLASSES * 80))
+#else
+#define STATUS_JSON_CLASSES     0
+#endif
+#ifdef K64F_STATIC_ALLOC
+#define STATUS_JSON_SLAB        (40 + (SLAB_POOLS * 104))
+#else
+#define STATUS_JSON_SLAB        0
+#endif
+#ifdef ALLOC_STRESS
+#define STATUS_JSON_STRESS      100
+#else
+#define STATUS_JSON_STRESS      0
+#endif
+#ifdef PICO_MUTEX_STATS
+#define STATUS_JSON_LOCKS       100
+#else
+#define STATUS_JSON_LOCKS       0
+#endif
+#ifdef ENET_LOOPBACK_STRESS
+#define STATUS_JSON_LOOPBACK    176
+#else
+#define STATUS_JSON_LOOPBACK    0
+#endif
+#define STATUS_JSON_MAX (STATUS_JSON_BASE + STATUS_JSON_CLASSES + \
+        STATUS_JSON_SLAB + STATUS_JSON_STRESS + STATUS_JSON_LOCKS + \
+        STATUS_JSON_LOOPBACK)
+
+/* Scratch buffers for the response bodies and for complete responses,
+ * with room for the headers */
+#if STATUS_JSON_MAX > 2048
+#define HTTP_BODY_SIZE          STATUS_JSON_MAX
+#else
+#define HTTP_BODY_SIZE          2048
+#endif
+static char http_body[HTTP_BODY_SIZE];
+static char http_response[HTTP_BODY_SIZE + 512];
 
-static void parse_update(WOLFSSL *ssl, char *inbuf, size_t size)
+/* The index page only depends on the running firmware version, which is
+ * constant until the next reboot: the complete response is rendered once
+ * at boot, and sent with a single wolfSSL_write() (one TLS record).
+ * Clients revalidating with If-None-Match get a 304 without the body.
+ */
+static char index_response[1280];
+static uint32_t index_response_len;
+static uint32_t index_hdr_len;
+static char index_not_modified[64];
+static uint32_t index_not_modified_len;
+static char index_etag[12];
+
+static void index_render(void)
 {
-    uint32_t fw_off = 0;
-    uint32_t buf_off = 0;
-    uint32_t fw_siz = 0;
-    int i = 0;
-    int res;
-    while (i < size) {
-        if (strncmp(&inbuf[i], "\r\n\r\nWOLF", 8) == 0) {
-            i+=4;
-            fw_siz = inbuf[i + 4] + ((inbuf[i + 5]) << 8) + ((inbuf[i + 6]) << 16) + ((inbuf[i + 7]) << 24);
+    uint32_t version = wolfBoot_current_firmware_version();
+    struct http_buf body, out;
 
-            break;
+    http_buf_init(&out, index_etag, sizeof(index_etag) - 1);
+    http_buf_str(&out, "\"v");
+    http_buf_hex(&out, version, 8);
+    http_buf_str(&out, "\"");
+    index_etag[out.len] = '\0';
+
+    http_buf_init(&body, http_body, sizeof(http_body));
+    http_buf_str(&body, http_index_head);
+    http_buf_hex(&body, version, 8);
+    http_buf_str(&body, http_index_tail);
+
+    http_buf_init(&out, index_response, sizeof(index_response));
+    if (http_response_render(&out, "200 OK", "text/html", index_etag, NULL,
+                body.buf, body.len, &index_hdr_len) < 0)
+        while(1)
+            ;
+    index_response_len = out.len;
+
+    http_buf_init(&out, index_not_modified, sizeof(index_not_modified));
+    http_buf_str(&out, "HTTP/1.1 304 Not Modified\r\nETag: ");
+    http_buf_str(&out, index_etag);
+    http_buf_str(&out, "\r\n\r\n");
+    index_not_modified_len = out.len;
+}
+
+static int etag_matches(const char *if_none_match)
+{
+    return (if_none_match[0] == '*') || (strstr(if_none_match, index_etag) != NULL);
+}
+
+static void send_index(struct https_conn *c, int head_only)
+{
+    if (c->not_modified)
+        https_conn_write(c, index_not_modified, index_not_modified_len);
+    else
+        https_conn_write(c, index_response, head_only ? index_hdr_len : index_response_len);
+}
+
+#ifdef HTTPS_BENCH
+static void send_bench(struct https_conn *c)
+{
+    const struct bench_result *r;
+    int n = bench_results(&r);
+    int i;
+    struct http_buf body, out;
+
+    http_buf_init(&body, http_body, sizeof(http_body));
+    http_buf_str(&body, "config: ");
+    http_buf_str(&body, bench_config());
+    http_buf_str(&body, "\n");
+    for (i = 0; i < n; i++) {
+        http_buf_str(&body, r[i].name);
+        http_buf_str(&body, ": ops=");
+        http_buf_dec(&body, r[i].count);
+        http_buf_str(&body, " us=");
+        http_buf_dec(&body, r[i].us);
+        if (r[i].count) {
+            http_buf_str(&body, " us/op=");
+            http_buf_dec(&body, r[i].us / r[i].count);
         }
-        i++;
-    }
-    if ((fw_siz > WOLFBOOT_PARTITION_SIZE) || (fw_siz < WOLFBOOT_SECTOR_SIZE))
-        goto internal_error;
-    fw_siz += 0x100;
-
-    if (i < size) {
-        memcpy(fw_buffer, &inbuf[i], (size - i));
-        buf_off = size - i;
-    }
-    hal_flash_unlock();
-    while(fw_off < fw_siz) {
-        res = wolfSSL_read(ssl, fw_buffer + buf_off, 2048 - buf_off);
-        if (res > 0) {
-            buf_off += res;
-            if ((buf_off == 2048) || (fw_siz - fw_off <= buf_off)) {
-                if ((fw_off % WOLFBOOT_SECTOR_SIZE) == 0)
-                    hal_flash_erase(WOLFBOOT_PARTITION_UPDATE_ADDRESS + fw_off, WOLFBOOT_SECTOR_SIZE);
-                if (fw_off + buf_off > fw_siz) {
-                    buf_off = fw_siz - fw_off;
-                    memset(fw_buffer + buf_off, 0xFF, 2048 - buf_off);
-                }
-                hal_flash_write(WOLFBOOT_PARTITION_UPDATE_ADDRESS + fw_off, fw_buffer, 2048);
-                fw_off += buf_off;
-                buf_off = 0;
+        if (r[i].bytes && r[i].us) {
+            http_buf_str(&body, " KB/s=");
+            http_buf_dec(&body, (uint32_t)(((uint64_t)r[i].bytes * 1000000) / (1024 * (uint64_t)r[i].us)));
+        }
+        if (r[i].heap) {
+            http_buf_str(&body, " heap=");
+            http_buf_dec(&body, r[i].heap);
+        }
+        http_buf_str(&body, "\n");
+    }
+    if (n == 0)
+        http_buf_str(&body, "running...\n");
+    if (io_stats.dl_bytes) {
+        http_buf_str(&body, "download: bytes=");
+        http_buf_dec(&body, io_stats.dl_bytes);
+        http_buf_str(&body, " ms=");
+        http_buf_dec(&body, io_stats.dl_ms);
+        if (io_stats.dl_ms) {
+            http_buf_str(&body, " KB/s=");
+            http_buf_dec(&body, (uint32_t)(((uint64_t)io_stats.dl_bytes * 1000) / (1024 * (uint64_t)io_stats.dl_ms)));
+        }
+        http_buf_str(&body, "\n");
+    }
+    http_buf_init(&out, http_response, sizeof(http_response));
+    if (http_response_render(&out, "200 OK", "text/plain", NULL, NULL,
+                body.buf, body.len, NULL) > 0)
+        https_conn_write(c, out.buf, out.len);
+}
+
+/* GET /bench/download?kb=N: N KB of filler data, sent in records of
+ * HTTPS_STREAM_CHUNK bytes as fast as the TCP send queue drains. Used to
+ * measure the TLS transmit throughput from a host, e.g. with curl.
+ */
+#define HTTPS_STREAM_CHUNK  4096
+#define HTTPS_STREAM_MAX_KB (16 * 1024)
+static const uint8_t stream_chunk[HTTPS_STREAM_CHUNK];
+static TickType_t stream_start;
+
+static void send_download(struct https_conn *c, const char *url)
+{
+    const char *q = strstr(url, "kb=");
+    uint32_t kb = 0;
+    struct http_buf out;
+    if (q) {
+        for (q += 3; (*q >= '0') && (*q <= '9'); q++)
+            kb = kb * 10 + (*q - '0');
+    }
+    if ((kb == 0) || (kb > HTTPS_STREAM_MAX_KB))
+        kb = 1024;
+    http_buf_init(&out, http_response, sizeof(http_response));
+    http_response_render(&out, "200 OK", "application/octet-stream", NULL, NULL,
+            NULL, kb * 1024, NULL);
+    https_conn_write(c, out.buf, out.len);
+    c->stream_left = kb * 1024;
+    io_stats.dl_bytes = 0;
+    io_stats.dl_ms = 0;
+    stream_start = xTaskGetTickCount();
+    xEventGroupSetBits(https_events, HTTPS_EV_KICK);
+}
+
+/* Queue the next records of a download, until the send queue is full */
+static void https_conn_stream(struct https_conn *c)
+{
+    int budget = HTTPS_READ_BUDGET;
+    while ((c->stream_left > 0) && (c->tx_len == 0) && !c->close_after &&
+            (budget-- > 0)) {
+        uint32_t n = c->stream_left;
+        if (n > HTTPS_STREAM_CHUNK)
+            n = HTTPS_STREAM_CHUNK;
+        https_conn_write(c, stream_chunk, n);
+        c->stream_left -= n;
+        io_stats.dl_bytes += n;
+    }
+    if (c->stream_left == 0)
+        io_stats.dl_ms = (xTaskGetTickCount() - stream_start) * portTICK_PERIOD_MS;
+    else if ((c->tx_len == 0) && !c->close_after)
+        xEventGroupSetBits(https_events, HTTPS_EV_KICK);
+}
+#endif
+
+static const char *part_state_name(uint8_t part)
+{
+    uint8_t st;
+    if (wolfBoot_get_partition_state(part, &st) != 0)
+        return "none";
+    switch (st) {
+        case IMG_STATE_NEW:
+            return "new";
+        case IMG_STATE_UPDATING:
+            return "updating";
+        case IMG_STATE_TESTING:
+            return "testing";
+        case IMG_STATE_SUCCESS:
+            return "success";
+        default:
+            return "unknown";
+    }
+}
+
+static void json_task(struct http_buf *b, TaskHandle_t t, int last)
+{
+    http_buf_str(b, "{\"name\":\"");
+    http_buf_str(b, pcTaskGetName(t));
+    http_buf_str(b, "\",\"stack_free\":");
+    http_buf_dec(b, uxTaskGetStackHighWaterMark(t) * sizeof(StackType_t));
+    http_buf_str(b, last ? "}" : "},");
+}
+
+/* Heap usage and fragmentation: the share of the free memory that is not
+ * in the largest free block, in percent */
+static void json_heap(struct http_buf *b)
+{
+    HeapStats_t hs;
+#if defined(K64F_STATIC_ALLOC) || (K64F_HEAP == 6)
+    int i;
+#endif
+#ifdef ALLOC_STRESS
+    const struct alloc_stress_stats *st = alloc_stress_stats();
+#endif
+
+    vPortGetHeapStats(&hs);
+    http_buf_str(b, "\"heap\":{\"free\":");
+    http_buf_dec(b, hs.xAvailableHeapSpaceInBytes);
+    http_buf_str(b, ",\"min_free\":");
+    http_buf_dec(b, hs.xMinimumEverFreeBytesRemaining);
+    http_buf_str(b, ",\"largest_free\":");
+    http_buf_dec(b, hs.xSizeOfLargestFreeBlockInBytes);
+    http_buf_str(b, ",\"free_blocks\":");
+    http_buf_dec(b, hs.xNumberOfFreeBlocks);
+    http_buf_str(b, ",\"fragmentation\":");
+    http_buf_dec(b, hs.xAvailableHeapSpaceInBytes ?
+            100 - hs.xSizeOfLargestFreeBlockInBytes * 100 / hs.xAvailableHeapSpaceInBytes : 0);
+    http_buf_str(b, ",\"allocs\":");
+    http_buf_dec(b, hs.xNumberOfSuccessfulAllocations);
+    http_buf_str(b, ",\"frees\":");
+    http_buf_dec(b, hs.xNumberOfSuccessfulFrees);
+#if K64F_HEAP == 6
+    {
+        SizeClassStats_t cs[STATUS_HEAP_CLASSES];
+        UBaseType_t n = uxPortGetSizeClassStats(cs, STATUS_HEAP_CLASSES);
+        http_buf_str(b, ",\"classes\":[");
+        for (i = 0; i < (int)n; i++) {
+            http_buf_str(b, i ? ",{\"size\":" : "{\"size\":");
+            http_buf_dec(b, cs[i].xBlockSize);
+            http_buf_str(b, ",\"free\":");
+            http_buf_dec(b, cs[i].xFreeBlocks);
+            http_buf_str(b, ",\"hits\":");
+            http_buf_dec(b, cs[i].xHits);
+            http_buf_str(b, ",\"misses\":");
+            http_buf_dec(b, cs[i].xMisses);
+            http_buf_str(b, "}");
+        }
+        http_buf_str(b, "]");
+    }
+#endif
+    http_buf_str(b, "}");
+#ifdef K64F_STATIC_ALLOC
+    http_buf_str(b, ",\"slab\":{\"large\":");
+    http_buf_dec(b, slab_large_allocs());
+    http_buf_str(b, ",\"pools\":[");
+    for (i = 0; i < slab_count(); i++) {
+        const struct slab_stats *ss = slab_stats(i);
+        http_buf_str(b, i ? ",{\"size\":" : "{\"size\":");
+        http_buf_dec(b, ss->size);
+        http_buf_str(b, ",\"count\":");
+        http_buf_dec(b, ss->count);
+        http_buf_str(b, ",\"used\":");
+        http_buf_dec(b, ss->used);
+        http_buf_str(b, ",\"used_max\":");
+        http_buf_dec(b, ss->used_max);
+        http_buf_str(b, ",\"fallback\":");
+        http_buf_dec(b, ss->fallback);
+        http_buf_str(b, "}");
+    }
+    http_buf_str(b, "]}");
+#endif
+#ifdef ALLOC_STRESS
+    http_buf_str(b, ",\"stress\":{\"iterations\":");
+    http_buf_dec(b, st->iterations);
+    http_buf_str(b, ",\"failures\":");
+    http_buf_dec(b, st->failures);
+    http_buf_str(b, ",\"live\":");
+    http_buf_dec(b, st->live_bytes);
+    http_buf_str(b, ",\"live_max\":");
+    http_buf_dec(b, st->live_max);
+    http_buf_str(b, "}");
+#endif
+}
+
+/* Incremented by the FreeRTOS trace hooks, see FreeRTOSConfig.h */
+volatile uint32_t rtos_tick_irqs;
+volatile uint32_t rtos_idle_exits;
+
+/* Wake-ups per second since the previous call */
+static void json_power(struct http_buf *b)
+{
+    static uint32_t last_ms, last_irqs, last_exits;
+    uint32_t now = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    uint32_t irqs = rtos_tick_irqs, exits = rtos_idle_exits;
+    uint32_t ms = now - last_ms;
+
+#ifdef K64F_TICKLESS
+    http_buf_str(b, "\"power\":{\"tickless\":true,\"tick_irqs\":");
+#else
+    http_buf_str(b, "\"power\":{\"tickless\":false,\"tick_irqs\":");
+#endif
+    http_buf_dec(b, irqs);
+    http_buf_str(b, ",\"idle_exits\":");
+    http_buf_dec(b, exits);
+    http_buf_str(b, ",\"interval_ms\":");
+    http_buf_dec(b, ms);
+    http_buf_str(b, ",\"tick_irqs_s\":");
+    http_buf_dec(b, ms ? (uint32_t)(((uint64_t)(irqs - last_irqs) * 1000) / ms) : 0);
+    http_buf_str(b, ",\"idle_exits_s\":");
+    http_buf_dec(b, ms ? (uint32_t)(((uint64_t)(exits - last_exits) * 1000) / ms) : 0);
+    http_buf_str(b, "}");
+    last_ms = now;
+    last_irqs = irqs;
+    last_exits = exits;
+}
+
+/* GET /status.json: machine-readable state of the device, rendered in
+ * http_body without any allocation. Sizes are in bytes, times in ms.
+ */
+static void send_status(struct https_conn *c)
+{
+    const struct fw_update_stats *up = fw_update_stats();
+    const struct pico_enet_stats *net = pico_enet_stats();
+    struct http_buf body, out;
+    int i, active = 0;
+
+    for (i = 0; i < HTTPS_MAX_CONN; i++) {
+        if (conn_pool[i].state != CONN_FREE)
+            active++;
+    }
+
+    http_buf_init(&body, http_body, sizeof(http_body));
+    http_buf_str(&body, "{\"version\":{\"boot\":");
+    http_buf_dec(&body, wolfBoot_current_firmware_version());
+    http_buf_str(&body, ",\"update\":");
+    http_buf_dec(&body, wolfBoot_update_firmware_version());
+    http_buf_str(&body, "},\"partition\":{\"boot\":\"");
+    http_buf_str(&body, part_state_name(PART_BOOT));
+    http_buf_str(&body, "\",\"update\":\"");
+    http_buf_str(&body, part_state_name(PART_UPDATE));
+    http_buf_str(&body, "\"},\"uptime_ms\":");
+    http_buf_dec(&body, xTaskGetTickCount() * portTICK_PERIOD_MS);
+    http_buf_str(&body, ",");
+    json_heap(&body);
+    http_buf_str(&body, ",");
+    json_power(&body);
+    http_buf_str(&body, ",\"tasks\":[");
+    json_task(&body, main_task, 0);
+    json_task(&body, pico_task, 1);
+    http_buf_str(&body, "],\"net\":{\"link\":");
+    if (net->link_up) {
+        http_buf_str(&body, net->link_speed ? "\"100M" : "\"10M");
+        http_buf_str(&body, net->link_duplex ? "-full\"" : "-half\"");
+    } else {
+        http_buf_str(&body, "\"down\"");
+    }
+    http_buf_str(&body, ",\"link_changes\":");
+    http_buf_dec(&body, net->link_changes);
+    http_buf_str(&body, ",\"rx_frames\":");
+    http_buf_dec(&body, net->rx_frames);
+    http_buf_str(&body, ",\"rx_bytes\":");
+    http_buf_dec(&body, net->rx_bytes);
+    http_buf_str(&body, ",\"rx_errors\":");
+    http_buf_dec(&body, net->rx_errors);
+    http_buf_str(&body, ",\"rx_dropped\":");
+    http_buf_dec(&body, net->rx_dropped);
+    http_buf_str(&body, ",\"rx_overrun\":");
+    http_buf_dec(&body, net->rx_overrun);
+    http_buf_str(&body, ",\"tx_frames\":");
+    http_buf_dec(&body, net->tx_frames);
+    http_buf_str(&body, ",\"tx_bytes\":");
+    http_buf_dec(&body, net->tx_bytes);
+    http_buf_str(&body, ",\"tx_busy\":");
+    http_buf_dec(&body, net->tx_busy);
+    http_buf_str(&body, ",\"tx_dropped\":");
+    http_buf_dec(&body, net->tx_dropped);
+    http_buf_str(&body, ",\"tx_wait\":");
+    http_buf_dec(&body, io_stats.want_write);
+    http_buf_str(&body, ",\"rx_wake_us_avg\":");
+    http_buf_dec(&body, io_stats.wake_n ? io_stats.wake_us / io_stats.wake_n : 0);
+    http_buf_str(&body, ",\"rx_wake_us_max\":");
+    http_buf_dec(&body, io_stats.wake_us_max);
+#ifdef PICO_MUTEX_STATS
+    {
+        const struct pico_mutex_stats *ms = pico_mutex_stats();
+        http_buf_str(&body, ",\"locks\":{\"taken\":");
+        http_buf_dec(&body, ms->locks);
+        http_buf_str(&body, ",\"contended\":");
+        http_buf_dec(&body, ms->contended);
+        http_buf_str(&body, ",\"wait_ms\":");
+        http_buf_dec(&body, ms->wait_ms);
+        http_buf_str(&body, ",\"wait_ms_max\":");
+        http_buf_dec(&body, ms->wait_ms_max);
+        http_buf_str(&body, "}");
+    }
+#endif
+#ifdef ENET_LOOPBACK_STRESS
+    {
+        const struct pico_enet_stress *st = pico_enet_stress();
+        http_buf_str(&body, ",\"loopback\":{\"ms\":");
+        http_buf_dec(&body, st->ms);
+        http_buf_str(&body, ",\"sent\":");
+        http_buf_dec(&body, st->sent);
+        http_buf_str(&body, ",\"received\":");
+        http_buf_dec(&body, st->received);
+        http_buf_str(&body, ",\"frames_s\":");
+        http_buf_dec(&body, st->ms ? (uint32_t)(((uint64_t)st->received * 1000) / st->ms) : 0);
+        http_buf_str(&body, ",\"dropped\":");
+        http_buf_dec(&body, st->sent - st->received);
+        http_buf_str(&body, ",\"busy\":");
+        http_buf_dec(&body, st->busy);
+        http_buf_str(&body, ",\"errors\":");
+        http_buf_dec(&body, st->errors);
+        http_buf_str(&body, ",\"overrun\":");
+        http_buf_dec(&body, st->overrun);
+        http_buf_str(&body, "}");
+    }
+#endif
+    http_buf_str(&body, ",\"tcp_sockets\":");
+    http_buf_dec(&body, pico_count_sockets(PICO_PROTO_TCP));
+    http_buf_str(&body, ",\"https_conn\":");
+    http_buf_dec(&body, active);
+    http_buf_str(&body, "},\"tls\":{\"full\":");
+    http_buf_dec(&body, hs_stats.full);
+    http_buf_str(&body, ",\"full_ms\":");
+    http_buf_dec(&body, hs_stats.full_ms);
+    http_buf_str(&body, ",\"resumed\":");
+    http_buf_dec(&body, hs_stats.resumed);
+    http_buf_str(&body, ",\"resumed_ms\":");
+    http_buf_dec(&body, hs_stats.resumed_ms);
+    http_buf_str(&body, ",\"early_data\":");
+    http_buf_dec(&body, hs_stats.early_data);
+    http_buf_str(&body, "},\"upload\":{\"bytes\":");
+    http_buf_dec(&body, up->bytes);
+    http_buf_str(&body, ",\"ms\":");
+    http_buf_dec(&body, up->ms);
+    http_buf_str(&body, ",\"kbps\":");
+    http_buf_dec(&body, up->kbps);
+    http_buf_str(&body, ",\"result\":");
+    http_buf_int(&body, up->result);
+    http_buf_str(&body, "}}\n");
+
+    /* Never send truncated JSON, see STATUS_JSON_MAX */
+    http_buf_init(&out, http_response, sizeof(http_response));
+    if (!body.overflow && http_response_render(&out, "200 OK",
+                "application/json", NULL, "Cache-Control: no-store\r\n",
+                body.buf, body.len, NULL) > 0)
+        https_conn_write(c, out.buf, out.len);
+    else
+        https_conn_write(c, http_html_internal_error, strlen(http_html_internal_error));
+}
+
+#ifdef K64F_HEAP_TRACE
+/* GET /heap-trace: the heap operations recorded since the previous request,
+ * as many as fit in http_body, in the heap-bench trace format:
+ *   m <address> <size> <caller> <ms>
+ *   f <address> <size> <caller> <ms>
+ * The size of an allocation is the size requested (block size minus the
+ * header, rounded up to 8 bytes). Call again while "# pending" is not 0.
+ */
+#define HEAP_TRACE_LINE 48
+static void send_heap_trace(struct https_conn *c)
+{
+    struct heap_trace_rec rec[8];
+    struct http_buf body, out;
+    uint32_t lost, pending = 0, lost_total = 0;
+    int i, n;
+
+    http_buf_init(&body, http_body, sizeof(http_body));
+    http_buf_str(&body, "# heap trace, uptime ");
+    http_buf_dec(&body, xTaskGetTickCount() * portTICK_PERIOD_MS);
+    http_buf_str(&body, " ms\n");
+    while (body.size - body.len >= (8 * HEAP_TRACE_LINE) + 64) {
+        n = heap_trace_read(rec, 8, &lost, &pending);
+        lost_total += lost;
+        for (i = 0; i < n; i++) {
+            uint32_t size = rec[i].size & ~HEAP_TRACE_FREE;
+            if (rec[i].size & HEAP_TRACE_FREE) {
+                http_buf_str(&body, "f ");
+            } else {
+                http_buf_str(&body, "m ");
+                if (size >= HEAP_TRACE_HDR)
+                    size -= HEAP_TRACE_HDR;
             }
+            http_buf_hex(&body, rec[i].addr, 8);
+            http_buf_str(&body, " ");
+            http_buf_dec(&body, size);
+            http_buf_str(&body, " ");
+            http_buf_hex(&body, rec[i].caller, 8);
+            http_buf_str(&body, " ");
+            http_buf_dec(&body, rec[i].ms);
+            http_buf_str(&body, "\n");
         }
-        xSemaphoreTake(picotcp_rx_data, pdMS_TO_TICKS(100));
+        if ((n == 0) || (pending == 0))
+            break;
+    }
+    if (lost_total) {
+        http_buf_str(&body, "# lost ");
+        http_buf_dec(&body, lost_total);
+        http_buf_str(&body, "\n");
     }
-    if (fw_off == fw_siz) {
-        wolfSSL_write(ssl, http_html_transfer_complete, strlen(http_html_transfer_complete));
+    http_buf_str(&body, "# pending ");
+    http_buf_dec(&body, pending);
+    http_buf_str(&body, "\n");
+
+    http_buf_init(&out, http_response, sizeof(http_response));
+    if (http_response_render(&out, "200 OK", "text/plain", NULL,
+                "Cache-Control: no-store\r\n", body.buf, body.len, NULL) > 0)
+        https_conn_write(c, out.buf, out.len);
+    else
+        https_conn_write(c, http_html_internal_error, strlen(http_html_internal_error));
+}
+#endif
+
+static void send_update_result(struct https_conn *c, int result)
+{
+    if (result == 0) {
+        const struct fw_update_stats *st = fw_update_stats();
+        struct http_buf body, out;
+        http_buf_init(&body, http_body, sizeof(http_body));
+        http_buf_str(&body, http_html_transfer_complete);
+        http_buf_str(&body, "<p>");
+        http_buf_dec(&body, st->bytes);
+        http_buf_str(&body, " bytes in ");
+        http_buf_dec(&body, st->ms);
+        http_buf_str(&body, " ms (");
+        http_buf_dec(&body, st->kbps);
+        http_buf_str(&body, " KB/s)</p>");
+        http_buf_str(&body, http_html_transfer_wait);
+
+        http_buf_init(&out, http_response, sizeof(http_response));
+        if (http_response_render(&out, "200 OK", "text/html", NULL, NULL,
+                    body.buf, body.len, NULL) > 0)
+            https_conn_write(c, out.buf, out.len);
+        https_conn_drain(c, HTTPS_DRAIN_TIMEOUT_MS);
         wolfBoot_update_trigger();
-        
+
         /* Wait one second, reboot */
         vTaskDelay(pdMS_TO_TICKS(1000));
         reboot();
         return;
     }
+    https_conn_write(c, http_html_internal_error, strlen(http_html_internal_error));
+}
+
+/* Request handler: called by the parser as the request is decoded. The
+ * 'file' part of a POST to /update.cgi is streamed to the update partition
+ * while it is being received.
+ */
+#define HTTPS_BUSY      1
+#define HTTPS_TOO_EARLY 2
+
+static int https_request(struct http_parser *p, enum http_event ev,
+        const uint8_t *data, uint32_t len)
+{
+    struct https_conn *c = (struct https_conn *)p->arg;
+    switch (ev) {
+        case HTTP_EV_REQUEST:
+            /* Only the idempotent GET is allowed in 0-RTT data (RFC 8470) */
+            if (c->early && (p->method != HTTP_METHOD_GET))
+                return HTTPS_TOO_EARLY;
+            c->not_modified = 0;
+            break;
+        case HTTP_EV_HEADER:
+            {
+                const char *v = http_header_value((const char *)data, "If-None-Match");
+                if (v && etag_matches(v))
+                    c->not_modified = 1;
+            }
+            break;
+        case HTTP_EV_PART_BEGIN:
+            if ((p->method == HTTP_METHOD_POST) && (strcmp(p->part_name, "file") == 0)) {
+                /* One upload at a time */
+                if (upload_conn && (upload_conn != c))
+                    return HTTPS_BUSY;
+                upload_conn = c;
+                fw_update_begin();
+            }
+            break;
+        case HTTP_EV_PART_DATA:
+            if ((upload_conn == c) && fw_update_active() &&
+                    (fw_update_write(data, len) < 0))
+                return HTTP_ERR_ABORTED;
+            break;
+        case HTTP_EV_PART_END:
+            if ((upload_conn == c) && fw_update_active() && (fw_update_end() < 0))
+                return HTTP_ERR_ABORTED;
+            break;
+        case HTTP_EV_MESSAGE_COMPLETE:
+            if (p->flags & HTTP_F_CLOSE)
+                c->close_after = 1;
+            if ((p->method == HTTP_METHOD_GET) || (p->method == HTTP_METHOD_HEAD)) {
+                if ((strcmp(p->url, "/") == 0) || (strcmp(p->url, "/index.html") == 0)) {
+                    send_index(c, p->method == HTTP_METHOD_HEAD);
+                    break;
+                }
+                if (strcmp(p->url, "/status.json") == 0) {
+                    send_status(c);
+                    break;
+                }
+#ifdef K64F_HEAP_TRACE
+                if (strcmp(p->url, "/heap-trace") == 0) {
+                    send_heap_trace(c);
+                    break;
+                }
+#endif
+#ifdef HTTPS_BENCH
+                if (strcmp(p->url, "/bench") == 0) {
+                    send_bench(c);
+                    break;
+                }
+                if (strncmp(p->url, "/bench/download", 15) == 0) {
+                    send_download(c, p->url);
+                    break;
+                }
+#endif
+                https_conn_write(c, http_not_found, strlen(http_not_found));
+            } else if (p->method == HTTP_METHOD_POST) {
+                int result = -1;
+                if (upload_conn == c) {
+                    upload_conn = NULL;
+                    result = fw_update_stats()->result;
+                }
+                send_update_result(c, result);
+                if (result != 0)
+                    c->close_after = 1;
+            }
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
 
-internal_error:
-    wolfSSL_write(ssl, http_html_internal_error, strlen(http_html_internal_error));
-    return;
+static char HttpReq[1024];
+
+static void https_conn_close(struct https_conn *c)
+{
+    if (upload_conn == c) {
+        fw_update_abort();
+        upload_conn = NULL;
+    }
+    if (c->ssl) {
+        if (!c->peer_closed)
+            wolfSSL_shutdown(c->ssl);
+        wolfSSL_free(c->ssl);
+        c->ssl = NULL;
+    }
+    if (c->sock)
+        pico_socket_close(c->sock);
+    c->sock = NULL;
+    xEventGroupClearBits(https_events, CONN_EV(c - conn_pool, CONN_EV_RD | CONN_EV_WR | CONN_EV_CLOSE));
+    c->close_after = 0;
+    c->tx_len = 0;
+#ifdef HTTPS_BENCH
+    c->stream_left = 0;
+#endif
+    c->state = CONN_FREE;
 }
 
-static void set_version(uint8_t *buf, int off)
+/* Output still to be sent before reading the next request */
+static int https_conn_pending(struct https_conn *c)
 {
-    uint32_t fw_version = wolfBoot_current_firmware_version();
-    uint8_t *vp = (uint8_t *) (&fw_version);
-    int i;
+#ifdef HTTPS_BENCH
+    if (c->stream_left > 0)
+        return 1;
+#endif
+    return c->tx_len > 0;
+}
 
-    for (i = 3; i >= 0; i--) {
-        char *a = &buf[off++];
-        char *b = &buf[off++];
-        char v;
-        v = (vp[i] & 0xF0) >> 4;
-        *a = v;
-        v = vp[i] & 0x0F;
-        *b = v;
-        if (*a < 9) 
-            *a += '0';
-        else
-            *a += 'A';
-        if (*b < 9)
-            *b += '0';
-        else
-            *b += 'A';
-    }
-}
-
-static void https_request(WOLFSSL *ssl, char *url, int size)
-{
-    char lens[8] = "000\r\n\r\n";
-    int  response_len;
-    char *p;
-    if (size >= 5 &&
-            url[0] == 'G' &&
-            url[1] == 'E' &&
-            url[2] == 'T' &&
-            url[3] == ' ' &&
-            url[4] == '/') {
-
-        response_len = strlen(http_index_html);
-        wolfSSL_write(ssl, http_html_hdr, strlen(http_html_hdr));
-        lens[0] = response_len / 100 + '0';
-        lens[1] = (response_len % 100) / 10 + '0';
-        lens[2] = (response_len % 10) + '0';
-        wolfSSL_write(ssl, lens, strlen(lens));
-        set_version(http_index_html, 424);
-        wolfSSL_write(ssl, http_index_html, response_len); 
-    }
-    if (size >= 6 &&
-            url[0] == 'P' &&
-            url[1] == 'O' &&
-            url[2] == 'S' &&
-            url[3] == 'T' &&
-            url[4] == ' ') {
-        parse_update(ssl, url, size);
+/* Feed decrypted application data to the connection's HTTP parser */
+static void https_conn_input(struct https_conn *c, const uint8_t *buf, int len)
+{
+    int res = http_parse(&c->req, buf, len);
+    if (res == 0)
+        return;
+    if (res == HTTPS_BUSY)
+        https_conn_write(c, http_html_busy, strlen(http_html_busy));
+    else if (res == HTTPS_TOO_EARLY)
+        https_conn_write(c, http_html_too_early, strlen(http_html_too_early));
+    else
+        https_conn_write(c, http_html_internal_error,
+                strlen(http_html_internal_error));
+    c->close_after = 1;
+}
 
+static void https_handshake_done(struct https_conn *c)
+{
+    uint32_t ms = (xTaskGetTickCount() - c->hs_start) * portTICK_PERIOD_MS;
+    if (wolfSSL_session_reused(c->ssl)) {
+        hs_stats.resumed++;
+        hs_stats.resumed_ms += ms;
+    } else {
+        hs_stats.full++;
+        hs_stats.full_ms += ms;
     }
 }
 
+static void https_conn_service(WOLFSSL_CTX *ctx, struct https_conn *c, TickType_t now)
+{
+    int res;
+    int budget = HTTPS_READ_BUDGET;
+#ifdef WOLFSSL_EARLY_DATA
+    int early_sz;
+#endif
 
-static char HttpReq[1024];
+    switch (c->state) {
+        case CONN_ACCEPTED:
+            c->ssl = wolfSSL_new(ctx);
+            if (!c->ssl) {
+                https_conn_close(c);
+                return;
+            }
+            wolfSSL_SetIOReadCtx(c->ssl, c);
+            wolfSSL_SetIOWriteCtx(c->ssl, c);
+            wolfSSL_set_using_nonblock(c->ssl, 1);
+            http_parser_init(&c->req, https_request, c);
+            c->close_after = 0;
+            c->early = 0;
+            c->writable = 1;
+            c->tx_len = 0;
+            c->last_activity = now;
+            c->hs_start = xTaskGetTickCount();
+#ifdef WOLFSSL_EARLY_DATA
+            c->early_len = 0;
+#endif
+            c->state = CONN_HANDSHAKE;
+            /* Fall through */
+        case CONN_HANDSHAKE:
+#ifdef WOLFSSL_EARLY_DATA
+            /* Requests in 0-RTT data are parsed and answered as soon as they
+             * are decrypted, before the client Finished arrives: the
+             * response goes out as 0.5-RTT data. wolfSSL_read_early_data()
+             * returns a byte count, so completion is only taken from
+             * wolfSSL_is_init_finished(). Once HTTPS_EARLY_DATA_MAX bytes
+             * were read the client cannot send more early data, and the
+             * handshake is completed with wolfSSL_accept(). */
+            do {
+                early_sz = 0;
+                if (c->early_len < HTTPS_EARLY_DATA_MAX) {
+                    uint32_t room = HTTPS_EARLY_DATA_MAX - c->early_len;
+                    if (room > sizeof(HttpReq))
+                        room = sizeof(HttpReq);
+                    res = wolfSSL_read_early_data(c->ssl, HttpReq, room, &early_sz);
+                } else {
+                    res = wolfSSL_accept(c->ssl);
+                }
+                if (early_sz > 0) {
+                    if (c->early_len == 0)
+                        hs_stats.early_data++;
+                    c->early_len += early_sz;
+                    if (!c->close_after) {
+                        c->early = 1;
+                        https_conn_input(c, (uint8_t *)HttpReq, early_sz);
+                        c->early = 0;
+                    }
+                }
+            } while ((early_sz > 0) && !wolfSSL_is_init_finished(c->ssl) &&
+                    (--budget > 0));
+            if ((early_sz > 0) && (budget == 0))
+                xEventGroupSetBits(https_events, HTTPS_EV_KICK);
+#else
+            res = wolfSSL_accept(c->ssl);
+#endif
+            if (wolfSSL_is_init_finished(c->ssl)) {
+                https_handshake_done(c);
+                c->rd_stamp = 0;
+                c->last_activity = now;
+                c->state = CONN_HTTP;
+                /* Application data may already be decrypted and buffered
+                 * by wolfSSL, with no socket event to come for it */
+                xEventGroupSetBits(https_events, HTTPS_EV_KICK);
+            } else if (((res < 0) && !https_conn_want_io(c, res)) || c->peer_closed ||
+                    ((now - c->last_activity) > pdMS_TO_TICKS(HTTPS_HANDSHAKE_TIMEOUT_MS))) {
+                https_conn_close(c);
+            }
+            return;
+
+        case CONN_HTTP:
+            /* A deferred response is retried once the socket is writable;
+             * no new request is read until it is out */
+            if (c->tx_len > 0) {
+                if (c->writable && (https_conn_flush(c) == 0))
+                    c->last_activity = now;
+            }
+#ifdef HTTPS_BENCH
+            if (c->tx_len == 0)
+                https_conn_stream(c);
+#endif
+            if (https_conn_pending(c)) {
+                if (c->peer_closed ||
+                        ((now - c->last_activity) > pdMS_TO_TICKS(HTTPS_IDLE_TIMEOUT_MS)))
+                    https_conn_close(c);
+                return;
+            }
+            if (c->close_after) {
+                https_conn_close(c);
+                return;
+            }
+
+            /* Drain what is already available, within a budget so that the
+             * other connections are served during an upload */
+            do {
+                res = wolfSSL_read(c->ssl, HttpReq, sizeof(HttpReq));
+                if (res > 0) {
+                    c->last_activity = now;
+                    https_wake_latency(c);
+                    https_conn_input(c, (uint8_t *)HttpReq, res);
+                } else if (!https_conn_want_io(c, res)) {
+                    https_conn_close(c);
+                    return;
+                }
+            } while ((res > 0) && !c->close_after && !https_conn_pending(c) &&
+                    (--budget > 0));
+
+            if (https_conn_pending(c))
+                return;
+            if (c->close_after || (c->peer_closed && (res <= 0)) ||
+                    ((now - c->last_activity) > pdMS_TO_TICKS(HTTPS_IDLE_TIMEOUT_MS))) {
+                https_conn_close(c);
+            } else if (budget == 0) {
+                /* More data may be pending: come back without sleeping */
+                xEventGroupSetBits(https_events, HTTPS_EV_KICK);
+            }
+            return;
+
+        case CONN_FREE:
+        default:
+            return;
+    }
+}
 
 void MainTask(void *pv)
 {
-    int res;
     struct pico_socket *s;
     uint16_t port = short_be(443);
-    WOLFSSL *ssl;
     struct pico_ip4 any;
+    TickType_t now;
+    int i;
     wolfSSL_Init();
     xSemaphoreTake(picotcp_started, portMAX_DELAY);
     any.addr = 0;
 
-    s = pico_socket_open(PICO_PROTO_IPV4, PICO_PROTO_TCP, &socket_cb);
-    pico_socket_bind(s, &any, &port);
-    pico_socket_listen(s, 1);
-
-    cli = pico_socket_accept(s, NULL, NULL);
-
     WOLFSSL_CTX *ctx = wolfSSL_CTX_new(wolfTLSv1_3_server_method());
     if (wolfSSL_CTX_use_certificate_buffer( ctx, server_cert, server_cert_len, SSL_FILETYPE_ASN1) != SSL_SUCCESS)
         while(1);
@@ -302,55 +1332,78 @@ void MainTask(void *pv)
 
     wolfSSL_CTX_SetIORecv(ctx, pico_recv);
     wolfSSL_CTX_SetIOSend(ctx, pico_send);
+    if (tls_ticket_init(ctx) != 0)
+        while(1);
+#ifdef WOLFSSL_EARLY_DATA
+    wolfSSL_CTX_set_max_early_data(ctx, HTTPS_EARLY_DATA_MAX);
+#endif
 
-    while(!cli) {
-        vTaskDelay(pdMS_TO_TICKS(5));
-    }
-    ssl = wolfSSL_new(ctx);
-    if (!ssl)
-        while(1)
-            ;
+    s = pico_socket_open(PICO_PROTO_IPV4, PICO_PROTO_TCP, &socket_cb);
+    pico_socket_bind(s, &any, &port);
+    pico_socket_listen(s, HTTPS_MAX_CONN);
+
+    index_render();
     wolfBoot_success();
-    do {
-        wolfSSL_SetIOReadCtx(ssl, cli);
-        wolfSSL_SetIOWriteCtx(ssl, cli);
-        res = wolfSSL_accept(ssl);
-        xSemaphoreTake(picotcp_rx_data, pdMS_TO_TICKS(100));
-    } while (res != SSL_SUCCESS);
-    wolfSSL_set_using_nonblock(ssl, 1);
 
     while(1) {
-        res = wolfSSL_read(ssl, HttpReq, 1024);
-        if (res > 0) 
-            https_request(ssl, HttpReq, res);
-        xSemaphoreTake(picotcp_rx_data, pdMS_TO_TICKS(100));
+        TickType_t poll = portMAX_DELAY;
+        now = xTaskGetTickCount();
+        for (i = 0; i < HTTPS_MAX_CONN; i++) {
+            https_conn_service(ctx, &conn_pool[i], now);
+            /* Timeouts only need checking with a connection open */
+            if (conn_pool[i].state != CONN_FREE)
+                poll = pdMS_TO_TICKS(HTTPS_POLL_MS);
+        }
+        xEventGroupWaitBits(https_events, https_wait_mask(), pdTRUE, pdFALSE, poll);
     }
 }
 
 void PicoTask(void *pv) {
     struct pico_device *dev = NULL;
     struct pico_ip4 addr, mask, gw, any;
-    TickType_t xLastWakeTime;
+#ifndef PICO_SUPPORT_TICKLESS
     const TickType_t xFrequency = 5;
+#endif
+    uint8_t led_link = 0;
 
     pico_string_to_ipv4("192.168.178.211", &addr.addr);
     pico_string_to_ipv4("255.255.255.0", &mask.addr);
     pico_string_to_ipv4("192.168.178.1", &gw.addr);
     any.addr = 0;
     pico_stack_init();
+    /* Seed the picoTCP generator (ports, sequence numbers) */
+    pico_rand_feed(hw_rng_word());
+    pico_enet_set_rx_task(xTaskGetCurrentTaskHandle());
     dev = pico_enet_create("en0");
     if (dev) {
        pico_ipv4_link_add(dev, addr, mask); 
        pico_ipv4_route_add(any, any, gw, 1, NULL);
-       LED_GREEN_ON();
     }
     xSemaphoreGive(picotcp_started);
     pico_stack_tick();
 
-    xLastWakeTime = xTaskGetTickCount();
-    while(1) { 
-        vTaskDelayUntil(&xLastWakeTime, xFrequency);
+    while(1) {
+#ifdef PICO_SUPPORT_TICKLESS
+        /* Run the stack, then sleep until its next timer is due or the
+         * ENET interrupt signals a frame: with nothing else to run, the
+         * idle task stops the tick for that long */
+        long long next = pico_stack_go();
+        ulTaskNotifyTake(pdTRUE, (next < 0) ? portMAX_DELAY : pdMS_TO_TICKS((TickType_t)next));
+#else
+        /* Run the stack timers every xFrequency ticks, or as soon as the
+         * ENET RX interrupt signals a new frame */
+        ulTaskNotifyTake(pdTRUE, xFrequency);
         pico_stack_tick();
+#endif
+        hw_rng_harvest();
+        /* Green LED on while the link is up */
+        if (pico_enet_stats()->link_up != led_link) {
+            led_link = pico_enet_stats()->link_up;
+            if (led_link)
+                LED_GREEN_ON();
+            else
+                LED_GREEN_OFF();
+        }
     }
 }
 /*
@@ -363,31 +1416,50 @@ int main(void) {
     SYSMPU_Enable(SYSMPU, false);
 
     LED_GREEN_INIT(1);
+    hw_rng_init();
     vPortDefineHeapRegions(xHeapRegions); // Pass the array into vPortDefineHeapRegions(). Must be called first!
     
+#ifdef K64F_STATIC_ALLOC
+    picotcp_started = xSemaphoreCreateBinaryStatic(&picotcp_started_buf);
+    https_events = xEventGroupCreateStatic(&https_events_buf);
+#else
     picotcp_started = xSemaphoreCreateBinary();
-    picotcp_rx_data = xSemaphoreCreateBinary();
+    https_events = xEventGroupCreate();
+#endif
+
+    /* Cycle counter, used to time the socket wake-up latency */
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    bench_start();
+    alloc_stress_start();
 
+#ifdef K64F_STATIC_ALLOC
+    pico_task = xTaskCreateStatic(PicoTask, "picoTCP", PICO_TASK_STACK, NULL,
+            tskIDLE_PRIORITY + PICO_TASK_PRIO, pico_task_stack, &pico_task_tcb);
+    main_task = xTaskCreateStatic(MainTask, "Main", MAIN_TASK_STACK, NULL,
+            tskIDLE_PRIORITY + MAIN_TASK_PRIO, main_task_stack, &main_task_tcb);
+#else
     if (xTaskCreate(
         PicoTask,  /* pointer to the task */
         "picoTCP", /* task name for kernel awareness debugging */
-        400, /* task stack size */
+        PICO_TASK_STACK, /* task stack size */
         (void*)NULL, /* optional task startup argument */
-        tskIDLE_PRIORITY,  /* initial priority */
-        (xTaskHandle*)NULL /* optional task handle to create */
+        tskIDLE_PRIORITY + PICO_TASK_PRIO,  /* initial priority */
+        &pico_task /* optional task handle to create */
       ) != pdPASS) {
        for(;;){} /* error! probably out of memory */
     }
     if (xTaskCreate(
         MainTask,  /* pointer to the task */
         "Main", /* task name for kernel awareness debugging */
-        1200, /* task stack size */
+        MAIN_TASK_STACK, /* task stack size */
         (void*)NULL, /* optional task startup argument */
-        tskIDLE_PRIORITY,  /* initial priority */
-        (xTaskHandle*)NULL /* optional task handle to create */
+        tskIDLE_PRIORITY + MAIN_TASK_PRIO,  /* initial priority */
+        &main_task /* optional task handle to create */
       ) != pdPASS) {
        for(;;){} /* error! probably out of memory */
     }
+#endif
 
     vTaskStartScheduler();
     while(1) {
@@ -41,7 +41,9 @@
 #include "pico_stack.h"
 #include "pico_device.h"
 #include "FreeRTOS.h"
+#include "task.h"
 #include "event_groups.h"
+#include "timers.h"
 #include "pico_enet_kinetis.h"
 #include "fsl_enet.h"
 #include "fsl_phy.h"
@@ -50,8 +52,16 @@
 #define EXAMPLE_ENET ENET
 #define EXAMPLE_PHY 0x00U
 #define CORE_CLK_FREQ CLOCK_GetFreq(kCLOCK_CoreSysClk)
-#define ENET_RXBD_NUM (4)
-#define ENET_TXBD_NUM (4)
+/* Descriptor ring depths, see ENET_RXBD/ENET_TXBD in the Makefile */
+#ifndef ENET_RXBD_NUM
+#define ENET_RXBD_NUM (8)
+#endif
+#ifndef ENET_TXBD_NUM
+#define ENET_TXBD_NUM (8)
+#endif
+#define ENET_STRESS_MS (2000)
+/* PHY link state polling period */
+#define ENET_LINK_POLL_MS (500)
 #define ENET_RXBUFF_SIZE (ENET_FRAME_MAX_FRAMELEN)
 #define ENET_TXBUFF_SIZE (ENET_FRAME_MAX_FRAMELEN)
 #define ENET_DATA_LENGTH (1500)
@@ -68,11 +78,36 @@ SDK_ALIGN(uint8_t g_rxDataBuff[ENET_RXBD_NUM][SDK_SIZEALIGN(ENET_RXBUFF_SIZE, AP
 SDK_ALIGN(uint8_t g_txDataBuff[ENET_TXBD_NUM][SDK_SIZEALIGN(ENET_TXBUFF_SIZE, APP_ENET_BUFF_ALIGNMENT)],
           APP_ENET_BUFF_ALIGNMENT);
 
+#define ENET_RXBUFF_STRIDE SDK_SIZEALIGN(ENET_RXBUFF_SIZE, APP_ENET_BUFF_ALIGNMENT)
+#define ENET_RX_ERR_MASK (ENET_BUFFDESCRIPTOR_RX_TRUNC_MASK | ENET_BUFFDESCRIPTOR_RX_OVERRUN_MASK | \
+        ENET_BUFFDESCRIPTOR_RX_LENVLIOLATE_MASK | ENET_BUFFDESCRIPTOR_RX_NOOCTET_MASK | \
+        ENET_BUFFDESCRIPTOR_RX_CRC_MASK)
+
 enet_handle_t g_handle;
 static uint8_t g_frame[ENET_DATA_LENGTH + 14];
 
+/* Zero-copy receive: received frames are passed to picoTCP in place, in
+ * the RX descriptor buffers. A descriptor is owned by the stack until the
+ * frame is discarded, then it is given back to the DMA.
+ */
+static uint32_t rx_next;
+static volatile uint8_t rx_held[ENET_RXBD_NUM];
+
+static struct pico_enet_stats enet_stats;
+
 uint8_t g_macAddr[6] = {0xd4, 0xbe, 0xd9, 0x45, 0x22, 0x60};
 
+/* Task notified by the RX interrupt, and by the TX interrupt when a
+ * frame was refused for lack of free TX descriptors */
+static TaskHandle_t rx_task = NULL;
+static volatile uint8_t tx_blocked;
+
+/* PHY management: the PHY is initialized and its link state polled from
+ * a FreeRTOS timer, so that the interface comes up whenever the cable is
+ * plugged in, without blocking PicoTask. */
+static TimerHandle_t link_timer;
+static uint8_t phy_ready;
+
 struct pico_device_enet {
     struct pico_device dev;
     ENET_Type *base;
@@ -98,14 +133,35 @@ static void ENET_BuildBroadCastFrame(void)
 }
 
 
+/* Called by the SDK from the ENET interrupt handlers */
+static void enet_callback(ENET_Type *base, enet_handle_t *handle, enet_event_t event, void *userData)
+{
+    BaseType_t woken = pdFALSE;
+    if (event == kENET_TxEvent) {
+        /* Transmitted frames free their descriptors in hardware: wake the
+         * stack only if it is waiting for one */
+        enet_stats.tx_complete++;
+        if (!tx_blocked)
+            return;
+        tx_blocked = 0;
+    } else if (event != kENET_RxEvent) {
+        return;
+    }
+    if (rx_task) {
+        vTaskNotifyGiveFromISR(rx_task, &woken);
+        portYIELD_FROM_ISR(woken);
+    }
+}
+
+void pico_enet_set_rx_task(TaskHandle_t task)
+{
+    rx_task = task;
+}
+
 static int enet_driver_init(struct pico_device_enet *enet)
 {
     enet_config_t config;
-    status_t status;
-    bool link = false;
     uint32_t sysClock;
-    phy_speed_t speed;
-    phy_duplex_t duplex;
 
     /* prepare the buffer configuration. */
     enet_buffer_config_t buffConfig[] = {
@@ -129,56 +185,243 @@ static int enet_driver_init(struct pico_device_enet *enet)
      * config.rxMaxFrameLen = ENET_FRAME_MAX_FRAMELEN;
      */
     ENET_GetDefaultConfig(&config);
+    config.interrupt = kENET_RxFrameInterrupt | kENET_TxFrameInterrupt;
+#ifdef ENET_OFFLOAD
+    /* Discard received frames with a wrong IPv4 header or TCP/UDP/ICMP
+     * checksum. picoTCP is built without PICO_SUPPORT_CRC, so it does not
+     * verify them again. The transmit accelerator is left off: it expects
+     * the checksum fields to be zero, while picoTCP always fills them. */
+    config.rxAccelerConfig = kENET_RxAccelIpCheckEnabled | kENET_RxAccelProtoCheckEnabled;
+#endif
 
-    /* Set SMI to get PHY link status. */
+    /* The MAC starts with the default 100M full duplex configuration. The
+     * PHY and the actual link parameters are handled by enet_link_poll(). */
     sysClock = CORE_CLK_FREQ;
-    status = PHY_Init(EXAMPLE_ENET, EXAMPLE_PHY, sysClock);
-    while (status != kStatus_Success)
-    {
-        status = PHY_Init(EXAMPLE_ENET, EXAMPLE_PHY, sysClock);
-    }
-
-    PHY_GetLinkStatus(EXAMPLE_ENET, EXAMPLE_PHY, &link);
-    if (link)
-    {
-        /* Get the actual PHY link speed. */
-        PHY_GetLinkSpeedDuplex(EXAMPLE_ENET, EXAMPLE_PHY, &speed, &duplex);
-        /* Change the MII speed and duplex for actual link status. */
-        config.miiSpeed = (enet_mii_speed_t)speed;
-        config.miiDuplex = (enet_mii_duplex_t)duplex;
-    }
-
     ENET_Init(EXAMPLE_ENET, &g_handle, &config, &buffConfig[0], &g_macAddr[0], sysClock);
+    ENET_SetCallback(&g_handle, enet_callback, enet);
+    /* Enable the MIB counters (receive FIFO overflow statistics) */
+    EXAMPLE_ENET->MIBC &= ~ENET_MIBC_MIB_DIS_MASK;
     ENET_ActiveRead(EXAMPLE_ENET);
 
     return 0;
 }
 
+/* Initialize the PHY if not done yet, then read the link state and
+ * reconfigure the MAC for the negotiated speed and duplex when it changes.
+ * Runs in the timer task, so that PHY_Init() waiting for autonegotiation
+ * never holds up PicoTask. The MAC is reconfigured without being stopped:
+ * nothing is exchanged while the link is down.
+ */
+static void enet_link_poll(TimerHandle_t t)
+{
+    bool link = false;
+    phy_speed_t speed;
+    phy_duplex_t duplex;
+
+    (void)t;
+    if (!phy_ready) {
+        /* Fails while autonegotiation cannot complete (e.g. no cable):
+         * retried on the next period */
+        if (PHY_Init(EXAMPLE_ENET, EXAMPLE_PHY, CORE_CLK_FREQ) != kStatus_Success)
+            return;
+        phy_ready = 1;
+    }
+    if (PHY_GetLinkStatus(EXAMPLE_ENET, EXAMPLE_PHY, &link) != kStatus_Success)
+        return;
+    if (link) {
+        if (PHY_GetLinkSpeedDuplex(EXAMPLE_ENET, EXAMPLE_PHY, &speed, &duplex) != kStatus_Success)
+            return;
+        if (enet_stats.link_up && (enet_stats.link_speed == (uint8_t)speed) &&
+                (enet_stats.link_duplex == (uint8_t)duplex))
+            return;
+        ENET_SetMII(EXAMPLE_ENET, (enet_mii_speed_t)speed, (enet_mii_duplex_t)duplex);
+        enet_stats.link_speed = (uint8_t)speed;
+        enet_stats.link_duplex = (uint8_t)duplex;
+    } else if (!enet_stats.link_up) {
+        return;
+    }
+    enet_stats.link_up = link ? 1 : 0;
+    enet_stats.link_changes++;
+    /* Let PicoTask see the new state (pico_device link_state) at once */
+    if (rx_task)
+        xTaskNotifyGive(rx_task);
+}
+
+/* picoTCP link_state callback */
+static int enet_link_state(struct pico_device *dev)
+{
+    (void)dev;
+    return enet_stats.link_up;
+}
+
 void pico_enet_destroy(struct pico_device *enet)
 {
     
 }
 
+/* Give a receive descriptor back to the DMA */
+static void enet_rx_recycle(uint32_t i)
+{
+    volatile enet_rx_bd_struct_t *bd = &g_rxBuffDescrip[i];
+    rx_held[i] = 0;
+    bd->control = (bd->control & ENET_BUFFDESCRIPTOR_RX_WRAP_MASK) | ENET_BUFFDESCRIPTOR_RX_EMPTY_MASK;
+    ENET->RDAR = ENET_RDAR_RDAR_MASK;
+}
+
+/* Called by picoTCP when a zero-copy frame is discarded */
+static void enet_rx_free(uint8_t *buffer)
+{
+    uint32_t i = (uint32_t)(buffer - &g_rxDataBuff[0][0]) / ENET_RXBUFF_STRIDE;
+    if ((i < ENET_RXBD_NUM) && rx_held[i])
+        enet_rx_recycle(i);
+}
+
 static int enet_poll(struct pico_device *dev, int loop_score)
 {
-    struct pico_device_enet *enet = (struct pico_device_enet *)dev;
-    uint32_t size;
     while(loop_score > 0) {
-        if (ENET_GetRxFrameSize(&g_handle, &size) == kStatus_ENET_RxFrameEmpty)
+        uint32_t i = rx_next;
+        volatile enet_rx_bd_struct_t *bd = &g_rxBuffDescrip[i];
+        uint16_t control = bd->control;
+        uint16_t size = bd->length;
+
+        /* Stop at the first empty descriptor, or at one still in use by
+         * the stack (the DMA has wrapped around) */
+        if (rx_held[i] || (control & ENET_BUFFDESCRIPTOR_RX_EMPTY_MASK))
             return loop_score;
-        ENET_ReadFrame(enet->base, &g_handle, g_frame, size);
-        pico_stack_recv(dev, g_frame, size);
+        rx_next = (i + 1) % ENET_RXBD_NUM;
+
+        /* Frames always fit in one descriptor */
+        if ((control & ENET_RX_ERR_MASK) || !(control & ENET_BUFFDESCRIPTOR_RX_LAST_MASK)) {
+            enet_stats.rx_errors++;
+            enet_rx_recycle(i);
+            continue;
+        }
+        rx_held[i] = 1;
+        if (pico_stack_recv_zerocopy_ext_buffer_notify(dev, bd->buffer, size, enet_rx_free) <= 0) {
+            /* Device queue full. picoTCP may already have released the
+             * buffer through enet_rx_free(). */
+            enet_stats.rx_dropped++;
+            if (rx_held[i])
+                enet_rx_recycle(i);
+            continue;
+        }
+        enet_stats.rx_frames++;
+        enet_stats.rx_bytes += size;
         loop_score--;
     }
     return loop_score;
 }
 
+#ifdef PICO_SUPPORT_TICKLESS
+/* Sleep until a frame is received, or for at most 'timeout' ms. Must be
+ * called by the task registered with pico_enet_set_rx_task().
+ */
+static int enet_WFI(struct pico_device *dev, int timeout)
+{
+    if (!rx_held[rx_next] && !(g_rxBuffDescrip[rx_next].control & ENET_BUFFDESCRIPTOR_RX_EMPTY_MASK))
+        return 1;
+    return ulTaskNotifyTake(pdTRUE, (timeout < 0) ? portMAX_DELAY : pdMS_TO_TICKS(timeout)) ? 1 : 0;
+}
+#endif
+
+/* picoTCP releases the frame as soon as send() returns, so the frame is
+ * copied once, into the TX descriptor buffer, by ENET_SendFrame().
+ */
 static int enet_send(struct pico_device *dev, void *buf, int len)
 {
     struct pico_device_enet *enet = (struct pico_device_enet *)dev;
-    if (ENET_SendFrame(enet->base, &g_handle, buf, len) != kStatus_ENET_TxFrameBusy)
-        return len;
-    return 0;
+    status_t ret;
+    /* Set before trying, so that a completion in between is not missed */
+    tx_blocked = 1;
+    ret = ENET_SendFrame(enet->base, &g_handle, buf, len);
+    if (ret == kStatus_ENET_TxFrameBusy) {
+        /* picoTCP retries on the next tick: the TX interrupt wakes it
+         * up as soon as a descriptor is free */
+        enet_stats.tx_busy++;
+        return 0;
+    }
+    tx_blocked = 0;
+    if (ret == kStatus_Success) {
+        enet_stats.tx_frames++;
+        enet_stats.tx_bytes += len;
+    } else {
+        /* Frame not sent (e.g. too long): not retried */
+        enet_stats.tx_dropped++;
+    }
+    return len;
+}
+
+#ifdef ENET_LOOPBACK_STRESS
+static struct pico_enet_stress stress;
+
+/* Send broadcast frames back to back for ENET_STRESS_MS, with the MAC in
+ * internal loopback, and count the frames received back. Runs at boot,
+ * before the interface is initialized for normal operation.
+ */
+static void enet_loopback_stress(void)
+{
+    enet_config_t config;
+    TickType_t start;
+    uint32_t i;
+    enet_buffer_config_t buffConfig[] = {
+        {
+            ENET_RXBD_NUM,
+            ENET_TXBD_NUM,
+            SDK_SIZEALIGN(ENET_RXBUFF_SIZE, APP_ENET_BUFF_ALIGNMENT),
+            SDK_SIZEALIGN(ENET_TXBUFF_SIZE, APP_ENET_BUFF_ALIGNMENT),
+            &g_rxBuffDescrip[0],
+            &g_txBuffDescrip[0],
+            &g_rxDataBuff[0][0],
+            &g_txDataBuff[0][0],
+        }
+    };
+
+    ENET_GetDefaultConfig(&config);
+    /* Internal loopback requires the MII mode */
+    config.miiMode = kENET_MiiMode;
+    config.macSpecialConfig |= kENET_ControlMIILoopEnable;
+    ENET_Init(EXAMPLE_ENET, &g_handle, &config, &buffConfig[0], &g_macAddr[0], CORE_CLK_FREQ);
+    EXAMPLE_ENET->MIBC &= ~ENET_MIBC_MIB_DIS_MASK;
+    ENET_ActiveRead(EXAMPLE_ENET);
+    ENET_BuildBroadCastFrame();
+    rx_next = 0;
+
+    start = xTaskGetTickCount();
+    while ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(ENET_STRESS_MS)) {
+        if (ENET_SendFrame(EXAMPLE_ENET, &g_handle, g_frame, ENET_DATA_LENGTH) == kStatus_Success)
+            stress.sent++;
+        else
+            stress.busy++;
+        /* Drain the receive ring */
+        for (i = 0; i < ENET_RXBD_NUM; i++) {
+            uint16_t control = g_rxBuffDescrip[rx_next].control;
+            if (control & ENET_BUFFDESCRIPTOR_RX_EMPTY_MASK)
+                break;
+            if (control & ENET_RX_ERR_MASK)
+                stress.errors++;
+            else
+                stress.received++;
+            enet_rx_recycle(rx_next);
+            rx_next = (rx_next + 1) % ENET_RXBD_NUM;
+        }
+    }
+    stress.ms = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+    stress.overrun = EXAMPLE_ENET->IEEE_R_MACERR;
+    ENET_Deinit(EXAMPLE_ENET);
+    rx_next = 0;
+}
+
+const struct pico_enet_stress *pico_enet_stress(void)
+{
+    return &stress;
+}
+#endif
+
+const struct pico_enet_stats *pico_enet_stats(void)
+{
+    /* Frames lost because the receive FIFO overflowed */
+    enet_stats.rx_overrun = ENET->IEEE_R_MACERR;
+    return &enet_stats;
 }
 
 struct pico_device *pico_enet_create(char *name)
@@ -197,11 +440,29 @@ struct pico_device *pico_enet_create(char *name)
     enet->dev.wfi = enet_WFI;
 #endif
     enet->dev.destroy = pico_enet_destroy;
+    enet->dev.link_state = enet_link_state;
+#ifdef ENET_LOOPBACK_STRESS
+    enet_loopback_stress();
+#endif
     enet_driver_init(enet);
+#ifdef K64F_STATIC_ALLOC
+    {
+        static StaticTimer_t link_timer_buf;
+        link_timer = xTimerCreateStatic("link", pdMS_TO_TICKS(ENET_LINK_POLL_MS),
+                pdTRUE, NULL, enet_link_poll, &link_timer_buf);
+    }
+#else
+    link_timer = xTimerCreate("link", pdMS_TO_TICKS(ENET_LINK_POLL_MS), pdTRUE, NULL, enet_link_poll);
+#endif
+    if (link_timer)
+        xTimerStart(link_timer, 0);
     dbg("Device %s created.\n", enet->dev.name);
 #ifdef PICO_SUPPORT_MULTICAST
     ENET_AcceptAllMulticast(enet->base);
 #endif
+    /* The RX callback uses the FreeRTOS FromISR API */
+    NVIC_SetPriority(ENET_Receive_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY);
+    NVIC_SetPriority(ENET_Transmit_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY);
     NVIC_EnableIRQ(ENET_Receive_IRQn);
     NVIC_EnableIRQ(ENET_Transmit_IRQn);
     return (struct pico_device *)enet;
@@ -1,6 +1,43 @@
 #ifndef PICO_DEV_KINETIS_H
 #define PICO_DEV_KINETIS_H
 
+#include <stdint.h>
+#include "FreeRTOS.h"
+#include "task.h"
+
+struct pico_enet_stats {
+    uint32_t rx_frames;
+    uint32_t rx_bytes;
+    uint32_t tx_frames;
+    uint32_t tx_bytes;
+    uint32_t rx_errors;     /* Frames received with errors (CRC, length, ...) */
+    uint32_t rx_dropped;    /* Frames dropped: stack input queue full */
+    uint32_t rx_overrun;    /* Frames lost in hardware: receive FIFO overflow */
+    uint32_t tx_busy;       /* Frames refused: no free TX descriptor */
+    uint32_t tx_dropped;    /* Frames rejected by the MAC */
+    uint32_t tx_complete;   /* TX interrupts */
+    uint32_t link_changes;  /* Link up/down transitions */
+    uint8_t link_up;
+    uint8_t link_speed;     /* phy_speed_t: 0 = 10M, 1 = 100M */
+    uint8_t link_duplex;    /* phy_duplex_t: 0 = half, 1 = full */
+};
+
+/* ENET_LOOPBACK_STRESS: MAC loopback test run at boot */
+struct pico_enet_stress {
+    uint32_t ms;
+    uint32_t sent;
+    uint32_t received;
+    uint32_t busy;          /* Send attempts with the TX ring full */
+    uint32_t errors;        /* Frames received with errors */
+    uint32_t overrun;       /* Frames lost in the receive FIFO */
+};
+
 struct pico_device *pico_enet_create(char *name);
+/* Task to notify (xTaskNotifyGive) when a frame is received */
+void pico_enet_set_rx_task(TaskHandle_t task);
+const struct pico_enet_stats *pico_enet_stats(void);
+#ifdef ENET_LOOPBACK_STRESS
+const struct pico_enet_stress *pico_enet_stress(void);
+#endif
 
 #endif
@@ -13,6 +13,24 @@
 
 #define PICO_SUPPORT_MUTEX
 
+#ifdef PICO_MUTEX_STATS
+/* Lock contention in the picoTCP port layer (src/picotcp.c), all locks */
+struct pico_mutex_stats {
+    uint32_t locks;         /* Successful and failed lock attempts */
+    uint32_t contended;     /* Attempts that found the lock taken */
+    uint32_t wait_ms;       /* Total time spent waiting */
+    uint32_t wait_ms_max;
+};
+const struct pico_mutex_stats *pico_mutex_stats(void);
+#endif
+
+#ifdef K64F_STATIC_ALLOC
+/* Small buffers and frames from the slab pools, see src/slab.h */
+#include "slab.h"
+#define pico_free(x) slab_free(x)
+#define free(x)      slab_free(x)
+#define pico_zalloc(x) slab_zalloc(x)
+#else
 #define pico_free(x) vPortFree(x)
 #define free(x)      vPortFree(x)
 
@@ -25,6 +43,7 @@ static inline void *pico_zalloc(size_t size)
 
     return ptr;
 }
+#endif
 
 #define malloc(x) pico_zalloc(x)
 
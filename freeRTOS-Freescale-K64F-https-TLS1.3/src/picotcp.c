@@ -26,32 +26,128 @@
 #include "portmacro.h"
 
 #include "pico_stack.h"
+#include "hw_rng.h"
 
 
-void *pico_mutex_init(void)
+/* picoTCP locks are FreeRTOS mutexes, so that a task holding one inherits
+ * the priority of a higher priority task waiting for it. Build with
+ * PICO_MUTEX_RECURSIVE to allow the same task to take a lock again.
+ */
+#ifdef PICO_MUTEX_RECURSIVE
+#define mutex_create()      xSemaphoreCreateRecursiveMutex()
+#define mutex_take(m, t)    xSemaphoreTakeRecursive((SemaphoreHandle_t)(m), (t))
+#define mutex_give(m)       xSemaphoreGiveRecursive((SemaphoreHandle_t)(m))
+#else
+#define mutex_create()      xSemaphoreCreateMutex()
+#define mutex_take(m, t)    xSemaphoreTake((SemaphoreHandle_t)(m), (t))
+#define mutex_give(m)       xSemaphoreGive((SemaphoreHandle_t)(m))
+#endif
+
+#ifdef K64F_STATIC_ALLOC
+#ifdef PICO_MUTEX_RECURSIVE
+#define mutex_create_static(b)  xSemaphoreCreateRecursiveMutexStatic(b)
+#else
+#define mutex_create_static(b)  xSemaphoreCreateMutexStatic(b)
+#endif
+
+/* picoTCP creates its few locks at init: serve them from a static pool,
+ * falling back to the heap if it runs out. */
+#ifndef PICO_MUTEX_POOL
+#define PICO_MUTEX_POOL 8
+#endif
+static StaticSemaphore_t mutex_pool[PICO_MUTEX_POOL];
+static uint8_t mutex_pool_used[PICO_MUTEX_POOL];
+
+static int mutex_pool_slot(void *mutex)
+{
+    int i;
+    for (i = 0; i < PICO_MUTEX_POOL; i++) {
+        if (mutex == (void *)&mutex_pool[i])
+            return i;
+    }
+    return -1;
+}
+#endif
+
+#ifdef PICO_MUTEX_STATS
+static struct pico_mutex_stats mutex_stats;
+
+const struct pico_mutex_stats *pico_mutex_stats(void)
+{
+    return &mutex_stats;
+}
+
+/* Take the mutex, counting the attempts that had to wait and for how
+ * long */
+static BaseType_t mutex_take_counted(void *mutex, TickType_t timeout)
 {
-    void *ret;
-    ret = xSemaphoreCreateBinary();
-    if (ret)
-        xSemaphoreGive(ret);
+    TickType_t start, waited;
+    BaseType_t ret = mutex_take(mutex, 0);
+
+    if ((ret == pdTRUE) || (timeout == 0)) {
+        taskENTER_CRITICAL();
+        mutex_stats.locks++;
+        if (ret != pdTRUE)
+            mutex_stats.contended++;
+        taskEXIT_CRITICAL();
+        return ret;
+    }
+    start = xTaskGetTickCount();
+    ret = mutex_take(mutex, timeout);
+    waited = xTaskGetTickCount() - start;
+    taskENTER_CRITICAL();
+    mutex_stats.locks++;
+    mutex_stats.contended++;
+    mutex_stats.wait_ms += waited * portTICK_PERIOD_MS;
+    if (waited * portTICK_PERIOD_MS > mutex_stats.wait_ms_max)
+        mutex_stats.wait_ms_max = waited * portTICK_PERIOD_MS;
+    taskEXIT_CRITICAL();
     return ret;
 }
+#undef mutex_take
+#define mutex_take(m, t) mutex_take_counted((m), (t))
+#endif
+
+void *pico_mutex_init(void)
+{
+#ifdef K64F_STATIC_ALLOC
+    int i, slot = -1;
+    taskENTER_CRITICAL();
+    for (i = 0; i < PICO_MUTEX_POOL; i++) {
+        if (!mutex_pool_used[i]) {
+            mutex_pool_used[i] = 1;
+            slot = i;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL();
+    if (slot >= 0)
+        return mutex_create_static(&mutex_pool[slot]);
+#endif
+    return mutex_create();
+}
+
 void pico_mutex_deinit(void *mutex)
 {
+#ifdef K64F_STATIC_ALLOC
+    int slot = mutex_pool_slot(mutex);
+    vSemaphoreDelete(mutex);
+    if (slot >= 0)
+        mutex_pool_used[slot] = 0;
+#else
     vSemaphoreDelete(mutex);
+#endif
 }
 
 void pico_mutex_lock(void *mutex)
 {
-    while(xSemaphoreTake(mutex, portMAX_DELAY) == pdFALSE)
-        ;
-
+    mutex_take(mutex, portMAX_DELAY);
 }
 
 int pico_mutex_lock_timeout(void *mutex, int timeout)
 {
-    int ret = xSemaphoreTake(mutex, timeout);
-    if (ret)
+    TickType_t t = (timeout < 0) ? portMAX_DELAY : pdMS_TO_TICKS(timeout);
+    if (mutex_take(mutex, t) == pdTRUE)
         return 0; /* Success */
     else
         return -1; /* Timeout */
@@ -59,20 +155,19 @@ int pico_mutex_lock_timeout(void *mutex, int timeout)
 
 void pico_mutex_unlock(void *mutex)
 {
-    xSemaphoreGive(mutex);
+    mutex_give(mutex);
 }
 
+/* A mutex cannot be released from an interrupt: picoTCP never does, and
+ * no driver in this example needs it. */
 void pico_mutex_unlock_ISR(void *mutex)
 {
-    long task_switch_is_needed = 0;
-    xSemaphoreGiveFromISR(mutex, &task_switch_is_needed);
+    (void)mutex;
+    configASSERT(0);
 }
 
+/* wolfSSL CUSTOM_RAND_GENERATE_BLOCK */
 int rnd_custom_generate_block(uint8_t *b, int len)
 {
-    int i;
-    for (i = 0; i < len; i++) {
-        b[i] = (uint8_t)pico_rand();
-    }
-    return 0;
+    return hw_rng_block(b, (uint32_t)len);
 }
@@ -0,0 +1,165 @@
+/* tls_ticket.c
+ *
+ * TLS 1.3 session ticket support for the K64F HTTPS server
+ *
+ * Tickets carry the session state encrypted with AES-GCM under a key
+ * generated at boot, so they are invalidated by a reboot (e.g. after a
+ * firmware update). Each issued ticket is also recorded in a small cache,
+ * and can be used only once: a ticket is removed from the cache when a
+ * client resumes with it, and the server issues a fresh one at the end of
+ * the handshake. Single use makes replaying 0-RTT early data with the
+ * same ticket impossible, and bounds the number of valid tickets.
+ *
+ * Copyright (C) 2019 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "wolfssl/wolfcrypt/settings.h"
+#include "wolfssl/wolfcrypt/aes.h"
+#include "wolfssl/wolfcrypt/random.h"
+#include "tls_ticket.h"
+
+#ifdef HAVE_SESSION_TICKET
+
+#define TICKET_KEY_SZ   32
+#define TICKET_NONCE_SZ 12
+#define TICKET_TAG_SZ   16
+
+struct ticket_entry {
+    uint8_t iv[WOLFSSL_TICKET_IV_SZ];
+    TickType_t issued;
+    uint8_t valid;
+};
+
+static uint8_t ticket_key_name[WOLFSSL_TICKET_NAME_SZ];
+static uint8_t ticket_key[TICKET_KEY_SZ];
+static struct ticket_entry ticket_cache[TLS_TICKET_CACHE_SIZE];
+static WC_RNG ticket_rng;
+static Aes ticket_aes;
+
+static int ticket_expired(const struct ticket_entry *e)
+{
+    return (xTaskGetTickCount() - e->issued) >
+        ((TickType_t)TLS_TICKET_LIFETIME * configTICK_RATE_HZ);
+}
+
+static void ticket_cache_add(const uint8_t *iv)
+{
+    struct ticket_entry *slot = &ticket_cache[0];
+    int i;
+    for (i = 0; i < TLS_TICKET_CACHE_SIZE; i++) {
+        struct ticket_entry *e = &ticket_cache[i];
+        if (!e->valid || ticket_expired(e)) {
+            slot = e;
+            break;
+        }
+        /* Evict the oldest ticket if the cache is full */
+        if ((TickType_t)(e->issued - slot->issued) > ((TickType_t)~0U >> 1))
+            slot = e;
+    }
+    memcpy(slot->iv, iv, WOLFSSL_TICKET_IV_SZ);
+    slot->issued = xTaskGetTickCount();
+    slot->valid = 1;
+}
+
+/* Find and consume a ticket. Returns 0 if it was valid. */
+static int ticket_cache_take(const uint8_t *iv)
+{
+    int i;
+    for (i = 0; i < TLS_TICKET_CACHE_SIZE; i++) {
+        struct ticket_entry *e = &ticket_cache[i];
+        if (e->valid && (memcmp(e->iv, iv, WOLFSSL_TICKET_IV_SZ) == 0)) {
+            e->valid = 0;
+            return ticket_expired(e) ? -1 : 0;
+        }
+    }
+    return -1;
+}
+
+static int ticket_enc_cb(WOLFSSL *ssl,
+        unsigned char key_name[WOLFSSL_TICKET_NAME_SZ],
+        unsigned char iv[WOLFSSL_TICKET_IV_SZ],
+        unsigned char mac[WOLFSSL_TICKET_MAC_SZ],
+        int enc, unsigned char *ticket, int inLen, int *outLen, void *userCtx)
+{
+    uint8_t aad[WOLFSSL_TICKET_NAME_SZ + WOLFSSL_TICKET_IV_SZ + 2];
+    int ret;
+    (void)ssl;
+    (void)userCtx;
+
+    if (enc) {
+        memcpy(key_name, ticket_key_name, WOLFSSL_TICKET_NAME_SZ);
+        if (wc_RNG_GenerateBlock(&ticket_rng, iv, WOLFSSL_TICKET_IV_SZ) != 0)
+            return WOLFSSL_TICKET_RET_REJECT;
+    } else {
+        if (memcmp(key_name, ticket_key_name, WOLFSSL_TICKET_NAME_SZ) != 0)
+            return WOLFSSL_TICKET_RET_REJECT;
+        if (ticket_cache_take(iv) != 0)
+            return WOLFSSL_TICKET_RET_REJECT;
+    }
+
+    memcpy(aad, key_name, WOLFSSL_TICKET_NAME_SZ);
+    memcpy(aad + WOLFSSL_TICKET_NAME_SZ, iv, WOLFSSL_TICKET_IV_SZ);
+    aad[WOLFSSL_TICKET_NAME_SZ + WOLFSSL_TICKET_IV_SZ] = (uint8_t)(inLen >> 8);
+    aad[WOLFSSL_TICKET_NAME_SZ + WOLFSSL_TICKET_IV_SZ + 1] = (uint8_t)inLen;
+
+    if (enc) {
+        memset(mac, 0, WOLFSSL_TICKET_MAC_SZ);
+        ret = wc_AesGcmEncrypt(&ticket_aes, ticket, ticket, inLen,
+                iv, TICKET_NONCE_SZ, mac, TICKET_TAG_SZ, aad, sizeof(aad));
+        if (ret != 0)
+            return WOLFSSL_TICKET_RET_REJECT;
+        ticket_cache_add(iv);
+    } else {
+        ret = wc_AesGcmDecrypt(&ticket_aes, ticket, ticket, inLen,
+                iv, TICKET_NONCE_SZ, mac, TICKET_TAG_SZ, aad, sizeof(aad));
+        if (ret != 0)
+            return WOLFSSL_TICKET_RET_REJECT;
+    }
+    *outLen = inLen;
+    return WOLFSSL_TICKET_RET_OK;
+}
+
+int tls_ticket_init(WOLFSSL_CTX *ctx)
+{
+    if (wc_InitRng(&ticket_rng) != 0)
+        return -1;
+    if ((wc_RNG_GenerateBlock(&ticket_rng, ticket_key_name, sizeof(ticket_key_name)) != 0) ||
+            (wc_RNG_GenerateBlock(&ticket_rng, ticket_key, sizeof(ticket_key)) != 0))
+        return -1;
+    if (wc_AesGcmSetKey(&ticket_aes, ticket_key, sizeof(ticket_key)) != 0)
+        return -1;
+    memset(ticket_cache, 0, sizeof(ticket_cache));
+    if (wolfSSL_CTX_set_TicketEncCb(ctx, ticket_enc_cb) != SSL_SUCCESS)
+        return -1;
+    if (wolfSSL_CTX_set_TicketHint(ctx, TLS_TICKET_LIFETIME) != SSL_SUCCESS)
+        return -1;
+    return 0;
+}
+
+#else
+
+int tls_ticket_init(WOLFSSL_CTX *ctx)
+{
+    (void)ctx;
+    return 0;
+}
+
+#endif /* HAVE_SESSION_TICKET */
@@ -0,0 +1,43 @@
+/* tls_ticket.h
+ *
+ * TLS 1.3 session ticket support for the K64F HTTPS server
+ *
+ * Copyright (C) 2019 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+#ifndef TLS_TICKET_H
+#define TLS_TICKET_H
+#include "wolfssl/ssl.h"
+
+/* Number of outstanding tickets remembered by the server. Older tickets
+ * are evicted when the cache is full, and resuming with them falls back
+ * to a full handshake. */
+#ifndef TLS_TICKET_CACHE_SIZE
+#define TLS_TICKET_CACHE_SIZE   8
+#endif
+
+/* Ticket lifetime, in seconds */
+#ifndef TLS_TICKET_LIFETIME
+#define TLS_TICKET_LIFETIME     3600
+#endif
+
+/* Generate the ticket key and register the ticket callback on 'ctx'.
+ * Returns 0 on success. */
+int tls_ticket_init(WOLFSSL_CTX *ctx);
+
+#endif /* TLS_TICKET_H */
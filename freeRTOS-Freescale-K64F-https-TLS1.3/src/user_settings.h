@@ -4,6 +4,7 @@
 #include "portmacro.h"
 #include "semphr.h"
 #include "pico_stack.h"
+#include "hw_rng.h"
 
 
 
@@ -13,13 +14,21 @@
 //#define WOLFSSL_LOG_PRINTF
 //#define SINGLE_THREADED
 #define WOLFSSL_USER_IO
-#define CUSTOM_RAND_GENERATE pico_rand
+/* K64F RNGA, see src/hw_rng.c */
+#define CUSTOM_RAND_GENERATE hw_rng_word
 #define CUSTOM_RAND_TYPE uint32_t 
 #define CUSTOM_RAND_GENERATE_BLOCK rnd_custom_generate_block
 #define XMALLOC_OVERRIDE
+#ifdef K64F_STATIC_ALLOC
+#include "slab.h"
+#define XMALLOC(s, h, type) slab_alloc((s))
+#define XREALLOC(p, n, h, t) slab_realloc((p), (n))
+#define XFREE(p, h, type)  slab_free((p))
+#else
 #define XMALLOC(s, h, type) pvPortMalloc((s))
 #define XREALLOC(p, n, h, t) pvPortRealloc((p), (n))
 #define XFREE(p, h, type)  vPortFree((p))
+#endif
 #define TIME_OVERRIDES
 static inline long XTIME(long *x) { return xTaskGetTickCount() / configTICK_RATE_HZ;}
 #define NO_ASN_TIME
@@ -41,9 +50,23 @@ static inline long XTIME(long *x) { return xTaskGetTickCount() / configTICK_RATE
 #   define FP_LUT 4
 #   define WOLFSSL_HAVE_SP_ECC
 
-/* SP math */
+/* SP math
+ *
+ * ECC table mode, selected with ECC_TABLES= in the Makefile:
+ *  - small (default): WOLFSSL_SP_SMALL, 16-entry base point comb table,
+ *    generic loops. Smallest code, slowest.
+ *  - sp: full SP implementation, with the 256-entry precomputed P-256
+ *    comb table (const, linked in flash) for base point multiplication.
+ *    FP_ECC also builds tables for other points at run time, in RAM.
+ *  - flash: full SP with the precomputed flash tables only, without the
+ *    run-time FP_ECC cache, so the speed-up costs no RAM.
+ */
 #define WOLFSSL_SP_MATH
-#define WOLFSSL_SP_SMALL
+#if defined(ECC_FLASH_TABLES)
+#   undef FP_ECC
+#elif !defined(ECC_SP_DEFAULT)
+#   define WOLFSSL_SP_SMALL
+#endif
 #define SP_WORD_SIZE 32
 
 /* Edwards */
@@ -73,11 +96,26 @@ static inline long XTIME(long *x) { return xTaskGetTickCount() / configTICK_RATE
 #   define HAVE_AESGCM
 #   define WC_RSA_PSS
 
+/* TLS 1.3 session resumption (PSK tickets) and 0-RTT */
+#   define HAVE_SESSION_TICKET
+#   define WOLFSSL_EARLY_DATA
+
 /* SHA */
 #define USE_SLOW_SHA
 #define USE_SLOW_SHA2
 //#define USE_SLOW_SHA512
 
+/* mmCAU: K64F crypto coprocessor for SHA-256 and the AES block cipher
+ * (also used by AES-GCM). Needs the mmCAU library from the Kinetis SDK
+ * (middleware/mmcau), which is linked when building with MMCAU=1.
+ */
+#ifdef K64F_MMCAU
+#   define FREESCALE_MMCAU
+#   define FREESCALE_MMCAU_SHA
+#   define FREESCALE_USE_MMCAU
+#   undef USE_SLOW_SHA2
+#endif
+
 /* Disabled ciphers */
 #define NO_DES3
 #define NO_MD4
@@ -85,7 +85,12 @@ extern uint32_t SystemCoreClock;
  *----------------------------------------------------------*/
 
 #define configUSE_PREEMPTION                    1
+#ifdef K64F_TICKLESS
+/* Stop the tick while all the tasks are blocked (TICKLESS=1) */
+#define configUSE_TICKLESS_IDLE                 1
+#else
 #define configUSE_TICKLESS_IDLE                 0
+#endif
 #define configCPU_CLOCK_HZ                      (SystemCoreClock)
 #define configTICK_RATE_HZ                      ((TickType_t)1000)
 #define configMAX_PRIORITIES                    5
@@ -107,7 +112,12 @@ extern uint32_t SystemCoreClock;
 #define configUSE_APPLICATION_TASK_TAG          0
 
 /* Memory allocation related definitions. */
+#ifdef K64F_STATIC_ALLOC
+/* Task stacks and kernel objects in .bss (STATIC_ALLOC=1) */
+#define configSUPPORT_STATIC_ALLOCATION         1
+#else
 #define configSUPPORT_STATIC_ALLOCATION         0
+#endif
 #define configSUPPORT_DYNAMIC_ALLOCATION        1
 #define configTOTAL_HEAP_SIZE                   ((size_t)(10240))
 #define configAPPLICATION_ALLOCATED_HEAP        0
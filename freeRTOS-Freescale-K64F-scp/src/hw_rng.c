@@ -0,0 +1,92 @@
+/* hw_rng.c
+ *
+ * K64F RNGA random number generator
+ *
+ * Copyright (C) 2019 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "fsl_rnga.h"
+#include "hw_rng.h"
+
+/* The RNGA output register holds a single word, and a new one is ready
+ * every 256 RNGA clocks. Words harvested in the background are kept in
+ * the pool, so that short requests (nonces, IVs) do not wait for it.
+ */
+#define HW_RNG_POOL_WORDS 16
+
+static uint32_t pool[HW_RNG_POOL_WORDS];
+static uint32_t pool_len;
+
+void hw_rng_init(void)
+{
+    RNGA_Init(RNG);
+    pool_len = 0;
+}
+
+static int rnga_word(uint32_t *w)
+{
+    while ((RNG->SR & RNG_SR_OREG_LVL_MASK) == 0) {
+        if (RNG->SR & RNG_SR_SECV_MASK)
+            return -1;
+    }
+    *w = RNG->OR;
+    return 0;
+}
+
+int hw_rng_block(uint8_t *out, uint32_t len)
+{
+    uint32_t w, n;
+    int ret = 0;
+
+    /* Scheduler lock only: the pool is shared between tasks, and the
+     * interrupts stay enabled while waiting for the RNGA */
+    vTaskSuspendAll();
+    while (len > 0) {
+        if (pool_len > 0) {
+            w = pool[--pool_len];
+            pool[pool_len] = 0;
+        } else if (rnga_word(&w) != 0) {
+            ret = -1;
+            break;
+        }
+        n = (len < sizeof(w)) ? len : sizeof(w);
+        memcpy(out, &w, n);
+        out += n;
+        len -= n;
+    }
+    xTaskResumeAll();
+    return ret;
+}
+
+uint32_t hw_rng_word(void)
+{
+    uint32_t w = 0;
+    hw_rng_block((uint8_t *)&w, sizeof(w));
+    return w;
+}
+
+void hw_rng_harvest(void)
+{
+    vTaskSuspendAll();
+    if ((pool_len < HW_RNG_POOL_WORDS) && (RNG->SR & RNG_SR_OREG_LVL_MASK))
+        pool[pool_len++] = RNG->OR;
+    xTaskResumeAll();
+}
@@ -0,0 +1,46 @@
+/* hw_rng.h
+ *
+ * K64F RNGA random number generator, with a small pool of prefetched
+ * words, used by wolfSSL (CUSTOM_RAND_GENERATE_BLOCK) and to seed
+ * picoTCP (pico_rand_feed).
+ *
+ * Copyright (C) 2019 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+#ifndef HW_RNG_H
+#define HW_RNG_H
+#include <stdint.h>
+
+/* Start the RNGA. Must be called before the first hw_rng_block(). */
+void hw_rng_init(void);
+
+/* Fill 'out' with 'len' random bytes, from the pool first, then from the
+ * RNGA. Returns 0, or -1 if the RNGA has stopped on a security violation.
+ * Must be called from a task.
+ */
+int hw_rng_block(uint8_t *out, uint32_t len);
+
+/* Single word (wolfSSL CUSTOM_RAND_GENERATE, picoTCP seed) */
+uint32_t hw_rng_word(void);
+
+/* Move one word from the RNGA to the pool, if one is ready. Does not
+ * wait: meant to be called periodically from a task.
+ */
+void hw_rng_harvest(void);
+
+#endif /* HW_RNG_H */
@@ -33,6 +33,7 @@
 #include "pico_ipv4.h"
 #include "pico_socket.h"
 #include "pico_enet_kinetis.h"
+#include "hw_rng.h"
 #include "board.h"
 #include "pin_mux.h"
 #include "clock_config.h"
@@ -46,6 +47,7 @@
 #include "wolfssh/error.h"
 #include "certs.h"
 #include "semphr.h"
+#include "event_groups.h"
 #include "wolfboot/wolfboot.h"
 #include "target.h"
 
@@ -62,8 +64,63 @@ extern unsigned int _end_stack;
 extern unsigned int _start_heap;
 
 static struct pico_socket *cli = NULL;
+static volatile int cli_closed = 0;
 static SemaphoreHandle_t picotcp_started;
-static SemaphoreHandle_t picotcp_rx_data;
+
+/* Task priorities above idle, see PICO_PRIO/MAIN_PRIO in the Makefile */
+#ifndef PICO_TASK_PRIO
+#define PICO_TASK_PRIO 0
+#endif
+#ifndef MAIN_TASK_PRIO
+#define MAIN_TASK_PRIO 0
+#endif
+#if (tskIDLE_PRIORITY + PICO_TASK_PRIO >= configMAX_PRIORITIES) || \
+    (tskIDLE_PRIORITY + MAIN_TASK_PRIO >= configMAX_PRIORITIES)
+#error "PICO_PRIO and MAIN_PRIO must be below configMAX_PRIORITIES"
+#endif
+
+#define PICO_TASK_STACK 400
+#define MAIN_TASK_STACK 1200
+
+#ifdef K64F_STATIC_ALLOC
+static StackType_t pico_task_stack[PICO_TASK_STACK];
+static StaticTask_t pico_task_tcb;
+static StackType_t main_task_stack[MAIN_TASK_STACK];
+static StaticTask_t main_task_tcb;
+static StaticSemaphore_t picotcp_started_buf;
+static StaticEventGroup_t scp_events_buf;
+
+/* Kernel task memory, required by configSUPPORT_STATIC_ALLOCATION */
+void vApplicationGetIdleTaskMemory(StaticTask_t **tcb, StackType_t **stack,
+        uint32_t *stack_size)
+{
+    static StaticTask_t idle_tcb;
+    static StackType_t idle_stack[configMINIMAL_STACK_SIZE];
+    *tcb = &idle_tcb;
+    *stack = idle_stack;
+    *stack_size = configMINIMAL_STACK_SIZE;
+}
+
+void vApplicationGetTimerTaskMemory(StaticTask_t **tcb, StackType_t **stack,
+        uint32_t *stack_size)
+{
+    static StaticTask_t timer_tcb;
+    static StackType_t timer_stack[configTIMER_TASK_STACK_DEPTH];
+    *tcb = &timer_tcb;
+    *stack = timer_stack;
+    *stack_size = configTIMER_TASK_STACK_DEPTH;
+}
+#endif
+
+/* Socket events, set by socket_cb() in the PicoTask context. The wolfSSH
+ * I/O callbacks block on them instead of polling the socket.
+ */
+#define SCP_IDLE_TIMEOUT_MS 60000
+#define SCP_EV_ACCEPT   (1 << 0)
+#define SCP_EV_RD       (1 << 1)
+#define SCP_EV_WR       (1 << 2)
+#define SCP_EV_CLOSE    (1 << 3)
+static EventGroupHandle_t scp_events;
 
 static void reboot(void)
 {
@@ -106,7 +163,14 @@ void init_data_bss(void)
 #include "task.h"
 
 static __attribute__ ((used,section(".noinit.$SRAM_LOWER_Heap5"))) uint8_t heap_sram_lower[16*1024]; /* placed in in no_init section inside SRAM_LOWER */
-static __attribute__ ((used,section(".noinit_Heap5"))) uint8_t heap_sram_upper[128*1024]; /* placed in in no_init section inside SRAM_UPPER */
+#ifdef K64F_STATIC_ALLOC
+/* Task stacks, kernel objects and the slab pools (src/slab.c) are static,
+ * the heap only serves the large allocations */
+#define HEAP_UPPER_SIZE (72*1024)
+#else
+#define HEAP_UPPER_SIZE (128*1024)
+#endif
+static __attribute__ ((used,section(".noinit_Heap5"))) uint8_t heap_sram_upper[HEAP_UPPER_SIZE]; /* placed in in no_init section inside SRAM_UPPER */
 
 static HeapRegion_t xHeapRegions[] =
 {
@@ -121,13 +185,42 @@ static void socket_cb(uint16_t ev, struct pico_socket *s)
     struct pico_ip4 client_addr;
     uint16_t client_port;
     if (ev & PICO_SOCK_EV_CONN) {
-        cli = pico_socket_accept(s, &client_addr, &client_port);
+        struct pico_socket *cs = pico_socket_accept(s, &client_addr, &client_port);
+        if (!cs)
+            return;
+        if (cli) {
+            /* One session at a time */
+            pico_socket_close(cs);
+            return;
+        }
+        cli_closed = 0;
+        cli = cs;
+        xEventGroupSetBits(scp_events, SCP_EV_ACCEPT);
         return;
     }
-    if (ev & PICO_SOCK_EV_RD) {
-        xSemaphoreGive(picotcp_rx_data);
+    if (s != cli)
+        return;
+    if (ev & PICO_SOCK_EV_RD)
+        xEventGroupSetBits(scp_events, SCP_EV_RD);
+    if (ev & PICO_SOCK_EV_WR)
+        xEventGroupSetBits(scp_events, SCP_EV_WR);
+    if (ev & (PICO_SOCK_EV_FIN | PICO_SOCK_EV_CLOSE | PICO_SOCK_EV_ERR)) {
+        cli_closed = 1;
+        xEventGroupSetBits(scp_events, SCP_EV_CLOSE);
     }
+}
 
+/* Block until one of 'ev' (or a close) is signalled on the client socket */
+static int scp_wait(EventBits_t ev)
+{
+    EventBits_t got;
+    if (cli_closed)
+        return -1;
+    got = xEventGroupWaitBits(scp_events, ev | SCP_EV_CLOSE, pdTRUE, pdFALSE,
+            pdMS_TO_TICKS(SCP_IDLE_TIMEOUT_MS));
+    if ((got & (ev | SCP_EV_CLOSE)) == 0)
+        return -1;
+    return 0;
 }
 
 static INLINE void c32toa(word32 u32, byte* c)
@@ -436,14 +529,29 @@ int wolfssh_socket_send(WOLFSSH *ssh, void *_data, word32 len, void *_ctx)
 {
     struct pico_socket *cli = (struct pico_socket *)_ctx;
     uint8_t *data = _data;
-    return pico_socket_write(cli, data, len);
+    int r;
+    while ((r = pico_socket_write(cli, data, len)) == 0) {
+        /* TCP send queue full */
+        if (scp_wait(SCP_EV_WR) < 0)
+            return cli_closed ? WS_CBIO_ERR_CONN_CLOSE : WS_CBIO_ERR_TIMEOUT;
+    }
+    if (r < 0)
+        return WS_CBIO_ERR_GENERAL;
+    return r;
 }
 
 int wolfssh_socket_recv(WOLFSSH *ssh, void *_data, word32 len, void *_ctx)
 {
     struct pico_socket *cli = (struct pico_socket *)_ctx;
     uint8_t *data = _data;
-    return pico_socket_read(cli, data, len);
+    int r;
+    while ((r = pico_socket_read(cli, data, len)) == 0) {
+        if (scp_wait(SCP_EV_RD) < 0)
+            return cli_closed ? WS_CBIO_ERR_CONN_CLOSE : WS_CBIO_ERR_TIMEOUT;
+    }
+    if (r < 0)
+        return WS_CBIO_ERR_GENERAL;
+    return r;
 }
 
 void MainTask(void *pv)
@@ -463,8 +571,6 @@ void MainTask(void *pv)
     pico_socket_bind(s, &any, &port);
     pico_socket_listen(s, 1);
 
-    cli = pico_socket_accept(s, NULL, NULL);
-
     WOLFSSH_CTX *ctx = wolfSSH_CTX_new(WOLFSSH_ENDPOINT_SERVER, NULL);
     memset(&pubkeyMapList, 0, sizeof(pubkeyMapList));
     wolfSSH_SetUserAuth(ctx, UserAuth);
@@ -488,22 +594,20 @@ void MainTask(void *pv)
     wolfSSH_SetIORecv(ctx, wolfssh_socket_recv);
     wolfSSH_SetIOSend(ctx, wolfssh_socket_send);
 
-    while(!cli) {
-        vTaskDelay(pdMS_TO_TICKS(5));
-    }
-    ssh = wolfSSH_new(ctx);
-    if (!ssh)
-        while(1)
-            ;
     /* Set SCP callbacks */
     wolfSSH_SetScpRecv(ctx, update_recv_data);
     wolfSSH_SetScpSend(ctx, update_send_data);
 
-    /* Set auth CTX based on the MapList */
-    wolfSSH_SetUserAuthCtx(ssh, &pubkeyMapList);
-
     wolfBoot_success();
     while (1) {
+        /* Sleep until a client connects */
+        while (!cli)
+            xEventGroupWaitBits(scp_events, SCP_EV_ACCEPT, pdTRUE, pdFALSE, portMAX_DELAY);
+        ssh = wolfSSH_new(ctx);
+        if (!ssh)
+            while(1)
+                ;
+        /* Set auth CTX based on the MapList */
         wolfSSH_SetUserAuthCtx(ssh, &pubkeyMapList);
         wolfSSH_SetIOReadCtx(ssh, cli);
         wolfSSH_SetIOWriteCtx(ssh, cli);
@@ -520,33 +624,57 @@ void MainTask(void *pv)
         wolfSSH_stream_exit(ssh, 0);
         pico_socket_close(cli);
         wolfSSH_free(ssh);
+        cli = NULL;
+        xEventGroupClearBits(scp_events, SCP_EV_RD | SCP_EV_WR | SCP_EV_CLOSE);
     }
 }
 
 void PicoTask(void *pv) {
     struct pico_device *dev = NULL;
     struct pico_ip4 addr, mask, gw, any;
-    TickType_t xLastWakeTime;
+#ifndef PICO_SUPPORT_TICKLESS
     const TickType_t xFrequency = 5;
+#endif
+    uint8_t led_link = 0;
 
     pico_string_to_ipv4("192.168.178.211", &addr.addr);
     pico_string_to_ipv4("255.255.255.0", &mask.addr);
     pico_string_to_ipv4("192.168.178.1", &gw.addr);
     any.addr = 0;
     pico_stack_init();
+    /* Seed the picoTCP generator (ports, sequence numbers) */
+    pico_rand_feed(hw_rng_word());
+    pico_enet_set_rx_task(xTaskGetCurrentTaskHandle());
     dev = pico_enet_create("en0");
     if (dev) {
        pico_ipv4_link_add(dev, addr, mask);
        pico_ipv4_route_add(any, any, gw, 1, NULL);
-       LED_GREEN_ON();
     }
     xSemaphoreGive(picotcp_started);
     pico_stack_tick();
 
-    xLastWakeTime = xTaskGetTickCount();
     while(1) {
-        vTaskDelayUntil(&xLastWakeTime, xFrequency);
+#ifdef PICO_SUPPORT_TICKLESS
+        /* Run the stack, then sleep until its next timer is due or the
+         * ENET interrupt signals a frame: with nothing else to run, the
+         * idle task stops the tick for that long */
+        long long next = pico_stack_go();
+        ulTaskNotifyTake(pdTRUE, (next < 0) ? portMAX_DELAY : pdMS_TO_TICKS((TickType_t)next));
+#else
+        /* Run the stack timers every xFrequency ticks, or as soon as the
+         * ENET RX interrupt signals a new frame */
+        ulTaskNotifyTake(pdTRUE, xFrequency);
         pico_stack_tick();
+#endif
+        hw_rng_harvest();
+        /* Green LED on while the link is up */
+        if (pico_enet_stats()->link_up != led_link) {
+            led_link = pico_enet_stats()->link_up;
+            if (led_link)
+                LED_GREEN_ON();
+            else
+                LED_GREEN_OFF();
+        }
     }
 }
 /*
@@ -559,17 +687,29 @@ int main(void) {
     SYSMPU_Enable(SYSMPU, false);
 
     LED_GREEN_INIT(1);
+    hw_rng_init();
     vPortDefineHeapRegions(xHeapRegions); // Pass the array into vPortDefineHeapRegions(). Must be called first!
 
+#ifdef K64F_STATIC_ALLOC
+    picotcp_started = xSemaphoreCreateBinaryStatic(&picotcp_started_buf);
+    scp_events = xEventGroupCreateStatic(&scp_events_buf);
+#else
     picotcp_started = xSemaphoreCreateBinary();
-    picotcp_rx_data = xSemaphoreCreateBinary();
+    scp_events = xEventGroupCreate();
+#endif
 
+#ifdef K64F_STATIC_ALLOC
+    xTaskCreateStatic(PicoTask, "picoTCP", PICO_TASK_STACK, NULL,
+            tskIDLE_PRIORITY + PICO_TASK_PRIO, pico_task_stack, &pico_task_tcb);
+    xTaskCreateStatic(MainTask, "Main", MAIN_TASK_STACK, NULL,
+            tskIDLE_PRIORITY + MAIN_TASK_PRIO, main_task_stack, &main_task_tcb);
+#else
     if (xTaskCreate(
         PicoTask,  /* pointer to the task */
         "picoTCP", /* task name for kernel awareness debugging */
-        400, /* task stack size */
+        PICO_TASK_STACK, /* task stack size */
         (void*)NULL, /* optional task startup argument */
-        tskIDLE_PRIORITY,  /* initial priority */
+        tskIDLE_PRIORITY + PICO_TASK_PRIO,  /* initial priority */
         (xTaskHandle*)NULL /* optional task handle to create */
       ) != pdPASS) {
        for(;;){} /* error! probably out of memory */
@@ -577,13 +717,14 @@ int main(void) {
     if (xTaskCreate(
         MainTask,  /* pointer to the task */
         "Main", /* task name for kernel awareness debugging */
-        1200, /* task stack size */
+        MAIN_TASK_STACK, /* task stack size */
         (void*)NULL, /* optional task startup argument */
-        tskIDLE_PRIORITY,  /* initial priority */
+        tskIDLE_PRIORITY + MAIN_TASK_PRIO,  /* initial priority */
         (xTaskHandle*)NULL /* optional task handle to create */
       ) != pdPASS) {
        for(;;){} /* error! probably out of memory */
     }
+#endif
 
     vTaskStartScheduler();
     while(1) {
@@ -0,0 +1,202 @@
+/* slab.c
+ *
+ * Fixed-size block pools in front of the FreeRTOS heap
+ *
+ * Copyright (C) 2019 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "slab.h"
+
+/* Pool sizes. The 1600 bytes blocks hold a full Ethernet frame with the
+ * picoTCP headroom; the smaller ones the picoTCP frame, timer and socket
+ * structures and most wolfSSL/wolfSSH objects. TLS record buffers above
+ * that size come from the heap.
+ */
+#define SLAB_POOL(sz, n) \
+    static uint64_t pool_##sz[(sz) * (n) / sizeof(uint64_t)]
+SLAB_POOL(32, 64);
+SLAB_POOL(64, 64);
+SLAB_POOL(128, 32);
+SLAB_POOL(256, 16);
+SLAB_POOL(512, 8);
+SLAB_POOL(1600, 12);
+
+struct slab {
+    uint8_t *start;
+    uint8_t *end;
+    void *free_list;
+    struct slab_stats st;
+};
+
+#define SLAB(sz, n) \
+    { (uint8_t *)pool_##sz, (uint8_t *)pool_##sz + sizeof(pool_##sz), NULL, { sz, n, 0, 0, 0 } }
+static struct slab slabs[SLAB_POOLS] = {
+    SLAB(32, 64),
+    SLAB(64, 64),
+    SLAB(128, 32),
+    SLAB(256, 16),
+    SLAB(512, 8),
+    SLAB(1600, 12),
+};
+#define SLAB_N ((int)(sizeof(slabs) / sizeof(slabs[0])))
+
+static uint32_t large_allocs;
+static int slab_ready;
+
+/* Heap blocks carry their size, for slab_realloc() */
+#define HEAP_HDR 8
+
+static void slab_init(void)
+{
+    uint8_t *b;
+    int i;
+    for (i = 0; i < SLAB_N; i++) {
+        slabs[i].free_list = NULL;
+        for (b = slabs[i].end - slabs[i].st.size; b >= slabs[i].start; b -= slabs[i].st.size) {
+            *(void **)b = slabs[i].free_list;
+            slabs[i].free_list = b;
+        }
+    }
+    slab_ready = 1;
+}
+
+static int slab_of(const void *ptr)
+{
+    int i;
+    for (i = 0; i < SLAB_N; i++) {
+        if (((const uint8_t *)ptr >= slabs[i].start) && ((const uint8_t *)ptr < slabs[i].end))
+            return i;
+    }
+    return -1;
+}
+
+static void *heap_alloc(size_t size)
+{
+    uint8_t *p = pvPortMalloc(size + HEAP_HDR);
+    if (!p)
+        return NULL;
+    *(size_t *)p = size;
+    return p + HEAP_HDR;
+}
+
+void *slab_alloc(size_t size)
+{
+    void *p = NULL;
+    int i, first = -1;
+
+    if (size == 0)
+        return NULL;
+    vTaskSuspendAll();
+    if (!slab_ready)
+        slab_init();
+    /* Smallest block that fits, or the next size up if that pool is
+     * empty */
+    for (i = 0; i < SLAB_N; i++) {
+        if (size > slabs[i].st.size)
+            continue;
+        if (first < 0)
+            first = i;
+        p = slabs[i].free_list;
+        if (p) {
+            slabs[i].free_list = *(void **)p;
+            if (++slabs[i].st.used > slabs[i].st.used_max)
+                slabs[i].st.used_max = slabs[i].st.used;
+            break;
+        }
+    }
+    if (first < 0)
+        large_allocs++;
+    else if (!p)
+        slabs[first].st.fallback++;
+    (void)xTaskResumeAll();
+    if (!p)
+        p = heap_alloc(size);
+    return p;
+}
+
+void *slab_zalloc(size_t size)
+{
+    void *p = slab_alloc(size);
+    if (p)
+        memset(p, 0, size);
+    return p;
+}
+
+void slab_free(void *ptr)
+{
+    int i;
+    if (!ptr)
+        return;
+    i = slab_of(ptr);
+    if (i < 0) {
+        vPortFree((uint8_t *)ptr - HEAP_HDR);
+        return;
+    }
+    vTaskSuspendAll();
+    *(void **)ptr = slabs[i].free_list;
+    slabs[i].free_list = ptr;
+    slabs[i].st.used--;
+    (void)xTaskResumeAll();
+}
+
+void *slab_realloc(void *ptr, size_t size)
+{
+    size_t old;
+    void *p;
+    int i;
+
+    if (!ptr)
+        return slab_alloc(size);
+    if (size == 0) {
+        slab_free(ptr);
+        return NULL;
+    }
+    i = slab_of(ptr);
+    if (i >= 0)
+        old = slabs[i].st.size;
+    else
+        old = *(size_t *)((uint8_t *)ptr - HEAP_HDR);
+    if (size <= old)
+        return ptr;
+    p = slab_alloc(size);
+    if (p) {
+        memcpy(p, ptr, old);
+        slab_free(ptr);
+    }
+    return p;
+}
+
+int slab_count(void)
+{
+    return SLAB_N;
+}
+
+const struct slab_stats *slab_stats(int i)
+{
+    if ((i < 0) || (i >= SLAB_N))
+        return NULL;
+    return &slabs[i].st;
+}
+
+uint32_t slab_large_allocs(void)
+{
+    return large_allocs;
+}
@@ -0,0 +1,55 @@
+/* slab.h
+ *
+ * Fixed-size block pools in front of the FreeRTOS heap (STATIC_ALLOC=1)
+ *
+ * Allocations are served from the smallest pool whose blocks fit, in
+ * constant time and without splitting or coalescing. Requests larger than
+ * the biggest block, or made while the pool is empty, fall back to
+ * pvPortMalloc().
+ *
+ * Copyright (C) 2019 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+#ifndef SLAB_H
+#define SLAB_H
+#include <stddef.h>
+#include <stdint.h>
+
+struct slab_stats {
+    uint16_t size;          /* Block size, in bytes */
+    uint16_t count;         /* Blocks in the pool */
+    uint16_t used;
+    uint16_t used_max;
+    uint32_t fallback;      /* Requests sent to the heap: this pool and
+                             * the larger ones were empty */
+};
+
+void *slab_alloc(size_t size);
+void *slab_zalloc(size_t size);
+void *slab_realloc(void *ptr, size_t size);
+void slab_free(void *ptr);
+
+/* Number of pools, and statistics of pool 'i' (smallest first) */
+#define SLAB_POOLS 6
+int slab_count(void);
+const struct slab_stats *slab_stats(int i);
+
+/* Requests larger than the biggest block, sent to the heap */
+uint32_t slab_large_allocs(void);
+
+#endif /* SLAB_H */
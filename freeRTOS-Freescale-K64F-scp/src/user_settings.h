@@ -5,6 +5,7 @@
 #include "task.h"
 #include "portmacro.h"
 #include "pico_stack.h"
+#include "hw_rng.h"
 #include "pico_socket.h"
 #include "pico_port.h"
 
@@ -47,13 +48,21 @@ static inline int pico_recv(void *ssl, char *buf, int len, void *ctx)
 //#define WOLFSSL_LOG_PRINTF
 #define SINGLE_THREADED
 #define WOLFSSL_USER_IO
-#define CUSTOM_RAND_GENERATE pico_rand
+/* K64F RNGA, see src/hw_rng.c */
+#define CUSTOM_RAND_GENERATE hw_rng_word
 #define CUSTOM_RAND_TYPE uint32_t 
 #define CUSTOM_RAND_GENERATE_BLOCK rnd_custom_generate_block
 #define XMALLOC_OVERRIDE
+#ifdef K64F_STATIC_ALLOC
+#include "slab.h"
+#define XMALLOC(s, h, type) slab_alloc((s))
+#define XREALLOC(p, n, h, t) slab_realloc((p), (n))
+#define XFREE(p, h, type)  slab_free((p))
+#else
 #define XMALLOC(s, h, type) pvPortMalloc((s))
 #define XREALLOC(p, n, h, t) pvPortRealloc((p), (n))
 #define XFREE(p, h, type)  vPortFree((p))
+#endif
 #define NO_WOLFSSH_CLIENT
 
 #define TIME_OVERRIDES
@@ -102,6 +111,17 @@ static inline long XTIME(long *x) { return xTaskGetTickCount() / configTICK_RATE
 #define USE_SLOW_SHA2
 //#define USE_SLOW_SHA512
 
+/* mmCAU: K64F crypto coprocessor for SHA-256 and the AES block cipher
+ * (also used by AES-GCM). Needs the mmCAU library from the Kinetis SDK
+ * (middleware/mmcau), which is linked when building with MMCAU=1.
+ */
+#ifdef K64F_MMCAU
+#   define FREESCALE_MMCAU
+#   define FREESCALE_MMCAU_SHA
+#   define FREESCALE_USE_MMCAU
+#   undef USE_SLOW_SHA2
+#endif
+
 /* AES */
 #define HAVE_AESGCM
 #define HAVE_AESCCM
@@ -43,7 +43,25 @@
 
 #define MSGLEN      (4 + 4 + 8)
 #define PORT "/dev/ttyACM0" 
+#define BAUD_DEFAULT 115200
+#define MAX_RATES   8
 
+/* Baud rate negotiation: the host proposes a rate at the current speed
+ * with [A5 5B rate32], the target replies with ['$' rate32] (or '!' if the
+ * rate is not supported) and both sides switch. The host then sends
+ * [A5 5C rate32] at the new speed, which the target must echo back as
+ * ['$' rate32]. If anything goes wrong, both sides fall back to the
+ * speed in use before the proposal, i.e. the initial speed (-b), which
+ * must match the speed the target starts at.
+ */
+#define BAUD_PROPOSE 0x5B
+#define BAUD_CONFIRM 0x5C
+#define BAUD_ACK     '$'
+#define BAUD_NACK    '!'
+#define BAUD_TARGET_TIMEOUT_US 1000000
+
+/* Reads time out after VTIME (0.5 s) */
+#define VERSION_READ_TIMEOUTS 4
 
 static volatile int cleanup;                 /* To handle shutdown */
 union usb_ack {
@@ -57,6 +75,62 @@ static unsigned int  pktbuf_size = 0;
 static int serialfd = -1;
 static uint32_t high_ack;
 
+static const struct baud_map {
+    uint32_t rate;
+    speed_t speed;
+} baud_table[] = {
+    { 9600, B9600 },
+    { 19200, B19200 },
+    { 38400, B38400 },
+    { 57600, B57600 },
+    { 115200, B115200 },
+    { 230400, B230400 },
+#ifdef B460800
+    { 460800, B460800 },
+#endif
+#ifdef B921600
+    { 921600, B921600 },
+#endif
+#ifdef B1000000
+    { 1000000, B1000000 },
+#endif
+#ifdef B1500000
+    { 1500000, B1500000 },
+#endif
+#ifdef B2000000
+    { 2000000, B2000000 },
+#endif
+#ifdef B3000000
+    { 3000000, B3000000 },
+#endif
+};
+
+static int baud_to_speed(uint32_t rate, speed_t *speed)
+{
+    unsigned int i;
+    for (i = 0; i < sizeof(baud_table) / sizeof(baud_table[0]); i++) {
+        if (baud_table[i].rate == rate) {
+            *speed = baud_table[i].speed;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int serial_set_speed(int fd, uint32_t rate)
+{
+    struct termios tty;
+    speed_t speed;
+    if (baud_to_speed(rate, &speed) < 0)
+        return -1;
+    tcdrain(fd);
+    if (tcgetattr(fd, &tty) < 0)
+        return -1;
+    cfsetospeed(&tty, speed);
+    cfsetispeed(&tty, speed);
+    return tcsetattr(fd, TCSAFLUSH, &tty);
+}
+
 
 void alarm_handler(int signo)
 {
@@ -110,6 +184,97 @@ static void check(uint8_t *pkt)
         *c += p[i];
 }
 
+static void send_baud_pkt(uint8_t type, uint32_t rate)
+{
+    uint8_t pkt[2 + sizeof(uint32_t)] = { 0xA5, type };
+    memcpy(pkt + 2, &rate, sizeof(uint32_t));
+    write(serialfd, pkt, sizeof(pkt));
+}
+
+/* Wait for ['$' rate32] from the target. Any other byte is treated as line
+ * noise (e.g. a framing error after a speed switch), and the read times out
+ * after VTIME with no data.
+ */
+static int recv_baud_ack(uint32_t rate)
+{
+    uint8_t c;
+    uint32_t echo;
+    uint8_t *e = (uint8_t *)&echo;
+    int i = 0;
+    int res;
+    while (1) {
+        res = read(serialfd, &c, 1);
+        if (res <= 0)
+            return -1;
+        if (c == BAUD_NACK)
+            return -1;
+        if (c == BAUD_ACK)
+            break;
+    }
+    while (i < 4) {
+        res = read(serialfd, &e[i], 1);
+        if (res <= 0)
+            return -1;
+        i++;
+    }
+    if (echo != rate)
+        return -1;
+    return 0;
+}
+
+/* Try each proposed rate in order, returning the rate in use when done. */
+static uint32_t negotiate_baud(uint32_t base, const uint32_t *rates, int n_rates)
+{
+    int i;
+    speed_t speed;
+    for (i = 0; i < n_rates; i++) {
+        if ((rates[i] == base) || (baud_to_speed(rates[i], &speed) < 0)) {
+            printf("Skipping baud rate %u\n", rates[i]);
+            continue;
+        }
+        printf("Proposing baud rate %u... ", rates[i]);
+        fflush(stdout);
+        tcflush(serialfd, TCIOFLUSH);
+        send_baud_pkt(BAUD_PROPOSE, rates[i]);
+        if (recv_baud_ack(rates[i]) < 0) {
+            printf("refused.\n");
+            continue;
+        }
+        serial_set_speed(serialfd, rates[i]);
+        usleep(20000);
+        send_baud_pkt(BAUD_CONFIRM, rates[i]);
+        if (recv_baud_ack(rates[i]) == 0) {
+            printf("ok.\n");
+            return rates[i];
+        }
+        printf("failed, falling back to %u.\n", base);
+        serial_set_speed(serialfd, base);
+        /* Give the target time to time out and revert as well */
+        usleep(BAUD_TARGET_TIMEOUT_US);
+        tcflush(serialfd, TCIOFLUSH);
+    }
+    return base;
+}
+
+static int parse_rates(char *arg, uint32_t *rates)
+{
+    int n = 0;
+    char *tok = strtok(arg, ",");
+    while (tok && (n < MAX_RATES)) {
+        rates[n++] = strtoul(tok, NULL, 10);
+        tok = strtok(NULL, ",");
+    }
+    return n;
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [-d device] [-b baud] [-r rate[,rate...]] firmware_filename\n", name);
+    printf("  -d device  serial port to use (default: %s)\n", PORT);
+    printf("  -b baud    initial baud rate, as configured on the target (default: %d)\n", BAUD_DEFAULT);
+    printf("  -r rates   baud rates to propose to the target, in order of preference\n");
+}
+
 
 int main(int argc, char** argv)
 {
@@ -120,16 +285,41 @@ int main(int argc, char** argv)
     struct stat   st;
     union usb_ack ack;
     struct termios tty;
+    const char    *port = PORT;
+    uint32_t      baud = BAUD_DEFAULT;
+    uint32_t      rates[MAX_RATES];
+    int           n_rates = 0;
+    speed_t       speed;
+    int           opt;
     sigset(SIGALRM, alarm_handler);
-    
 
+    while ((opt = getopt(argc, argv, "d:b:r:")) != -1) {
+        switch (opt) {
+            case 'd':
+                port = optarg;
+                break;
+            case 'b':
+                baud = strtoul(optarg, NULL, 10);
+                break;
+            case 'r':
+                n_rates = parse_rates(optarg, rates);
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
 
-    if (argc != 2) {
-        printf("Usage: %s firmware_filename\n", argv[0]);
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        exit(1);
+    }
+    if (baud_to_speed(baud, &speed) < 0) {
+        printf("Unsupported baud rate %u\n", baud);
         exit(1);
     }
 
-    ffd = open(argv[1], O_RDONLY);
+    ffd = open(argv[optind], O_RDONLY);
     if (ffd < 0) {
         perror("opening file");
         exit(2);
@@ -141,10 +331,14 @@ int main(int argc, char** argv)
         exit(2);
     }
     tot_len = st.st_size;
-    serialfd = open(PORT, O_RDWR | O_NOCTTY);
+    serialfd = open(port, O_RDWR | O_NOCTTY);
+    if (serialfd < 0) {
+        perror("opening serial port");
+        exit(2);
+    }
     tcgetattr(serialfd, &tty);
-    cfsetospeed(&tty, B115200);
-    cfsetispeed(&tty, B115200);
+    cfsetospeed(&tty, speed);
+    cfsetispeed(&tty, speed);
     tty.c_cflag = (tty.c_cflag & ~CSIZE) | (CS8);
     tty.c_iflag &= ~(IGNBRK | IXON | IXOFF | IXANY| INLCR | ICRNL);
     tty.c_oflag &= ~OPOST;
@@ -168,6 +362,21 @@ int main(int argc, char** argv)
         if (c == '#') {
             break;
         }
+        else if (c == '*') {
+            /* Target announcing its version: '*' followed by 4 bytes */
+            uint8_t v[4];
+            int i = 0, timeouts = 0;
+            while (i < 4) {
+                if (read(serialfd, &v[i], 1) == 1) {
+                    i++;
+                } else if (++timeouts > VERSION_READ_TIMEOUTS) {
+                    printf("Timeout reading the target version\n");
+                    exit(2);
+                }
+            }
+            printf("Target version: %u\n", (v[0] << 24) | (v[1] << 16) | (v[2] << 8) | v[3]);
+            break;
+        }
         else {
             printf("%c",c);
             fflush(stdout);
@@ -176,6 +385,10 @@ int main(int argc, char** argv)
     }
     printf("Target connected.\n");
     usleep(500000);
+    if (n_rates > 0) {
+        baud = negotiate_baud(baud, rates, n_rates);
+        printf("Using baud rate %u\n", baud);
+    }
     printf("Starting update.\n");
 
 
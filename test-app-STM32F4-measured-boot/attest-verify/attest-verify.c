@@ -0,0 +1,792 @@
+/* attest-verify.c
+ *
+ * Host-side verifier for the measured boot attestation records produced
+ * by the STM32F4 test application.
+ *
+ * Copyright (C) 2021 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ *
+ *=============================================================================
+ *
+ * For each record:
+ *  - the attestation key included in the record must be one of the enrolled
+ *    keys (-k), and the ECDSA signature of the quote is verified with it,
+ *  - the nonce must have been issued by this tool (-n), recently and for
+ *    this record only,
+ *  - the nonce and the PCR selection in the quote are compared with the
+ *    record, and the PCR digest in the quote is recomputed from the PCR
+ *    values,
+ *  - the measured boot PCR is compared with the values expected after
+ *    wolfBoot extends a reset PCR with the hash of one of the signed
+ *    firmware images given on the command line, and the version in the
+ *    record must be the version of that image.
+ *
+ * The boot-phase timestamps are not part of the quote: they are printed,
+ * but nothing vouches for them.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+
+#include <wolfssl/options.h>
+#include <wolfssl/wolfcrypt/settings.h>
+#include <wolfssl/wolfcrypt/sha256.h>
+#include <wolfssl/wolfcrypt/ecc.h>
+
+#include "attest_record.h"
+
+#define PORT "/dev/ttyACM0"
+#define MAX_IMAGES 16
+#define MAX_AIKS 256
+#define AIK_COORD_SZ 32
+#define MAX_NONCES 4096
+#define NONCE_SZ 16
+#define NONCE_MAX_AGE 3600 /* seconds */
+
+/* wolfBoot manifest header */
+#define WOLFBOOT_MAGIC          0x464C4F57 /* WOLF */
+#define IMAGE_HEADER_SIZE       256
+#define HDR_END                 0x00
+#define HDR_VERSION             0x01
+#define HDR_SHA256              0x03
+#define HDR_PADDING             0xFF
+
+/* TPMS_ATTEST */
+#define TPM_GENERATED_VALUE     0xFF544347
+#define TPM_ST_ATTEST_QUOTE     0x8018
+
+struct expected_image {
+    const char *name;
+    uint32_t version;
+    uint8_t pcr[WC_SHA256_DIGEST_SIZE];
+};
+
+static struct expected_image images[MAX_IMAGES];
+static int n_images = 0;
+static int measured_pcr = 16;
+
+/* Attestation keys of the enrolled devices, by SHA-256 of x || y */
+struct enrolled_aik {
+    uint8_t fp[WC_SHA256_DIGEST_SIZE];
+    char name[32];
+};
+
+static struct enrolled_aik aiks[MAX_AIKS];
+static int n_aiks = 0;
+
+/* Nonces sent in attestation requests */
+struct issued_nonce {
+    uint8_t nonce[NONCE_SZ];
+    time_t issued;
+    int used;
+};
+
+static struct issued_nonce nonces[MAX_NONCES];
+static int n_nonces = 0;
+static long nonce_max_age = NONCE_MAX_AGE;
+
+struct pcr_value {
+    uint16_t alg;
+    uint8_t index;
+    uint8_t size;
+    const uint8_t *digest;
+};
+
+struct record {
+    uint32_t version;
+    uint8_t n_ts;
+    uint32_t ts[ATTEST_TS_COUNT];
+    uint8_t nonce_sz;
+    const uint8_t *nonce;
+    uint8_t n_pcr;
+    struct pcr_value pcr[8];
+    uint16_t attest_sz;
+    const uint8_t *attest;
+    uint16_t sig_hash;
+    uint8_t r_sz, s_sz, x_sz, y_sz;
+    const uint8_t *r, *s, *x, *y;
+};
+
+/* Bounds-checked little-endian reader over a record buffer */
+struct reader {
+    const uint8_t *buf;
+    uint32_t len;
+    uint32_t off;
+    int err;
+};
+
+static const uint8_t *rd_bytes(struct reader *rd, uint32_t len)
+{
+    const uint8_t *p;
+    if (rd->err || (rd->off + len > rd->len)) {
+        rd->err = 1;
+        return NULL;
+    }
+    p = rd->buf + rd->off;
+    rd->off += len;
+    return p;
+}
+
+static uint8_t rd_u8(struct reader *rd)
+{
+    const uint8_t *p = rd_bytes(rd, 1);
+    return p ? p[0] : 0;
+}
+
+static uint16_t rd_u16(struct reader *rd)
+{
+    const uint8_t *p = rd_bytes(rd, 2);
+    return p ? (p[0] | (p[1] << 8)) : 0;
+}
+
+static uint32_t rd_u32(struct reader *rd)
+{
+    const uint8_t *p = rd_bytes(rd, 4);
+    return p ? (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24)) : 0;
+}
+
+/* TPM structures are big-endian */
+static uint16_t rd_be16(struct reader *rd)
+{
+    const uint8_t *p = rd_bytes(rd, 2);
+    return p ? ((p[0] << 8) | p[1]) : 0;
+}
+
+static uint32_t rd_be32(struct reader *rd)
+{
+    const uint8_t *p = rd_bytes(rd, 4);
+    return p ? (((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]) : 0;
+}
+
+static int parse_record(const uint8_t *buf, uint32_t len, struct record *rec)
+{
+    struct reader rd = { buf, len, 0, 0 };
+    const uint8_t *magic;
+    int i;
+
+    memset(rec, 0, sizeof(*rec));
+    magic = rd_bytes(&rd, ATTEST_MAGIC_SZ);
+    if (!magic || memcmp(magic, ATTEST_MAGIC, ATTEST_MAGIC_SZ) != 0)
+        return -1;
+    rec->version = rd_u32(&rd);
+    rec->n_ts = rd_u8(&rd);
+    for (i = 0; i < rec->n_ts; i++) {
+        uint32_t ts = rd_u32(&rd);
+        if (i < ATTEST_TS_COUNT)
+            rec->ts[i] = ts;
+    }
+    rec->nonce_sz = rd_u8(&rd);
+    rec->nonce = rd_bytes(&rd, rec->nonce_sz);
+    rec->n_pcr = rd_u8(&rd);
+    if (rec->n_pcr > 8)
+        return -1;
+    for (i = 0; i < rec->n_pcr; i++) {
+        rec->pcr[i].alg = rd_u16(&rd);
+        rec->pcr[i].index = rd_u8(&rd);
+        rec->pcr[i].size = rd_u8(&rd);
+        rec->pcr[i].digest = rd_bytes(&rd, rec->pcr[i].size);
+    }
+    rec->attest_sz = rd_u16(&rd);
+    rec->attest = rd_bytes(&rd, rec->attest_sz);
+    rec->sig_hash = rd_u16(&rd);
+    rec->r_sz = rd_u8(&rd);
+    rec->r = rd_bytes(&rd, rec->r_sz);
+    rec->s_sz = rd_u8(&rd);
+    rec->s = rd_bytes(&rd, rec->s_sz);
+    rec->x_sz = rd_u8(&rd);
+    rec->x = rd_bytes(&rd, rec->x_sz);
+    rec->y_sz = rd_u8(&rd);
+    rec->y = rd_bytes(&rd, rec->y_sz);
+    return rd.err ? -1 : 0;
+}
+
+static int verify_signature(const struct record *rec)
+{
+    ecc_key key;
+    uint8_t hash[WC_SHA256_DIGEST_SIZE];
+    uint8_t sig[ECC_MAX_SIG_SIZE];
+    word32 sig_sz = sizeof(sig);
+    int res = 0;
+    int ret;
+
+    if (rec->sig_hash != ATTEST_ALG_SHA256)
+        return -1;
+    if ((rec->x_sz != AIK_COORD_SZ) || (rec->y_sz != AIK_COORD_SZ))
+        return -1;
+    if (wc_Sha256Hash(rec->attest, rec->attest_sz, hash) != 0)
+        return -1;
+    if (wc_ecc_rs_raw_to_sig(rec->r, rec->r_sz, rec->s, rec->s_sz,
+                sig, &sig_sz) != 0)
+        return -1;
+    if (wc_ecc_init(&key) != 0)
+        return -1;
+    ret = wc_ecc_import_unsigned(&key, (byte *)rec->x, (byte *)rec->y,
+            NULL, ECC_SECP256R1);
+    if (ret == 0)
+        ret = wc_ecc_verify_hash(sig, sig_sz, hash, sizeof(hash), &res, &key);
+    wc_ecc_free(&key);
+    return ((ret == 0) && (res == 1)) ? 0 : -1;
+}
+
+/* Check the TPMS_ATTEST against the record: nonce, PCR selection and
+ * PCR digest. */
+static const char *verify_attest(const struct record *rec)
+{
+    struct reader rd = { rec->attest, rec->attest_sz, 0, 0 };
+    const uint8_t *extra, *pcr_digest;
+    uint16_t sz;
+    uint32_t count, b;
+    int i, n = 0;
+    uint8_t digest[WC_SHA256_DIGEST_SIZE];
+    wc_Sha256 sha;
+
+    if (rd_be32(&rd) != TPM_GENERATED_VALUE)
+        return "bad TPMS_ATTEST magic";
+    if (rd_be16(&rd) != TPM_ST_ATTEST_QUOTE)
+        return "not a quote";
+    sz = rd_be16(&rd);                  /* qualifiedSigner */
+    rd_bytes(&rd, sz);
+    sz = rd_be16(&rd);                  /* extraData */
+    extra = rd_bytes(&rd, sz);
+    if (!extra || (sz != rec->nonce_sz) || memcmp(extra, rec->nonce, sz) != 0)
+        return "nonce mismatch";
+    rd_bytes(&rd, 8 + 4 + 4 + 1);       /* clockInfo */
+    rd_bytes(&rd, 8);                   /* firmwareVersion */
+
+    /* TPML_PCR_SELECTION must list the PCRs in the record, in order */
+    count = rd_be32(&rd);
+    for (b = 0; b < count; b++) {
+        uint16_t alg = rd_be16(&rd);
+        uint8_t sel_sz = rd_u8(&rd);
+        const uint8_t *sel = rd_bytes(&rd, sel_sz);
+        if (!sel)
+            return "truncated quote";
+        for (i = 0; i < sel_sz * 8; i++) {
+            if ((sel[i / 8] & (1 << (i % 8))) == 0)
+                continue;
+            if ((n >= rec->n_pcr) || (rec->pcr[n].alg != alg) ||
+                    (rec->pcr[n].index != i))
+                return "PCR selection mismatch";
+            n++;
+        }
+    }
+    if (n != rec->n_pcr)
+        return "PCR selection mismatch";
+
+    sz = rd_be16(&rd);
+    pcr_digest = rd_bytes(&rd, sz);
+    if (rd.err || (sz != WC_SHA256_DIGEST_SIZE))
+        return "truncated quote";
+
+    wc_InitSha256(&sha);
+    for (i = 0; i < rec->n_pcr; i++)
+        wc_Sha256Update(&sha, rec->pcr[i].digest, rec->pcr[i].size);
+    wc_Sha256Final(&sha, digest);
+    wc_Sha256Free(&sha);
+    if (memcmp(digest, pcr_digest, sizeof(digest)) != 0)
+        return "PCR digest mismatch";
+    return NULL;
+}
+
+static const struct expected_image *match_image(const struct record *rec)
+{
+    int i, j;
+    for (i = 0; i < rec->n_pcr; i++) {
+        if ((rec->pcr[i].alg != ATTEST_ALG_SHA256) ||
+                (rec->pcr[i].index != measured_pcr) ||
+                (rec->pcr[i].size != WC_SHA256_DIGEST_SIZE))
+            continue;
+        for (j = 0; j < n_images; j++) {
+            if (memcmp(rec->pcr[i].digest, images[j].pcr,
+                        WC_SHA256_DIGEST_SIZE) == 0)
+                return &images[j];
+        }
+    }
+    return NULL;
+}
+
+static void aik_fingerprint(const uint8_t *x, uint32_t x_sz,
+        const uint8_t *y, uint32_t y_sz, uint8_t *fp)
+{
+    wc_Sha256 sha;
+    wc_InitSha256(&sha);
+    wc_Sha256Update(&sha, x, x_sz);
+    wc_Sha256Update(&sha, y, y_sz);
+    wc_Sha256Final(&sha, fp);
+    wc_Sha256Free(&sha);
+}
+
+static const struct enrolled_aik *find_aik(const uint8_t *fp)
+{
+    int i;
+    for (i = 0; i < n_aiks; i++) {
+        if (memcmp(aiks[i].fp, fp, WC_SHA256_DIGEST_SIZE) == 0)
+            return &aiks[i];
+    }
+    return NULL;
+}
+
+/* The nonce must have been issued less than nonce_max_age seconds ago, and
+ * not be answered by another record. */
+static const char *check_nonce(const struct record *rec)
+{
+    time_t now = time(NULL);
+    int i;
+    if (rec->nonce_sz != NONCE_SZ)
+        return "nonce not issued by this verifier";
+    for (i = 0; i < n_nonces; i++) {
+        if (memcmp(nonces[i].nonce, rec->nonce, NONCE_SZ) != 0)
+            continue;
+        if (nonces[i].used)
+            return "nonce replayed";
+        if ((now < nonces[i].issued) ||
+                (now - nonces[i].issued > nonce_max_age))
+            return "stale nonce";
+        nonces[i].used = 1;
+        return NULL;
+    }
+    return "nonce not issued by this verifier";
+}
+
+static void print_hex(const uint8_t *buf, int len)
+{
+    int i;
+    for (i = 0; i < len; i++)
+        printf("%02x", buf[i]);
+}
+
+static int verify_record(const char *name, const uint8_t *buf, uint32_t len)
+{
+    struct record rec;
+    const struct expected_image *img;
+    const struct enrolled_aik *aik;
+    const char *err;
+    uint8_t fp[WC_SHA256_DIGEST_SIZE];
+    int i;
+
+    if (parse_record(buf, len, &rec) < 0) {
+        printf("%s: FAIL (malformed record)\n", name);
+        return -1;
+    }
+    if ((rec.x_sz != AIK_COORD_SZ) || (rec.y_sz != AIK_COORD_SZ)) {
+        printf("%s: FAIL (attestation key is not a P-256 point)\n", name);
+        return -1;
+    }
+    aik_fingerprint(rec.x, rec.x_sz, rec.y, rec.y_sz, fp);
+    aik = find_aik(fp);
+    if (!aik) {
+        printf("%s: FAIL (attestation key ", name);
+        print_hex(fp, sizeof(fp));
+        printf(" not enrolled)\n");
+        return -1;
+    }
+    if (verify_signature(&rec) < 0) {
+        printf("%s: FAIL (bad quote signature)\n", name);
+        return -1;
+    }
+    err = verify_attest(&rec);
+    if (!err)
+        err = check_nonce(&rec);
+    if (err) {
+        printf("%s: FAIL (%s)\n", name, err);
+        return -1;
+    }
+    img = match_image(&rec);
+    if (!img) {
+        printf("%s: FAIL (PCR%d does not match any known image)\n", name,
+                measured_pcr);
+        return -1;
+    }
+    /* The version in the record is not signed: it must be the one of the
+     * image that was measured */
+    if (rec.version != img->version) {
+        printf("%s: FAIL (version %u reported, image %s is version %u)\n",
+                name, rec.version, img->name, img->version);
+        return -1;
+    }
+
+    /* The boot times are not covered by the quote */
+    printf("%s: OK, device %s, version %u, image %s, "
+            "unauthenticated boot times (us):", name, aik->name, img->version,
+            img->name);
+    for (i = 0; (i < rec.n_ts) && (i < ATTEST_TS_COUNT); i++)
+        printf(" %u", rec.ts[i]);
+    printf("\n");
+    return 0;
+}
+
+static uint8_t *read_file(const char *name, uint32_t *len)
+{
+    FILE *f = fopen(name, "rb");
+    uint8_t *buf;
+    long sz;
+    if (!f)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    sz = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (sz <= 0) {
+        fclose(f);
+        return NULL;
+    }
+    buf = malloc(sz);
+    if (buf && (fread(buf, 1, sz, f) != (size_t)sz)) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    *len = (uint32_t)sz;
+    return buf;
+}
+
+static int parse_hex(const char *s, uint8_t *out, int max)
+{
+    int n = 0;
+    unsigned int v;
+    while (s[0] && s[1] && (n < max) && (sscanf(s, "%2x", &v) == 1)) {
+        out[n++] = (uint8_t)v;
+        s += 2;
+    }
+    return (*s == '\0') ? n : -1;
+}
+
+/* Enrolled attestation keys, one per line: the public key (x || y, 64
+ * bytes) or its SHA-256 fingerprint in hex, optionally followed by the
+ * name of the device. */
+static int load_aiks(const char *file)
+{
+    FILE *f = fopen(file, "r");
+    char line[256], key[160], name[sizeof(aiks[0].name)];
+    uint8_t bin[64];
+    int n, lineno = 0;
+
+    if (!f) {
+        perror(file);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        name[0] = '\0';
+        if ((line[0] == '#') || (sscanf(line, "%159s %31s", key, name) < 1))
+            continue;
+        if (n_aiks >= MAX_AIKS) {
+            fprintf(stderr, "%s: too many keys\n", file);
+            break;
+        }
+        n = parse_hex(key, bin, sizeof(bin));
+        if (n == sizeof(bin)) {
+            aik_fingerprint(bin, 32, bin + 32, 32, aiks[n_aiks].fp);
+        } else if (n == WC_SHA256_DIGEST_SIZE) {
+            memcpy(aiks[n_aiks].fp, bin, n);
+        } else {
+            fprintf(stderr, "%s:%d: not a key or a fingerprint\n", file, lineno);
+            fclose(f);
+            return -1;
+        }
+        strcpy(aiks[n_aiks].name, name[0] ? name : "-");
+        n_aiks++;
+    }
+    fclose(f);
+    return 0;
+}
+
+/* Issued nonces, one per line: the nonce in hex and the time it was sent */
+static int load_nonces(const char *file)
+{
+    FILE *f = fopen(file, "r");
+    char line[128], hex[2 * NONCE_SZ + 1];
+    long long issued;
+
+    if (!f)
+        return -1;
+    while (fgets(line, sizeof(line), f) && (n_nonces < MAX_NONCES)) {
+        if ((sscanf(line, "%32s %lld", hex, &issued) != 2) ||
+                (parse_hex(hex, nonces[n_nonces].nonce, NONCE_SZ) != NONCE_SZ))
+            continue;
+        nonces[n_nonces].issued = (time_t)issued;
+        nonces[n_nonces].used = 0;
+        n_nonces++;
+    }
+    fclose(f);
+    return 0;
+}
+
+static int add_nonce(const char *file, const uint8_t *nonce)
+{
+    FILE *f;
+    int i;
+    if (n_nonces >= MAX_NONCES)
+        return -1;
+    memcpy(nonces[n_nonces].nonce, nonce, NONCE_SZ);
+    nonces[n_nonces].issued = time(NULL);
+    nonces[n_nonces].used = 0;
+    if (file) {
+        f = fopen(file, "a");
+        if (!f) {
+            perror(file);
+            return -1;
+        }
+        for (i = 0; i < NONCE_SZ; i++)
+            fprintf(f, "%02x", nonce[i]);
+        fprintf(f, " %lld\n", (long long)nonces[n_nonces].issued);
+        fclose(f);
+    }
+    n_nonces++;
+    return 0;
+}
+
+/* Compute the expected measured boot PCR for a signed image: wolfBoot
+ * extends the PCR (reset to zeros) with the SHA-256 of the image stored in
+ * the manifest header. */
+static int add_image(const char *name)
+{
+    uint8_t *buf;
+    uint32_t len, off = 8;
+    const uint8_t *hash = NULL;
+    uint8_t zero[WC_SHA256_DIGEST_SIZE];
+    struct expected_image *img;
+    wc_Sha256 sha;
+
+    if (n_images >= MAX_IMAGES) {
+        fprintf(stderr, "Too many images\n");
+        return -1;
+    }
+    img = &images[n_images];
+    buf = read_file(name, &len);
+    if (!buf || (len < IMAGE_HEADER_SIZE) ||
+            ((buf[0] | (buf[1] << 8) | (buf[2] << 16) |
+              ((uint32_t)buf[3] << 24)) != WOLFBOOT_MAGIC)) {
+        fprintf(stderr, "%s: not a signed wolfBoot image\n", name);
+        free(buf);
+        return -1;
+    }
+    memset(img, 0, sizeof(*img));
+    img->name = name;
+    while (off + 4 <= IMAGE_HEADER_SIZE) {
+        uint16_t type = buf[off] | (buf[off + 1] << 8);
+        uint16_t tlen;
+        if (type == HDR_END)
+            break;
+        if ((buf[off] == HDR_PADDING) || (off & 1)) {
+            off++;
+            continue;
+        }
+        tlen = buf[off + 2] | (buf[off + 3] << 8);
+        if (off + 4 + tlen > IMAGE_HEADER_SIZE)
+            break;
+        if ((type == HDR_VERSION) && (tlen == 4))
+            memcpy(&img->version, buf + off + 4, 4);
+        if ((type == HDR_SHA256) && (tlen == WC_SHA256_DIGEST_SIZE))
+            hash = buf + off + 4;
+        off += 4 + tlen;
+    }
+    if (!hash) {
+        fprintf(stderr, "%s: no SHA256 digest in manifest\n", name);
+        free(buf);
+        return -1;
+    }
+    memset(zero, 0, sizeof(zero));
+    wc_InitSha256(&sha);
+    wc_Sha256Update(&sha, zero, sizeof(zero));
+    wc_Sha256Update(&sha, hash, WC_SHA256_DIGEST_SIZE);
+    wc_Sha256Final(&sha, img->pcr);
+    wc_Sha256Free(&sha);
+    free(buf);
+    n_images++;
+    return 0;
+}
+
+/* Request a record from a target connected to 'port', store it to 'out'.
+ * The nonce is added to the issued nonces, and to 'nonce_file' if set. */
+static int collect(const char *port, const char *out, const char *nonce_file)
+{
+    struct termios tty;
+    uint8_t req[3 + NONCE_SZ] = { 0xA5, ATTEST_REQUEST, NONCE_SZ };
+    uint8_t rec[ATTEST_RECORD_MAX];
+    uint8_t c;
+    uint16_t len = 0;
+    int fd, rfd, i, res;
+    FILE *f;
+
+    rfd = open("/dev/urandom", O_RDONLY);
+    if ((rfd < 0) || (read(rfd, req + 3, NONCE_SZ) != NONCE_SZ)) {
+        perror("reading nonce");
+        return -1;
+    }
+    close(rfd);
+    if (add_nonce(nonce_file, req + 3) < 0)
+        return -1;
+
+    fd = open(port, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        perror("opening serial port");
+        return -1;
+    }
+    tcgetattr(fd, &tty);
+    cfmakeraw(&tty);
+    cfsetospeed(&tty, B115200);
+    cfsetispeed(&tty, B115200);
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 50;
+    tcsetattr(fd, TCSANOW, &tty);
+    tcflush(fd, TCIOFLUSH);
+
+    write(fd, req, sizeof(req));
+    do {
+        res = read(fd, &c, 1);
+    } while ((res == 1) && (c != ATTEST_RESPONSE) && (c != '!'));
+    if ((res != 1) || (c != ATTEST_RESPONSE)) {
+        fprintf(stderr, "%s: no attestation record received\n", port);
+        close(fd);
+        return -1;
+    }
+    for (i = 0; i < 2; i++) {
+        if (read(fd, &c, 1) != 1) {
+            close(fd);
+            return -1;
+        }
+        len |= c << (8 * i);
+    }
+    if (len > sizeof(rec)) {
+        close(fd);
+        return -1;
+    }
+    for (i = 0; i < len; i += res) {
+        res = read(fd, rec + i, len - i);
+        if (res <= 0) {
+            fprintf(stderr, "%s: record truncated\n", port);
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+
+    /* The record must carry the nonce we just generated */
+    if ((len < ATTEST_MAGIC_SZ + 5) ||
+            (memmem(rec, len, req + 3, NONCE_SZ) == NULL)) {
+        fprintf(stderr, "%s: stale or invalid record\n", port);
+        return -1;
+    }
+    f = fopen(out, "wb");
+    if (!f || (fwrite(rec, 1, len, f) != len)) {
+        perror("writing record");
+        if (f)
+            fclose(f);
+        return -1;
+    }
+    fclose(f);
+    printf("Record saved to %s (%u bytes)\n", out, len);
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [-p pcr] -k keys -f signed_image [-f ...] [-n nonces [-t age]]\n"
+           "       [-d device -o record] [record ...]\n", name);
+    printf("  -p pcr     measured boot PCR index (default: 16)\n");
+    printf("  -k keys    attestation keys of the enrolled devices\n");
+    printf("  -f image   signed firmware image that the devices may run\n");
+    printf("  -n nonces  nonces issued with -d are appended to this file, and the\n");
+    printf("             records given on the command line must answer one of them\n");
+    printf("  -t age     maximum age of a nonce in seconds (default: %d)\n", NONCE_MAX_AGE);
+    printf("  -d device  request a fresh record from a target on this serial port\n");
+    printf("             (default: %s), and store it to the file given with -o\n", PORT);
+}
+
+int main(int argc, char **argv)
+{
+    const char *port = NULL;
+    const char *out = NULL;
+    const char *nonce_file = NULL;
+    uint8_t *buf;
+    uint32_t len;
+    int opt, i, fails = 0, total = 0;
+
+    while ((opt = getopt(argc, argv, "p:k:f:n:t:d:o:")) != -1) {
+        switch (opt) {
+            case 'p':
+                measured_pcr = atoi(optarg);
+                break;
+            case 'k':
+                if (load_aiks(optarg) < 0)
+                    exit(2);
+                break;
+            case 'n':
+                nonce_file = optarg;
+                break;
+            case 't':
+                nonce_max_age = atol(optarg);
+                break;
+            case 'f':
+                if (add_image(optarg) < 0)
+                    exit(2);
+                break;
+            case 'd':
+                port = optarg;
+                break;
+            case 'o':
+                out = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+    if ((n_images == 0) || (n_aiks == 0) || (port && !out) ||
+            (!port && optind >= argc) || ((optind < argc) && !nonce_file)) {
+        usage(argv[0]);
+        exit(1);
+    }
+    if (nonce_file && (load_nonces(nonce_file) < 0) && !port) {
+        perror(nonce_file);
+        exit(2);
+    }
+
+    if (port) {
+        if (collect(port, out, nonce_file) < 0)
+            exit(2);
+        buf = read_file(out, &len);
+        total++;
+        if (!buf || verify_record(out, buf, len) < 0)
+            fails++;
+        free(buf);
+    }
+
+    for (i = optind; i < argc; i++) {
+        total++;
+        buf = read_file(argv[i], &len);
+        if (!buf) {
+            printf("%s: FAIL (cannot read)\n", argv[i]);
+            fails++;
+            continue;
+        }
+        if (verify_record(argv[i], buf, len) < 0)
+            fails++;
+        free(buf);
+    }
+    printf("%d/%d records verified\n", total - fails, total);
+    return fails ? 1 : 0;
+}
@@ -0,0 +1,439 @@
+/* flash_pipe_sim.c
+ *
+ * Host test of the update partition writer (src/flash_pipe.c) against a
+ * simulated STM32F4 flash controller.
+ *
+ * The controller runs from a periodic signal, which preempts the code
+ * under test like the hardware does: it starts a sector erase when STRT is
+ * set, programs the word written by the pipeline, and raises the flash
+ * interrupt (isr_flash()) at the end of each operation, if unmasked. It
+ * checks the ordering rules of the hardware and of the pipeline:
+ *
+ *  - one operation at a time: no write or STRT while BSY is set
+ *  - PG / SER and PSIZE set for the operation in progress
+ *  - words are only programmed into erased flash, within the partition
+ *  - sectors outside the partition are never erased, and each sector of
+ *    the partition is erased once
+ *  - TIM2, whose vector is fetched from flash, is masked during erases
+ *
+ * Several images are then written through flash_pipe_page() /
+ * flash_pipe_commit() / flash_pipe_flush() with random delays between
+ * the pages, and read back.
+ *
+ * Copyright (C) 2021 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "flash_pipe.h"
+
+/* Same values as in flash_pipe.c */
+#define SR_BSY              (1 << 16)
+#define SR_PGSERR           (1 << 7)
+#define SR_PGPERR           (1 << 6)
+#define SR_PGAERR           (1 << 5)
+#define SR_WRPERR           (1 << 4)
+#define SR_EOP              (1 << 0)
+#define SR_ERRORS           (SR_PGSERR | SR_PGPERR | SR_PGAERR | SR_WRPERR | \
+                             (1 << 1))
+#define SR_MARK             (1UL << 31)
+
+#define CR_ERRIE            (1 << 25)
+#define CR_EOPIE            (1 << 24)
+#define CR_STRT             (1 << 16)
+#define CR_PSIZE_MASK       (3 << 8)
+#define CR_PSIZE_X32        (2 << 8)
+#define CR_SNB_SHIFT        3
+#define CR_SNB_MASK         (0x1F << CR_SNB_SHIFT)
+#define CR_SER              (1 << 1)
+#define CR_PG               (1 << 0)
+#define CR_VALID            (CR_ERRIE | CR_EOPIE | CR_STRT | CR_PSIZE_MASK | \
+                             CR_SNB_MASK | CR_SER | CR_PG)
+
+#define FLASH_IRQN          4
+#define TIM2_IRQN           28
+
+#define FLASH_START         0x08000000
+#define FLASH_SIZE          (1024 * 1024)
+#define N_SECTORS           12
+
+/* Timer period, and simulated duration of the operations in ticks */
+#define TICK_US             20
+#define ERASE_TICKS_MIN     2
+#define ERASE_TICKS_MAX     40
+#define MAX_OPS_PER_TICK    8
+#define MAX_TICKS           (5 * 1000 * 1000)
+
+volatile uint32_t sim_flash_sr = SR_MARK;
+volatile uint32_t sim_flash_cr;
+
+static uint8_t flash[FLASH_SIZE];
+static uint8_t flash_before[FLASH_SIZE];
+static uint32_t sector_erases[N_SECTORS];
+
+enum sim_op {
+    OP_NONE = 0,
+    OP_ERASE,
+    OP_PROGRAM
+};
+
+static uint32_t hw_sr;
+static volatile uint32_t irq_enabled;
+static int irq_pending;
+static volatile enum sim_op op;
+static uint32_t op_ticks;
+static uint32_t op_sector;
+static uint32_t op_offset;
+static uint32_t op_val;
+static uint32_t part_start, part_end;   /* Flash offsets */
+static volatile unsigned long ticks;
+static unsigned long violations;
+
+/* The controller runs in the signal handler: no stdio nor rand() there */
+static uint32_t sim_rand(void)
+{
+    static uint32_t x = 2463534242UL;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+static void violation(const char *what, uint32_t offset)
+{
+    char msg[96];
+    int n;
+    violations++;
+    if (violations <= 10) {
+        n = snprintf(msg, sizeof(msg), "violation: %s (offset 0x%05x)\n",
+                what, offset);
+        write(STDERR_FILENO, msg, n);
+    }
+}
+
+/* Independent from flash_sector() in flash_pipe.c */
+static const uint32_t sector_start[N_SECTORS + 1] = {
+    0x00000, 0x04000, 0x08000, 0x0C000, 0x10000, 0x20000, 0x40000,
+    0x60000, 0x80000, 0xA0000, 0xC0000, 0xE0000, 0x100000
+};
+
+static int sector_of(uint32_t offset)
+{
+    int i;
+    for (i = 0; i < N_SECTORS; i++) {
+        if (offset < sector_start[i + 1])
+            return i;
+    }
+    return -1;
+}
+
+/* The pipeline may use the flash region or its alias at 0 */
+static uint32_t flash_offset(uint32_t address)
+{
+    if (address >= FLASH_START)
+        return address - FLASH_START;
+    return address;
+}
+
+static void sigalrm_block(sigset_t *old)
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGALRM);
+    sigprocmask(SIG_BLOCK, &set, old);
+}
+
+static void sigalrm_restore(sigset_t *old)
+{
+    sigprocmask(SIG_SETMASK, old, NULL);
+}
+
+/* Apply the pending write 1 to clear, and publish the status */
+static void sr_sync(void)
+{
+    uint32_t v = sim_flash_sr;
+    if ((v & SR_MARK) == 0)
+        hw_sr &= ~(v & (SR_EOP | SR_ERRORS));
+    sim_flash_sr = hw_sr | SR_MARK;
+}
+
+static void op_error(uint32_t flag, const char *what, uint32_t offset)
+{
+    violation(what, offset);
+    hw_sr |= flag;
+    if (sim_flash_cr & CR_ERRIE)
+        irq_pending = 1;
+}
+
+void sim_irq_on(int n)
+{
+    irq_enabled |= (1UL << n);
+}
+
+void sim_irq_off(int n)
+{
+    irq_enabled &= ~(1UL << n);
+}
+
+void sim_program_word(uint32_t address, uint32_t val)
+{
+    uint32_t offset = flash_offset(address);
+    uint32_t cr = sim_flash_cr;
+    uint32_t old;
+    sigset_t mask;
+
+    sigalrm_block(&mask);
+    sr_sync();
+    if (hw_sr & SR_BSY) {
+        op_error(SR_PGSERR, "word written while busy", offset);
+    } else if (cr & ~CR_VALID) {
+        op_error(SR_PGSERR, "reserved bits set in FLASH_CR", offset);
+    } else if ((cr & (CR_PG | CR_SER)) != CR_PG) {
+        op_error(SR_PGSERR, "word written without PG", offset);
+    } else if ((cr & CR_PSIZE_MASK) != CR_PSIZE_X32) {
+        op_error(SR_PGPERR, "word written with the wrong PSIZE", offset);
+    } else if ((offset & 3) || (offset + 4 > FLASH_SIZE)) {
+        op_error(SR_PGAERR, "unaligned word", offset);
+    } else {
+        if ((offset < part_start) || (offset + 4 > part_end))
+            violation("word programmed outside the partition", offset);
+        memcpy(&old, flash + offset, sizeof(old));
+        if (old != 0xFFFFFFFF)
+            violation("word programmed into flash not erased", offset);
+        op = OP_PROGRAM;
+        op_ticks = 0;
+        op_offset = offset;
+        op_val = val;
+        hw_sr |= SR_BSY;
+    }
+    sr_sync();
+    sigalrm_restore(&mask);
+}
+
+static void op_start_erase(void)
+{
+    uint32_t cr = sim_flash_cr;
+    uint32_t sector = (cr & CR_SNB_MASK) >> CR_SNB_SHIFT;
+
+    if (cr & ~CR_VALID) {
+        op_error(SR_PGSERR, "reserved bits set in FLASH_CR", 0);
+        return;
+    }
+    if ((cr & (CR_PG | CR_SER)) != CR_SER) {
+        op_error(SR_PGSERR, "STRT without SER", 0);
+        return;
+    }
+    if ((cr & CR_PSIZE_MASK) != CR_PSIZE_X32) {
+        op_error(SR_PGPERR, "erase with the wrong PSIZE", 0);
+        return;
+    }
+    if (sector >= N_SECTORS) {
+        op_error(SR_WRPERR, "erase of an invalid sector", 0);
+        return;
+    }
+    if ((sector_start[sector] < part_start) ||
+            (sector_start[sector] >= part_end))
+        violation("sector erased outside the partition", sector_start[sector]);
+    if (sector_erases[sector]++ > 0)
+        violation("sector erased twice", sector_start[sector]);
+    if (irq_enabled & (1UL << TIM2_IRQN))
+        violation("erase started with TIM2 unmasked", sector_start[sector]);
+    op = OP_ERASE;
+    op_sector = sector;
+    op_ticks = ERASE_TICKS_MIN + sim_rand() % (ERASE_TICKS_MAX - ERASE_TICKS_MIN);
+    hw_sr |= SR_BSY;
+}
+
+static void op_complete(void)
+{
+    uint32_t old;
+    if (op == OP_ERASE) {
+        memset(flash + sector_start[op_sector], 0xFF,
+                sector_start[op_sector + 1] - sector_start[op_sector]);
+    } else {
+        /* Programming can only clear bits */
+        memcpy(&old, flash + op_offset, sizeof(old));
+        old &= op_val;
+        memcpy(flash + op_offset, &old, sizeof(old));
+    }
+    op = OP_NONE;
+    sim_flash_cr &= ~CR_STRT;
+    hw_sr &= ~SR_BSY;
+    if (sim_flash_cr & CR_EOPIE) {
+        hw_sr |= SR_EOP;
+        irq_pending = 1;
+    }
+}
+
+/* One tick of the controller, and the flash interrupt if pending */
+static void sim_tick(int signo)
+{
+    int n;
+    (void)signo;
+
+    if (++ticks > MAX_TICKS) {
+        static const char msg[] = "timeout: pipeline stalled\n";
+        write(STDERR_FILENO, msg, sizeof(msg) - 1);
+        _exit(1);
+    }
+    n = 1 + sim_rand() % MAX_OPS_PER_TICK;
+    while (n-- > 0) {
+        sr_sync();
+        if ((op == OP_ERASE) && (irq_enabled & (1UL << TIM2_IRQN)))
+            violation("TIM2 unmasked during an erase", sector_start[op_sector]);
+        if (op != OP_NONE) {
+            if (op_ticks > 0) {
+                op_ticks--;
+                break;
+            }
+            op_complete();
+        } else if (sim_flash_cr & CR_STRT) {
+            op_start_erase();
+        }
+        sr_sync();
+        if (irq_pending && (irq_enabled & (1UL << FLASH_IRQN))) {
+            irq_pending = 0;
+            isr_flash();
+            sr_sync();
+        }
+        if ((op == OP_NONE) && !(sim_flash_cr & CR_STRT))
+            break;
+    }
+}
+
+static void delay(void)
+{
+    volatile int i;
+    int n = rand() % 2000;
+    /* Now and then, long enough for the queue to drain */
+    if ((rand() % 16) == 0)
+        n = 400000;
+    for (i = 0; i < n; i++)
+        ;
+}
+
+static int run(uint32_t address, uint32_t len)
+{
+    static uint8_t image[FLASH_SIZE];
+    uint32_t start = flash_offset(address);
+    uint32_t end, off, sz, pages = 0, erased = 0;
+    unsigned long t0 = ticks;
+    uint8_t *page;
+    int i, ret, fail = 0;
+
+    /* The pipeline erases whole sectors, up to the end of the image */
+    for (i = sector_of(start); sector_start[i] < start + len; i++)
+        ;
+    end = sector_start[i];
+
+    for (off = 0; off < FLASH_SIZE; off++)
+        flash[off] = rand();
+    memcpy(flash_before, flash, FLASH_SIZE);
+    for (off = 0; off < len; off++)
+        image[off] = rand();
+    memset(sector_erases, 0, sizeof(sector_erases));
+    violations = 0;
+    part_start = start;
+    part_end = end;
+    /* TIM2 runs in the application */
+    sim_irq_on(TIM2_IRQN);
+
+    flash_pipe_init(address, len);
+    for (off = 0; off < len; off += FLASH_PIPE_PAGESIZE) {
+        sz = len - off;
+        if (sz > FLASH_PIPE_PAGESIZE)
+            sz = FLASH_PIPE_PAGESIZE;
+        page = flash_pipe_page();
+        memcpy(page, image + off, sz);
+        flash_pipe_commit(address + off);
+        pages++;
+        delay();
+    }
+    ret = flash_pipe_flush();
+    /* The last erase-ahead may still be in progress */
+    while ((op != OP_NONE) || (sim_flash_cr & CR_STRT))
+        ;
+
+    if (ret != 0) {
+        fprintf(stderr, "flash_pipe_flush() returned %d\n", ret);
+        fail = 1;
+    }
+    if (memcmp(flash + start, image, len) != 0) {
+        fprintf(stderr, "image mismatch\n");
+        fail = 1;
+    }
+    for (off = start + len; off < end; off++) {
+        if (flash[off] != 0xFF) {
+            fprintf(stderr, "not erased after the image at 0x%05x\n", off);
+            fail = 1;
+            break;
+        }
+    }
+    if ((memcmp(flash, flash_before, start) != 0) ||
+            (memcmp(flash + end, flash_before + end, FLASH_SIZE - end) != 0)) {
+        fprintf(stderr, "flash modified outside the partition\n");
+        fail = 1;
+    }
+    for (i = sector_of(start); i < N_SECTORS && sector_start[i] < end; i++) {
+        if (sector_erases[i] != 1) {
+            fprintf(stderr, "sector %d erased %u times\n", i, sector_erases[i]);
+            fail = 1;
+        }
+        erased++;
+    }
+    if (irq_enabled & (1UL << FLASH_IRQN)) {
+        fprintf(stderr, "flash interrupt still enabled\n");
+        fail = 1;
+    }
+    if (violations)
+        fail = 1;
+    printf("0x%08x %7u bytes: %4u pages, %u sectors, %8lu ticks: %s\n",
+            address, len, pages, erased, ticks - t0, fail ? "FAIL" : "OK");
+    return fail;
+}
+
+int main(int argc, char *argv[])
+{
+    struct itimerval it;
+    unsigned int seed = (argc > 1) ? strtoul(argv[1], NULL, 0) : getpid();
+    int fail = 0;
+
+    printf("Seed %u\n", seed);
+    srand(seed);
+    signal(SIGALRM, sim_tick);
+    it.it_interval.tv_sec = 0;
+    it.it_interval.tv_usec = TICK_US;
+    it.it_value = it.it_interval;
+    setitimer(ITIMER_REAL, &it, NULL);
+
+    /* Update partition of measured.wolfboot.config, at the flash alias */
+    fail |= run(0x00040000, 0x20000 - 8);
+    /* Across the 16K, 64K and 128K sectors, at the alias and in place */
+    fail |= run(0x00008000, 90000);
+    fail |= run(0x08008000, 90000);
+    /* Exactly one sector */
+    fail |= run(0x08004000, 0x4000);
+    /* Less than a page */
+    fail |= run(0x08060000, 100);
+
+    return fail;
+}
@@ -0,0 +1,58 @@
+/* flash_sim.h
+ *
+ * Host replacements for the hardware accessed by src/flash_pipe.c, which
+ * is built with this header pre-included (see Makefile).
+ *
+ * Copyright (C) 2021 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+#ifndef FLASH_SIM_H_INCLUDED
+#define FLASH_SIM_H_INCLUDED
+
+#include <stdint.h>
+
+/* Replaces src/system.h */
+#define SYSTEM_H_INCLUDED
+#define DMB() __sync_synchronize()
+#define NVIC_TIM2_IRQN          (28)
+static inline void nvic_irq_setprio(uint8_t n, uint8_t prio)
+{
+    (void)n;
+    (void)prio;
+}
+
+/* Everything runs from RAM on the host */
+#define RAMCODE
+
+/* FLASH_SR is write 1 to clear: the simulator tells writes apart from the
+ * value it published by a marker bit, which the pipeline never writes. */
+extern volatile uint32_t sim_flash_sr;
+extern volatile uint32_t sim_flash_cr;
+#define FLASH_SR sim_flash_sr
+#define FLASH_CR sim_flash_cr
+
+void sim_program_word(uint32_t address, uint32_t val);
+#define FLASH_PROGRAM_WORD(address, val) sim_program_word((address), (val))
+
+void sim_irq_on(int n);
+void sim_irq_off(int n);
+#define IRQ_ON(n) sim_irq_on(n)
+#define IRQ_OFF(n) sim_irq_off(n)
+
+#endif /* !FLASH_SIM_H_INCLUDED */
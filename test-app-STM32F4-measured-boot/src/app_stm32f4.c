@@ -31,11 +31,10 @@
 #include "wolfboot/wolfboot.h"
 #include "spi_flash.h"
 #include "spi_drv.h"
-#include "spi_tpm.h"
+#include "flash_pipe.h"
+#include "attest_record.h"
 
-#include "wolftpm/tpm2.h"
-#include "wolftpm/tpm2_wrap.h"
-static WOLFTPM2_DEV wolftpm_dev;
+#include "tpm_ctx.h"
 
 #define UART1 (0x40011000)
 #define UART2 (0x40014400)
@@ -57,7 +56,14 @@ static WOLFTPM2_DEV wolftpm_dev;
 #define UART_CR1_RX_ENABLE      (1 << 2)
 #define UART_CR2_STOPBITS       (3 << 12)
 #define UART_SR_TX_EMPTY        (1 << 7)
+#define UART_SR_TX_COMPLETE     (1 << 6)
 #define UART_SR_RX_NOTEMPTY     (1 << 5)
+#define UART_SR_NOISE_ERR       (1 << 2)
+#define UART_SR_FRAMING_ERR     (1 << 1)
+
+#ifndef UART_BAUD_DEFAULT
+#define UART_BAUD_DEFAULT 115200
+#endif
 
 
 #define CLOCK_SPEED (168000000)
@@ -90,12 +96,19 @@ static WOLFTPM2_DEV wolftpm_dev;
 #define UART2_TX_PIN 2 /* PA2 */
 
 #define MSGSIZE 16
-#define PAGESIZE (256)
-static uint8_t page[PAGESIZE];
-static const char ERR='!';
+
+/* Baud rate negotiation, see fw-update-server/server.c */
+#define BAUD_PROPOSE 0x5B
+#define BAUD_CONFIRM 0x5C
+#define BAUD_TIMEOUT_TICKS 10 /* 500 ms, timer ticks every 50 ms */
+#define PAGESIZE FLASH_PIPE_PAGESIZE
+/* ERR and ACK are used by the update loop while the flash is busy, so they
+ * must not be stored in flash */
+static char ERR='!';
 static const char START='*';
 static const char UPDATE='U';
-static const char ACK='#';
+static char ACK='#';
+static const char BAUD_ACK='$';
 static uint8_t msg[MSGSIZE];
 static const char startString[]="App started";
 static const char TPMfailString[]="tpm_init failed";
@@ -103,8 +116,12 @@ static const char TPMpcrString[]="Measured Boot PCR is = ";
 static const char HEX [16] = {'0','1','2','3','4','5','6','7','8','9','A','B','C','D','E','F'};
 
 volatile uint32_t time_elapsed = 0; /* Used for PWM on LED */
+static uint32_t boot_ts[ATTEST_TS_COUNT]; /* Boot-phase timestamps (us) */
+#define BOOT_TS(phase) (boot_ts[(phase)] = CYCLES_TO_US(cycle_counter()))
+static uint32_t uart_bitrate = UART_BAUD_DEFAULT;
+static uint32_t uart_line_errors = 0;
 
-void uart_write(const char c)
+RAMCODE void uart_write(const char c)
 {
     uint32_t reg;
     do {
@@ -119,6 +136,24 @@ void uart_write_hex(const char c)
     uart_write(HEX[c & 0x0F]);
 }
 
+void uart_print(const char *s)
+{
+    while (*s)
+        uart_write(*s++);
+}
+
+void uart_write_dec(uint32_t val)
+{
+    char buf[10];
+    int i = 0;
+    do {
+        buf[i++] = '0' + (val % 10);
+        val /= 10;
+    } while (val > 0);
+    while (i > 0)
+        uart_write(buf[--i]);
+}
+
 static void uart_pins_setup(void)
 {
     uint32_t reg;
@@ -170,6 +205,7 @@ int uart_setup(uint32_t bitrate, uint8_t data, char parity, uint8_t stop)
 
     /* Configure clock */
     UART_BRR =  CLOCK_SPEED / bitrate;
+    uart_bitrate = bitrate;
 
     /* Configure data bits */
     if (data == 8)
@@ -201,18 +237,63 @@ int uart_setup(uint32_t bitrate, uint8_t data, char parity, uint8_t stop)
     return 0;
 }
 
-char uart_read(void)
+/* Returns 1 if the baud rate divider for 'bitrate' is within 2% */
+static int uart_bitrate_supported(uint32_t bitrate)
+{
+    uint32_t div, actual, diff;
+    if (bitrate == 0)
+        return 0;
+    div = CLOCK_SPEED / bitrate;
+    if (div < 16 || div > 0xFFFF)
+        return 0;
+    actual = CLOCK_SPEED / div;
+    diff = (actual > bitrate) ? (actual - bitrate) : (bitrate - actual);
+    return (diff * 50) <= bitrate;
+}
+
+static void uart_set_bitrate(uint32_t bitrate)
+{
+    /* Wait for the last frame to leave the shift register */
+    while ((UART_SR & UART_SR_TX_COMPLETE) == 0)
+        ;
+    UART_CR1 &= ~UART_CR1_UART_ENABLE;
+    UART_BRR = CLOCK_SPEED / bitrate;
+    uart_bitrate = bitrate;
+    UART_CR1 |= UART_CR1_UART_ENABLE;
+}
+
+RAMCODE char uart_read(void)
 {
     char c;
     volatile uint32_t reg;
     do {
         reg = UART_SR;
     } while ((reg & UART_SR_RX_NOTEMPTY) == 0);
+    /* Error flags are cleared by the SR read followed by the DR read */
+    if (reg & (UART_SR_FRAMING_ERR | UART_SR_NOISE_ERR))
+        uart_line_errors++;
     c = (char)(UART_DR & 0xff);
     return c;
 }
 
-static void ack(uint32_t _off)
+static int uart_read_timeout(uint8_t *c, uint32_t ticks)
+{
+    volatile uint32_t reg;
+    uint32_t start = time_elapsed;
+    do {
+        reg = UART_SR;
+        if ((time_elapsed - start) > ticks)
+            return -1;
+    } while ((reg & UART_SR_RX_NOTEMPTY) == 0);
+    *c = (uint8_t)(UART_DR & 0xff);
+    if (reg & (UART_SR_FRAMING_ERR | UART_SR_NOISE_ERR)) {
+        uart_line_errors++;
+        return -1;
+    }
+    return 0;
+}
+
+static RAMCODE void ack(uint32_t _off)
 {
     uint8_t *off = (uint8_t *)(&_off);
     int i;
@@ -222,7 +303,51 @@ static void ack(uint32_t _off)
     }
 }
 
-static int check(uint8_t *pkt, int size)
+static void baud_ack(uint32_t rate)
+{
+    uint8_t *r = (uint8_t *)(&rate);
+    int i;
+    uart_write(BAUD_ACK);
+    for (i = 0; i < 4; i++) {
+        uart_write(r[i]);
+    }
+}
+
+/* Handle a [A5 5B rate32] proposal from the host. After acknowledging, the
+ * host must send [A5 5C rate32] at the new speed within BAUD_TIMEOUT_TICKS,
+ * otherwise we fall back to the rate the proposal was received at, as the
+ * host does.
+ */
+static void baud_negotiate(void)
+{
+    uint32_t prev = uart_bitrate;
+    uint32_t rate = 0;
+    uint8_t *r = (uint8_t *)&rate;
+    uint8_t confirm[2 + sizeof(uint32_t)];
+    int i;
+    for (i = 0; i < 4; i++)
+        r[i] = uart_read();
+    if (!uart_bitrate_supported(rate)) {
+        uart_write(ERR);
+        return;
+    }
+    baud_ack(rate);
+    uart_set_bitrate(rate);
+    for (i = 0; i < sizeof(confirm); i++) {
+        if (uart_read_timeout(&confirm[i], BAUD_TIMEOUT_TICKS) < 0)
+            break;
+    }
+    if ((i == sizeof(confirm)) && (confirm[0] == 0xA5) &&
+            (confirm[1] == BAUD_CONFIRM) &&
+            (memcmp(confirm + 2, &rate, sizeof(uint32_t)) == 0)) {
+        uart_line_errors = 0;
+        baud_ack(rate);
+        return;
+    }
+    uart_set_bitrate(prev);
+}
+
+static RAMCODE int check(uint8_t *pkt, int size)
 {
     int i;
     uint16_t c = 0;
@@ -235,90 +360,328 @@ static int check(uint8_t *pkt, int size)
     return -1;
 }
 
-static int app_tpm2_IoCb(TPM2_CTX* ctx, const byte* txBuf, byte* rxBuf,
-    word16 xferSz, void* userCtx)
+/* Reads out the TPM measurement created by wolfBoot */
+static int read_measured_boot(uint8_t* digest)
 {
-    (void)userCtx;
-    (void)ctx;
-    word16 i;
+    int rc;
+    PCR_Read_In pcrReadCmd;
+    PCR_Read_Out pcrReadResp;
+
+    XMEMSET(&pcrReadCmd, 0, sizeof(pcrReadCmd));
+    TPM2_SetupPCRSel(&pcrReadCmd.pcrSelectionIn, TPM_ALG_SHA256, WOLFBOOT_MEASURED_PCR_A);
+    tpm_timing_start();
+    rc = TPM2_PCR_Read(&pcrReadCmd, &pcrReadResp);
+    tpm_timing_end("TPM2_PCR_Read");
+    if (rc == TPM_RC_SUCCESS) {
+        XMEMCPY(digest, pcrReadResp.pcrValues.digests[0].buffer,
+                pcrReadResp.pcrValues.digests[0].size);
+        rc = 0;
+    }
+
+    return rc;
+}
+
+#ifdef MEASURED_BOOT_ATTEST
+/* PCRs included in the attestation quote, per bank. A single
+ * TPM2_PCR_Read returns at most 8 digests. */
+#ifndef ATTEST_PCRS_SHA256
+#define ATTEST_PCRS_SHA256 (1UL << WOLFBOOT_MEASURED_PCR_A)
+#endif
+#ifndef ATTEST_PCRS_SHA1
+#define ATTEST_PCRS_SHA1 (0)
+#endif
 
-    spi_cs_on(SPI_CS_TPM);
+static PCR_Read_In attest_pcr_in;
+static PCR_Read_Out attest_pcr_out;
+static Quote_In attest_quote_in;
+static Quote_Out attest_quote_out;
+static uint8_t attest_rec[ATTEST_RECORD_MAX];
+static uint32_t attest_rec_sz;
 
-    XMEMSET(rxBuf, 0, xferSz);
-    for (i = 0; i < xferSz; i++)
-    {
-        spi_write(txBuf[i]);
-        rxBuf[i] = spi_read();
+static void rec_put(const void *data, uint32_t len)
+{
+    if (attest_rec_sz + len > ATTEST_RECORD_MAX) {
+        /* Mark as overflowed, checked by attest_quote() */
+        attest_rec_sz = ATTEST_RECORD_MAX + 1;
+        return;
     }
-    spi_cs_off(SPI_CS_TPM);
+    XMEMCPY(attest_rec + attest_rec_sz, data, len);
+    attest_rec_sz += len;
+}
 
-    /*
-    printf("\r\nSPI TX: ");
-    printbin(txBuf, xferSz);
-    printf("SPI RX: ");
-    printbin(rxBuf, xferSz);
-    printf("\r\n");
-    */
+static void rec_put_u8(uint8_t v)
+{
+    rec_put(&v, 1);
+}
 
-    return 0;
+static void rec_put_u16(uint16_t v)
+{
+    rec_put(&v, sizeof(v));
 }
 
-static int app_tpm2_init(void)
+static void rec_put_u32(uint32_t v)
 {
-    int rc;
-    WOLFTPM2_CAPS caps;
+    rec_put(&v, sizeof(v));
+}
+
+static void attest_select_pcrs(TPML_PCR_SELECTION *sel)
+{
+    int i;
+    for (i = 0; i < 32; i++) {
+        if (ATTEST_PCRS_SHA256 & (1UL << i))
+            TPM2_SetupPCRSel(sel, TPM_ALG_SHA256, i);
+        if (ATTEST_PCRS_SHA1 & (1UL << i))
+            TPM2_SetupPCRSel(sel, TPM_ALG_SHA1, i);
+    }
+}
 
-    spi_init(0,0);
+/* Read all the selected PCR banks with a single TPM2_PCR_Read, sign them
+ * with TPM2_Quote over 'nonce', and build the record into attest_rec.
+ */
+static int attest_quote(const uint8_t *nonce, uint8_t nonce_sz,
+        uint32_t version)
+{
+    int rc;
+    uint32_t b, i, d = 0;
+    TPML_PCR_SELECTION *sel = &attest_pcr_out.pcrSelectionOut;
+    TPMS_SIGNATURE_ECC *sig;
+    TPMS_ECC_POINT *pub;
+    WOLFTPM2_KEY *aik;
+
+    /* Cached by tpm_ctx after the first request */
+    rc = tpm_ctx_get_aik(&aik);
+    if (rc != 0)
+        return rc;
 
-    /* Init the TPM2 device */
-    rc = wolfTPM2_Init(&wolftpm_dev, app_tpm2_IoCb, NULL);
-    if (rc != 0)  {
+    XMEMSET(&attest_pcr_in, 0, sizeof(attest_pcr_in));
+    attest_select_pcrs(&attest_pcr_in.pcrSelectionIn);
+    tpm_timing_start();
+    rc = TPM2_PCR_Read(&attest_pcr_in, &attest_pcr_out);
+    tpm_timing_end("TPM2_PCR_Read");
+    if (rc != TPM_RC_SUCCESS)
         return rc;
-    }
 
-    /* Get device capabilities + options */
-    rc = wolfTPM2_GetCapabilities(&wolftpm_dev, &caps);
-    if (rc != 0)  {
+    /* Quote exactly what the TPM returned, so the PCR digest in the quote
+     * matches the values in the record. The encrypted session is only
+     * attached to the quote: the PCR_Read response does not start with a
+     * TPM2B, so it cannot be parameter-encrypted. */
+    rc = tpm_ctx_session();
+    if (rc != 0)
         return rc;
+    wolfTPM2_SetAuthHandle(tpm_ctx_dev(), 0, &aik->handle);
+    XMEMSET(&attest_quote_in, 0, sizeof(attest_quote_in));
+    attest_quote_in.signHandle = aik->handle.hndl;
+    attest_quote_in.inScheme.scheme = TPM_ALG_ECDSA;
+    attest_quote_in.inScheme.details.any.hashAlg = TPM_ALG_SHA256;
+    attest_quote_in.qualifyingData.size = nonce_sz;
+    XMEMCPY(attest_quote_in.qualifyingData.buffer, nonce, nonce_sz);
+    XMEMCPY(&attest_quote_in.PCRselect, sel, sizeof(*sel));
+    tpm_timing_start();
+    rc = TPM2_Quote(&attest_quote_in, &attest_quote_out);
+    tpm_timing_end("TPM2_Quote");
+    wolfTPM2_UnsetAuth(tpm_ctx_dev(), 0);
+    tpm_ctx_session_detach();
+    if (rc != TPM_RC_SUCCESS)
+        return rc;
+    BOOT_TS(ATTEST_TS_QUOTE);
+
+    attest_rec_sz = 0;
+    rec_put(ATTEST_MAGIC, ATTEST_MAGIC_SZ);
+    rec_put_u32(version);
+    rec_put_u8(ATTEST_TS_COUNT);
+    for (i = 0; i < ATTEST_TS_COUNT; i++)
+        rec_put_u32(boot_ts[i]);
+    rec_put_u8(nonce_sz);
+    rec_put(nonce, nonce_sz);
+
+    /* Digests are returned bank by bank, in increasing PCR order */
+    rec_put_u8(attest_pcr_out.pcrValues.count);
+    for (b = 0; b < sel->count; b++) {
+        TPMS_PCR_SELECTION *s = &sel->pcrSelections[b];
+        for (i = 0; i < s->sizeofSelect * 8; i++) {
+            if ((s->pcrSelect[i / 8] & (1 << (i % 8))) == 0)
+                continue;
+            if (d >= attest_pcr_out.pcrValues.count)
+                return TPM_RC_FAILURE;
+            rec_put_u16(s->hash);
+            rec_put_u8(i);
+            rec_put_u8(attest_pcr_out.pcrValues.digests[d].size);
+            rec_put(attest_pcr_out.pcrValues.digests[d].buffer,
+                    attest_pcr_out.pcrValues.digests[d].size);
+            d++;
+        }
     }
 
+    rec_put_u16(attest_quote_out.quoted.size);
+    rec_put(attest_quote_out.quoted.attestationData,
+            attest_quote_out.quoted.size);
+
+    sig = &attest_quote_out.signature.signature.ecdsa;
+    rec_put_u16(sig->hash);
+    rec_put_u8(sig->signatureR.size);
+    rec_put(sig->signatureR.buffer, sig->signatureR.size);
+    rec_put_u8(sig->signatureS.size);
+    rec_put(sig->signatureS.buffer, sig->signatureS.size);
+
+    pub = &aik->pub.publicArea.unique.ecc;
+    rec_put_u8(pub->x.size);
+    rec_put(pub->x.buffer, pub->x.size);
+    rec_put_u8(pub->y.size);
+    rec_put(pub->y.buffer, pub->y.size);
+
+    if (attest_rec_sz > ATTEST_RECORD_MAX)
+        return TPM_RC_SIZE;
     return 0;
 }
 
-/* Reads out the TPM measurement created by wolfBoot */
-static int read_measured_boot(uint8_t* digest)
+/* Handle [A5 51 nonce_sz nonce] from the host */
+static void attest_request(uint32_t version)
 {
-    int rc;
-    PCR_Read_In pcrReadCmd;
-    PCR_Read_Out pcrReadResp;
-
-    XMEMSET(&pcrReadCmd, 0, sizeof(pcrReadCmd));
-    TPM2_SetupPCRSel(&pcrReadCmd.pcrSelectionIn, TPM_ALG_SHA256, WOLFBOOT_MEASURED_PCR_A);
-    rc = TPM2_PCR_Read(&pcrReadCmd, &pcrReadResp);
-    if (rc == TPM_RC_SUCCESS) {
-        XMEMCPY(digest, pcrReadResp.pcrValues.digests[0].buffer,
-                pcrReadResp.pcrValues.digests[0].size);
-        rc = 0;
+    uint8_t nonce[ATTEST_NONCE_MAX];
+    uint8_t nonce_sz;
+    uint32_t i;
+
+    BOOT_TS(ATTEST_TS_REQUEST);
+    nonce_sz = uart_read();
+    if (nonce_sz > ATTEST_NONCE_MAX) {
+        uart_write(ERR);
+        return;
     }
+    for (i = 0; i < nonce_sz; i++)
+        nonce[i] = uart_read();
 
-    return rc;
+    if (attest_quote(nonce, nonce_sz, version) != 0) {
+        uart_write(ERR);
+        return;
+    }
+    tpm_timing_report();
+    uart_write(ATTEST_RESPONSE);
+    uart_write(attest_rec_sz & 0xFF);
+    uart_write((attest_rec_sz >> 8) & 0xFF);
+    for (i = 0; i < attest_rec_sz; i++)
+        uart_write(attest_rec[i]);
 }
+#endif /* MEASURED_BOOT_ATTEST */
 
-void main(void)
+/* Receive the update image and store it into the update partition.
+ * Runs from RAM, so reception continues while the flash pipeline is
+ * erasing or programming.
+ */
+static RAMCODE void update_loop(uint32_t version)
 {
     uint32_t tlen = 0;
     volatile uint32_t recv_seq;
     uint32_t r_total = 0;
     uint32_t tot_len = 0;
     uint32_t next_seq = 0;
+    uint8_t *page = NULL;
+    int i;
+
+    while (1) {
+        r_total = 0;
+        do {
+            while(r_total < 2) {
+                msg[r_total++] = uart_read();
+                if ((tot_len == 0) && (uart_line_errors > 0) &&
+                        (uart_bitrate != UART_BAUD_DEFAULT)) {
+                    /* Framing errors while idle: the host has gone back
+                     * to the default rate. */
+                    uart_set_bitrate(UART_BAUD_DEFAULT);
+                    uart_line_errors = 0;
+                    r_total = 0;
+                    continue;
+                }
+                if ((r_total == 2) && (tot_len == 0) && (msg[0] == 0xA5) &&
+                        (msg[1] == BAUD_PROPOSE)) {
+                    baud_negotiate();
+                    r_total = 0;
+                    continue;
+                }
+#ifdef MEASURED_BOOT_ATTEST
+                if ((r_total == 2) && (tot_len == 0) && (msg[0] == 0xA5) &&
+                        (msg[1] == ATTEST_REQUEST)) {
+                    attest_request(version);
+                    r_total = 0;
+                    continue;
+                }
+#endif
+                if ((r_total == 2) && ((msg[0] != 0xA5) || msg[1] != 0x5A)) {
+                    r_total = 0;
+                    continue;
+                }
+            }
+            msg[r_total++] = uart_read();
+            if ((tot_len == 0) && r_total == 2 + sizeof(uint32_t))
+                break;
+            if ((r_total > 8)  && (tot_len <= ((r_total - 8) + next_seq)))
+                break;
+        } while (r_total < MSGSIZE);
+        if (tot_len == 0)  {
+            tlen = msg[2] + (msg[3] << 8) + (msg[4] << 16) + (msg[5] << 24);
+            if (tlen > WOLFBOOT_PARTITION_SIZE - 8) {
+                uart_write(ERR);
+                uart_write(ERR);
+                uart_write(ERR);
+                uart_write(ERR);
+                uart_write(START);
+                recv_seq = 0;
+                tot_len = 0;
+                continue;
+            }
+            tot_len = tlen;
+            /* Start erasing the first sector while the host sends data */
+            flash_pipe_init(WOLFBOOT_PARTITION_UPDATE_ADDRESS, tot_len);
+            ack(0);
+            continue;
+        }
+        if (check(msg, r_total) < 0) {
+            ack(next_seq);
+            continue;
+        }
+        recv_seq = msg[4] + (msg[5] << 8) + (msg[6] << 16) + (msg[7] << 24);
+        if (recv_seq == next_seq)
+        {
+            int psize = r_total - 8;
+            int page_idx = recv_seq % PAGESIZE;
+            if (page_idx == 0)
+                page = flash_pipe_page();
+            for (i = 0; i < psize; i++)
+                page[page_idx + i] = msg[8 + i];
+            page_idx += psize;
+            if ((page_idx == PAGESIZE) || (next_seq + psize >= tot_len)) {
+                uint32_t dst = (WOLFBOOT_PARTITION_UPDATE_ADDRESS + recv_seq + psize) - page_idx;
+                flash_pipe_commit(dst);
+            }
+            next_seq += psize;
+        }
+        if (next_seq >= tot_len) {
+            /* Update complete: wait for the last pages to be written */
+            if (flash_pipe_flush() < 0) {
+                uart_write(ERR);
+                break;
+            }
+            ack(next_seq);
+            spi_flash_probe();
+            wolfBoot_update_trigger();
+            spi_release();
+            hal_flash_lock();
+            break;
+        }
+        ack(next_seq);
+    }
+}
+
+void main(void)
+{
     uint32_t version = 0;
     uint8_t *v_array = (uint8_t *)&version;
     uint8_t boot_measurement[WOLFBOOT_SHA_DIGEST_SIZE];
     int i;
-    memset(page, 0xFF, PAGESIZE);
     boot_led_on();
     flash_set_waitstates();
     clock_config();
+    cycle_counter_init();
+    BOOT_TS(ATTEST_TS_CLOCK);
     led_pwm_setup();
     pwm_init(CPU_FREQ, 0);
 
@@ -330,8 +693,8 @@ void main(void)
      * effect.
      */
     timer_init(CPU_FREQ, 1, 50);
-    uart_setup(115200, 8, 'N', 1);
-    memset(page, 0xFF, PAGESIZE);
+    uart_setup(UART_BAUD_DEFAULT, 8, 'N', 1);
+    BOOT_TS(ATTEST_TS_UART);
     asm volatile ("cpsie i");
 
     while(time_elapsed == 0)
@@ -355,13 +718,15 @@ void main(void)
         uart_write(v_array[i]);
     }
 
-    if(app_tpm2_init() != 0) {
+    if(tpm_ctx_init() != 0) {
         for(i=0; i < sizeof(TPMfailString); i++) {
             uart_write(TPMfailString[i]);
         }
     }
+    BOOT_TS(ATTEST_TS_TPM_INIT);
 
     if(read_measured_boot(boot_measurement) == 0) {
+        BOOT_TS(ATTEST_TS_PCR_READ);
         for(i = 0; i < sizeof(TPMpcrString); i++) {
             uart_write(TPMpcrString[i]);
         }
@@ -373,70 +738,10 @@ void main(void)
         uart_write('\n');
         uart_write('\r');
     }
+    tpm_timing_report();
+
+    update_loop(version);
 
-    while (1) {
-        r_total = 0;
-        do {
-            while(r_total < 2) {
-                msg[r_total++] = uart_read();
-                if ((r_total == 2) && ((msg[0] != 0xA5) || msg[1] != 0x5A)) {
-                    r_total = 0;
-                    continue;
-                }
-            }
-            msg[r_total++] = uart_read();
-            if ((tot_len == 0) && r_total == 2 + sizeof(uint32_t))
-                break;
-            if ((r_total > 8)  && (tot_len <= ((r_total - 8) + next_seq)))
-                break;
-        } while (r_total < MSGSIZE);
-        if (tot_len == 0)  {
-            tlen = msg[2] + (msg[3] << 8) + (msg[4] << 16) + (msg[5] << 24);
-            if (tlen > WOLFBOOT_PARTITION_SIZE - 8) {
-                uart_write(ERR);
-                uart_write(ERR);
-                uart_write(ERR);
-                uart_write(ERR);
-                uart_write(START);
-                recv_seq = 0;
-                tot_len = 0;
-                continue;
-            }
-            tot_len = tlen;
-            ack(0);
-            continue;
-        }
-        if (check(msg, r_total) < 0) {
-            ack(next_seq);
-            continue;
-        }
-        recv_seq = msg[4] + (msg[5] << 8) + (msg[6] << 16) + (msg[7] << 24);
-        if (recv_seq == next_seq)
-        {
-            int psize = r_total - 8;
-            int page_idx = recv_seq % PAGESIZE;
-            memcpy(&page[recv_seq % PAGESIZE], msg + 8, psize);
-            page_idx += psize;
-            if ((page_idx == PAGESIZE) || (next_seq + psize >= tot_len)) {
-                uint32_t dst = (WOLFBOOT_PARTITION_UPDATE_ADDRESS + recv_seq + psize) - page_idx;
-                if ((dst % WOLFBOOT_SECTOR_SIZE) == 0) {
-                    hal_flash_erase(dst, WOLFBOOT_SECTOR_SIZE);
-                }
-                hal_flash_write(dst, page, PAGESIZE);
-                memset(page, 0xFF, PAGESIZE);
-            }
-            next_seq += psize;
-        }
-        ack(next_seq);
-        if (next_seq >= tot_len) {
-            /* Update complete */
-            spi_flash_probe();
-            wolfBoot_update_trigger();
-            spi_release();
-            hal_flash_lock();
-            break;
-        }
-    }
     /* Wait for reboot */
     while(1)
         ;
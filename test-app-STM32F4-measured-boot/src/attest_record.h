@@ -0,0 +1,72 @@
+/* attest_record.h
+ *
+ * Binary format of the measured boot attestation record, shared between
+ * the STM32F4 application and the host-side attest-verify tool.
+ *
+ * Copyright (C) 2021 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+#ifndef ATTEST_RECORD_H_INCLUDED
+#define ATTEST_RECORD_H_INCLUDED
+
+/* Request, sent by the host while no update is in progress:
+ *   [A5 51] [nonce_sz:8] [nonce]
+ *
+ * Response:
+ *   ['@'] [record_sz:16] [record]
+ * or '!' if the quote could not be produced.
+ *
+ * Record (multi-byte fields little-endian, except for the TPMS_ATTEST
+ * structure which is forwarded as marshaled by the TPM):
+ *   magic         "WBA1"
+ *   fw_version    u32
+ *   n_ts          u8, followed by n_ts x u32 boot-phase timestamps (us)
+ *   nonce_sz      u8, followed by the nonce
+ *   n_pcr         u8, followed by n_pcr x
+ *                     { alg:u16, index:u8, size:u8, digest }
+ *                 in the same order used by the TPM for the quote
+ *   attest_sz     u16, followed by TPMS_ATTEST
+ *   sig_hash      u16 (TPM_ALG_ID)
+ *   r_sz          u8, r,  s_sz u8, s   (ECDSA signature)
+ *   x_sz          u8, x,  y_sz u8, y   (attestation key, P-256)
+ */
+
+#define ATTEST_REQUEST       0x51
+#define ATTEST_RESPONSE      '@'
+#define ATTEST_MAGIC         "WBA1"
+#define ATTEST_MAGIC_SZ      4
+#define ATTEST_NONCE_MAX     32
+#define ATTEST_RECORD_MAX    1024
+
+/* Boot-phase timestamps, in microseconds since clock setup */
+enum attest_ts {
+    ATTEST_TS_CLOCK = 0,    /* Clock configured, cycle counter started */
+    ATTEST_TS_UART,         /* UART ready */
+    ATTEST_TS_TPM_INIT,     /* TPM initialized */
+    ATTEST_TS_PCR_READ,     /* Measured boot PCR read at start-up */
+    ATTEST_TS_REQUEST,      /* Attestation request received */
+    ATTEST_TS_QUOTE,        /* Quote produced */
+    ATTEST_TS_COUNT
+};
+
+/* TPM_ALG_ID values used in the record */
+#define ATTEST_ALG_SHA1      0x0004
+#define ATTEST_ALG_SHA256    0x000B
+
+#endif /* !ATTEST_RECORD_H_INCLUDED */
@@ -0,0 +1,241 @@
+/* flash_pipe.c
+ *
+ * Pipelined writer for the update partition: pages are queued by the
+ * update loop and programmed from the flash controller's EOP interrupt,
+ * while the next sector is erased ahead of time.
+ *
+ * Copyright (C) 2021 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+#ifdef PLATFORM_stm32f4
+#include <stdint.h>
+#include "system.h"
+#include "flash_pipe.h"
+
+/* The controller registers, the word writes and the NVIC masking are
+ * replaced by the host simulator in flash-pipe-sim/ */
+#ifndef FLASH_SR
+#define FLASH_BASE          (0x40023C00)
+#define FLASH_SR            (*(volatile uint32_t *)(FLASH_BASE + 0x0C))
+#define FLASH_CR            (*(volatile uint32_t *)(FLASH_BASE + 0x10))
+#endif
+#ifndef FLASH_PROGRAM_WORD
+#define FLASH_PROGRAM_WORD(address, val) \
+    (*((volatile uint32_t *)(address)) = (val))
+#endif
+
+#define FLASH_SR_BSY        (1 << 16)
+#define FLASH_SR_PGSERR     (1 << 7)
+#define FLASH_SR_PGPERR     (1 << 6)
+#define FLASH_SR_PGAERR     (1 << 5)
+#define FLASH_SR_WRPERR     (1 << 4)
+#define FLASH_SR_OPERR      (1 << 1)
+#define FLASH_SR_EOP        (1 << 0)
+#define FLASH_SR_ERRORS     (FLASH_SR_PGSERR | FLASH_SR_PGPERR | \
+                             FLASH_SR_PGAERR | FLASH_SR_WRPERR | FLASH_SR_OPERR)
+
+#define FLASH_CR_ERRIE      (1 << 25)
+#define FLASH_CR_EOPIE      (1 << 24)
+#define FLASH_CR_STRT       (1 << 16)
+#define FLASH_CR_PSIZE_X32  (2 << 8)
+#define FLASH_CR_SNB_SHIFT  3
+#define FLASH_CR_SNB_MASK   (0x1F << FLASH_CR_SNB_SHIFT)
+#define FLASH_CR_SER        (1 << 1)
+#define FLASH_CR_PG         (1 << 0)
+#define FLASH_CR_OP_MASK    (FLASH_CR_PG | FLASH_CR_SER | FLASH_CR_SNB_MASK | \
+                             (3 << 8) | FLASH_CR_EOPIE | FLASH_CR_ERRIE)
+
+#define FLASH_START         (0x08000000)
+#define NVIC_FLASH_IRQN     (4)
+
+/* Not using nvic_irq_enable/disable from system.h, as those are not
+ * guaranteed to be inlined into RAM code. Both IRQs are in ISER0/ICER0.
+ */
+#ifndef IRQ_ON
+#define NVIC_ISER0          (*(volatile uint32_t *)(NVIC_ISER_BASE))
+#define NVIC_ICER0          (*(volatile uint32_t *)(NVIC_ICER_BASE))
+#define IRQ_ON(n)           (NVIC_ISER0 = (1 << (n)))
+#define IRQ_OFF(n)          do { NVIC_ICER0 = (1 << (n)); DMB(); } while(0)
+#endif
+
+#define PAGE_WORDS (FLASH_PIPE_PAGESIZE / sizeof(uint32_t))
+
+enum flash_pipe_state {
+    PIPE_IDLE = 0,
+    PIPE_ERASING,
+    PIPE_PROGRAMMING
+};
+
+struct flash_pipe_page {
+    uint32_t dst;
+    uint32_t data[PAGE_WORDS];
+};
+
+static struct flash_pipe_page queue[FLASH_PIPE_DEPTH];
+static volatile uint32_t q_head, q_tail; /* pop at head, push at tail */
+static volatile uint32_t word_idx;
+static volatile enum flash_pipe_state state = PIPE_IDLE;
+static volatile uint32_t erased_end;
+static volatile uint32_t erase_sector_size;
+static uint32_t erase_limit;
+static volatile uint32_t pipe_errors;
+
+/* Sector layout of the 1MB STM32F40x flash: 4x16K, 1x64K, 7x128K.
+ * 'address' is either in the flash region or in its alias at 0, which is
+ * how the wolfBoot partitions are configured.
+ */
+static RAMCODE uint32_t flash_sector(uint32_t address, uint32_t *size)
+{
+    uint32_t off = address;
+    if (off >= FLASH_START)
+        off -= FLASH_START;
+    if (off < 0x10000) {
+        *size = 0x4000;
+        return off / 0x4000;
+    }
+    if (off < 0x20000) {
+        *size = 0x10000;
+        return 4;
+    }
+    *size = 0x20000;
+    return 4 + off / 0x20000;
+}
+
+/* Start the next flash operation, if any. Programming queued pages that
+ * fall into erased flash has priority; when the queue is drained, the
+ * next sector is erased ahead of time.
+ * Must be called with the flash interrupt masked, or from isr_flash.
+ */
+static RAMCODE void flash_pipe_kick(void)
+{
+    uint32_t cr;
+    if ((state != PIPE_IDLE) || (FLASH_SR & FLASH_SR_BSY))
+        return;
+    cr = FLASH_CR & ~FLASH_CR_OP_MASK;
+    if ((q_head != q_tail) &&
+            (queue[q_head % FLASH_PIPE_DEPTH].dst + FLASH_PIPE_PAGESIZE <= erased_end)) {
+        struct flash_pipe_page *p = &queue[q_head % FLASH_PIPE_DEPTH];
+        state = PIPE_PROGRAMMING;
+        FLASH_CR = cr | FLASH_CR_PG | FLASH_CR_PSIZE_X32 | FLASH_CR_EOPIE |
+            FLASH_CR_ERRIE;
+        DMB();
+        FLASH_PROGRAM_WORD(p->dst + word_idx * sizeof(uint32_t),
+            p->data[word_idx]);
+        return;
+    }
+    if (erased_end < erase_limit) {
+        uint32_t sector = flash_sector(erased_end, (uint32_t *)&erase_sector_size);
+        state = PIPE_ERASING;
+        /* The TIM2 vector lives in flash: fetching it would stall the CPU
+         * until the erase is complete. */
+        IRQ_OFF(NVIC_TIM2_IRQN);
+        FLASH_CR = cr | FLASH_CR_SER | FLASH_CR_PSIZE_X32 |
+            (sector << FLASH_CR_SNB_SHIFT) | FLASH_CR_EOPIE | FLASH_CR_ERRIE;
+        DMB();
+        FLASH_CR |= FLASH_CR_STRT;
+    }
+}
+
+RAMCODE void isr_flash(void)
+{
+    uint32_t sr = FLASH_SR;
+    /* EOP and error flags are cleared by writing 1 */
+    FLASH_SR = sr & (FLASH_SR_EOP | FLASH_SR_ERRORS);
+    if (sr & FLASH_SR_ERRORS)
+        pipe_errors++;
+
+    if (state == PIPE_ERASING) {
+        erased_end += erase_sector_size;
+        IRQ_ON(NVIC_TIM2_IRQN);
+    } else if (state == PIPE_PROGRAMMING) {
+        if (++word_idx == PAGE_WORDS) {
+            word_idx = 0;
+            q_head++;
+        }
+    }
+    FLASH_CR &= ~FLASH_CR_OP_MASK;
+    state = PIPE_IDLE;
+    flash_pipe_kick();
+}
+
+/* Prepare the pipeline for an image of 'len' bytes at 'address' (which must
+ * be sector aligned), and start erasing the first sector right away.
+ * The flash must be unlocked (hal_flash_unlock()).
+ */
+RAMCODE void flash_pipe_init(uint32_t address, uint32_t len)
+{
+    uint32_t sz;
+    IRQ_OFF(NVIC_FLASH_IRQN);
+    q_head = q_tail = 0;
+    word_idx = 0;
+    pipe_errors = 0;
+    state = PIPE_IDLE;
+    erased_end = address;
+    erase_limit = address;
+    while (erase_limit < address + len) {
+        flash_sector(erase_limit, &sz);
+        erase_limit += sz;
+    }
+    FLASH_SR = FLASH_SR_EOP | FLASH_SR_ERRORS;
+    nvic_irq_setprio(NVIC_FLASH_IRQN, 0);
+    flash_pipe_kick();
+    IRQ_ON(NVIC_FLASH_IRQN);
+}
+
+/* Returns the next free page in the queue, filled with 0xFF. Waits for a
+ * slot to be released by the flash interrupt if the queue is full.
+ */
+RAMCODE uint8_t *flash_pipe_page(void)
+{
+    uint32_t i;
+    struct flash_pipe_page *p;
+    while ((q_tail - q_head) >= FLASH_PIPE_DEPTH)
+        ;
+    p = &queue[q_tail % FLASH_PIPE_DEPTH];
+    for (i = 0; i < PAGE_WORDS; i++)
+        p->data[i] = 0xFFFFFFFF;
+    return (uint8_t *)p->data;
+}
+
+/* Queue the page returned by flash_pipe_page() for programming at 'dst' */
+RAMCODE void flash_pipe_commit(uint32_t dst)
+{
+    queue[q_tail % FLASH_PIPE_DEPTH].dst = dst;
+    IRQ_OFF(NVIC_FLASH_IRQN);
+    q_tail++;
+    flash_pipe_kick();
+    IRQ_ON(NVIC_FLASH_IRQN);
+}
+
+/* Wait until all the queued pages are programmed. Erase-ahead of sectors
+ * that have not been reached yet is cancelled.
+ */
+RAMCODE int flash_pipe_flush(void)
+{
+    while ((q_head != q_tail) || (state == PIPE_PROGRAMMING))
+        ;
+    IRQ_OFF(NVIC_FLASH_IRQN);
+    erase_limit = erased_end;
+    IRQ_ON(NVIC_FLASH_IRQN);
+    while (state != PIPE_IDLE)
+        ;
+    IRQ_OFF(NVIC_FLASH_IRQN);
+    return pipe_errors ? -1 : 0;
+}
+#endif /* PLATFORM_stm32f4 */
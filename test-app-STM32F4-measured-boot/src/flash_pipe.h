@@ -0,0 +1,53 @@
+/* flash_pipe.h
+ *
+ * Pipelined writer for the update partition: pages are queued by the
+ * update loop and programmed from the flash controller's EOP interrupt,
+ * while the next sector is erased ahead of time.
+ *
+ * Copyright (C) 2021 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+#ifndef FLASH_PIPE_H_INCLUDED
+#define FLASH_PIPE_H_INCLUDED
+
+#include <stdint.h>
+
+#ifndef FLASH_PIPE_PAGESIZE
+#define FLASH_PIPE_PAGESIZE (256)
+#endif
+
+#ifndef FLASH_PIPE_DEPTH
+#define FLASH_PIPE_DEPTH (8)
+#endif
+
+/* The STM32F4 stalls any fetch from flash while a sector erase is in
+ * progress. Everything that runs while the pipeline is busy must be
+ * placed in RAM (.ramcode is copied by isr_reset together with .data).
+ */
+#ifndef RAMCODE
+#define RAMCODE __attribute__((used,section(".ramcode"),long_call))
+#endif
+
+void flash_pipe_init(uint32_t address, uint32_t len);
+uint8_t *flash_pipe_page(void);
+void flash_pipe_commit(uint32_t dst);
+int flash_pipe_flush(void);
+void isr_flash(void);
+
+#endif /* !FLASH_PIPE_H_INCLUDED */
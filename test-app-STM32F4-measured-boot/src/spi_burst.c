@@ -0,0 +1,155 @@
+/* spi_burst.c
+ *
+ * Full-duplex block transfers on the TPM SPI bus (SPI1), using DMA2
+ * for long transfers and a pipelined data register loop otherwise.
+ *
+ * Copyright (C) 2021 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+#ifdef PLATFORM_stm32f4
+#include <stdint.h>
+#include "spi_burst.h"
+
+#define SPI1_BASE           (0x40013000)
+#define SPI1_CR2            (*(volatile uint32_t *)(SPI1_BASE + 0x04))
+#define SPI1_SR             (*(volatile uint32_t *)(SPI1_BASE + 0x08))
+#define SPI1_DR             (*(volatile uint32_t *)(SPI1_BASE + 0x0c))
+
+#define SPI_CR2_TXDMAEN     (1 << 1)
+#define SPI_CR2_RXDMAEN     (1 << 0)
+#define SPI_SR_BSY          (1 << 7)
+#define SPI_SR_TXE          (1 << 1)
+#define SPI_SR_RXNE         (1 << 0)
+
+#ifdef SPI_BURST_DMA
+#define AHB1_CLOCK_ER       (*(volatile uint32_t *)(0x40023830))
+#define DMA2_AHB1_CLOCK_ER  (1 << 22)
+
+/* SPI1_RX: DMA2 stream 0, channel 3. SPI1_TX: DMA2 stream 3, channel 3 */
+#define DMA2_BASE           (0x40026400)
+#define DMA2_LISR           (*(volatile uint32_t *)(DMA2_BASE + 0x00))
+#define DMA2_LIFCR          (*(volatile uint32_t *)(DMA2_BASE + 0x08))
+#define DMA2_SCR(s)         (*(volatile uint32_t *)(DMA2_BASE + 0x10 + 0x18 * (s)))
+#define DMA2_SNDTR(s)       (*(volatile uint32_t *)(DMA2_BASE + 0x14 + 0x18 * (s)))
+#define DMA2_SPAR(s)        (*(volatile uint32_t *)(DMA2_BASE + 0x18 + 0x18 * (s)))
+#define DMA2_SM0AR(s)       (*(volatile uint32_t *)(DMA2_BASE + 0x1c + 0x18 * (s)))
+
+#define SPI_RX_STREAM       0
+#define SPI_TX_STREAM       3
+#define SPI_DMA_CHANNEL     3
+
+#define DMA_SCR_CHSEL_SHIFT 25
+#define DMA_SCR_MINC        (1 << 10)
+#define DMA_SCR_DIR_M2P     (1 << 6)
+#define DMA_SCR_EN          (1 << 0)
+
+#define DMA_S0_FLAGS        (0x3D << 0)
+#define DMA_S3_FLAGS        (0x3D << 22)
+#define DMA_S0_TCIF         (1 << 5)
+#define DMA_S0_TEIF         (1 << 3)
+
+/* Without a buffer, TX repeats a constant filler and RX discards into a
+ * sink byte. They must be separate: with a single byte, the RX stream would
+ * overwrite what TX is sending with the bytes received. */
+static uint8_t dma_tx_fill = 0xFF;
+static uint8_t dma_rx_sink;
+
+static int spi_burst_dma(const uint8_t *tx, uint8_t *rx, uint32_t len)
+{
+    uint32_t isr;
+    AHB1_CLOCK_ER |= DMA2_AHB1_CLOCK_ER;
+
+    DMA2_SCR(SPI_RX_STREAM) = 0;
+    DMA2_SCR(SPI_TX_STREAM) = 0;
+    while ((DMA2_SCR(SPI_RX_STREAM) & DMA_SCR_EN) ||
+            (DMA2_SCR(SPI_TX_STREAM) & DMA_SCR_EN))
+        ;
+    DMA2_LIFCR = DMA_S0_FLAGS | DMA_S3_FLAGS;
+
+    DMA2_SPAR(SPI_RX_STREAM) = (uint32_t)&SPI1_DR;
+    DMA2_SM0AR(SPI_RX_STREAM) = rx ? (uint32_t)rx : (uint32_t)&dma_rx_sink;
+    DMA2_SNDTR(SPI_RX_STREAM) = len;
+    DMA2_SCR(SPI_RX_STREAM) = (SPI_DMA_CHANNEL << DMA_SCR_CHSEL_SHIFT) |
+        (rx ? DMA_SCR_MINC : 0);
+
+    DMA2_SPAR(SPI_TX_STREAM) = (uint32_t)&SPI1_DR;
+    DMA2_SM0AR(SPI_TX_STREAM) = tx ? (uint32_t)tx : (uint32_t)&dma_tx_fill;
+    DMA2_SNDTR(SPI_TX_STREAM) = len;
+    DMA2_SCR(SPI_TX_STREAM) = (SPI_DMA_CHANNEL << DMA_SCR_CHSEL_SHIFT) |
+        DMA_SCR_DIR_M2P | (tx ? DMA_SCR_MINC : 0);
+
+    /* RX must be armed before TX starts clocking */
+    DMA2_SCR(SPI_RX_STREAM) |= DMA_SCR_EN;
+    DMA2_SCR(SPI_TX_STREAM) |= DMA_SCR_EN;
+    SPI1_CR2 |= SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN;
+
+    do {
+        isr = DMA2_LISR;
+    } while ((isr & (DMA_S0_TCIF | DMA_S0_TEIF)) == 0);
+
+    while (SPI1_SR & SPI_SR_BSY)
+        ;
+    SPI1_CR2 &= ~(SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN);
+    DMA2_SCR(SPI_RX_STREAM) = 0;
+    DMA2_SCR(SPI_TX_STREAM) = 0;
+    DMA2_LIFCR = DMA_S0_FLAGS | DMA_S3_FLAGS;
+    if (isr & DMA_S0_TEIF)
+        return -1;
+    return 0;
+}
+#endif /* SPI_BURST_DMA */
+
+/* Keep the data register loaded while the previous byte is still being
+ * shifted out, so the clock runs back-to-back. At most two bytes are in
+ * flight, which guarantees no RX overrun. */
+static int spi_burst_pio(const uint8_t *tx, uint8_t *rx, uint32_t len)
+{
+    uint32_t tx_i = 0, rx_i = 0;
+    uint8_t b;
+
+    while (rx_i < len) {
+        if ((tx_i < len) && (tx_i - rx_i < 2) && (SPI1_SR & SPI_SR_TXE)) {
+            SPI1_DR = tx ? tx[tx_i] : 0xFF;
+            tx_i++;
+        }
+        if (SPI1_SR & SPI_SR_RXNE) {
+            b = (uint8_t)SPI1_DR;
+            if (rx)
+                rx[rx_i] = b;
+            rx_i++;
+        }
+    }
+    return 0;
+}
+
+int spi_burst_xfer(const uint8_t *tx, uint8_t *rx, uint32_t len)
+{
+    volatile uint32_t stale;
+    if (len == 0)
+        return 0;
+    /* Drop any byte left over from a previous single-byte transfer */
+    while (SPI1_SR & SPI_SR_RXNE)
+        stale = SPI1_DR;
+#ifdef SPI_BURST_DMA
+    if (len >= SPI_BURST_DMA_THRESHOLD)
+        return spi_burst_dma(tx, rx, len);
+#endif
+    return spi_burst_pio(tx, rx, len);
+}
+#endif /* PLATFORM_stm32f4 */
@@ -0,0 +1,41 @@
+/* spi_burst.h
+ *
+ * Full-duplex block transfers on the TPM SPI bus (SPI1), using DMA2
+ * for long transfers and a pipelined data register loop otherwise.
+ *
+ * Copyright (C) 2021 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+#ifndef SPI_BURST_H_INCLUDED
+#define SPI_BURST_H_INCLUDED
+
+#include <stdint.h>
+
+/* Transfers shorter than this are not worth the DMA setup */
+#ifndef SPI_BURST_DMA_THRESHOLD
+#define SPI_BURST_DMA_THRESHOLD (16)
+#endif
+
+/* Clock out 'len' bytes from 'tx' (0xFF if NULL) while storing the bytes
+ * received into 'rx' (discarded if NULL). The SPI bus must be initialized
+ * with spi_init() and the chip select asserted by the caller.
+ */
+int spi_burst_xfer(const uint8_t *tx, uint8_t *rx, uint32_t len);
+
+#endif /* !SPI_BURST_H_INCLUDED */
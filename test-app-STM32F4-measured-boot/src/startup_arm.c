@@ -33,6 +33,7 @@ static int zeroed_variable_in_bss;
 static int initialized_variable_in_data = 42;
 
 extern void isr_tim2(void);
+extern void isr_flash(void);
 
 #define STACK_PAINTING
 
@@ -288,7 +289,7 @@ void (* const IV[])(void) =
     isr_empty,              // PVD_IRQ 1
     isr_empty,              // TAMP_STAMP_IRQ 2
     isr_empty,              // RTC_WKUP_IRQ 3
-    isr_empty,              // FLASH_IRQ 4
+    isr_flash,              // FLASH_IRQ 4
     isr_empty,              // RCC_IRQ 5
     isr_empty,              // EXTI0_IRQ 6
     isr_empty,              // EXTI1_IRQ 7
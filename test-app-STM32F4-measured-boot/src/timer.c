@@ -71,6 +71,13 @@
 #define GPIOD_PUPD (*(volatile uint32_t *)(GPIOD_BASE + 0x0c))
 #define GPIOD_ODR  (*(volatile uint32_t *)(GPIOD_BASE + 0x14))
 
+/* Cortex-M debug cycle counter */
+#define DEMCR       (*(volatile uint32_t *)(0xE000EDFC))
+#define DEMCR_TRCENA (1 << 24)
+#define DWT_CTRL    (*(volatile uint32_t *)(0xE0001000))
+#define DWT_CYCCNT  (*(volatile uint32_t *)(0xE0001004))
+#define DWT_CTRL_CYCCNTENA (1 << 0)
+
 static uint32_t master_clock = 0;
 
 /** Use TIM4_CH4, which is linked to PD15 AF1 **/
@@ -147,6 +154,18 @@ int timer_init(uint32_t clock, uint32_t prescaler, uint32_t interval_ms)
     return 0;
 }
 
+void cycle_counter_init(void)
+{
+    DEMCR |= DEMCR_TRCENA;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+}
+
+uint32_t cycle_counter(void)
+{
+    return DWT_CYCCNT;
+}
+
 extern volatile uint32_t time_elapsed;
 void isr_tim2(void)
 {
@@ -168,4 +187,13 @@ void isr_tim2(void)
 {
 }
 
+void cycle_counter_init(void)
+{
+}
+
+uint32_t cycle_counter(void)
+{
+    return 0;
+}
+
 #endif /* PLATFORM_stm32f4 */
@@ -27,4 +27,9 @@
 int pwm_init(uint32_t clock, uint32_t threshold);
 int timer_init(uint32_t clock, uint32_t scaler, uint32_t interval);
 
+/* DWT cycle counter, for profiling */
+void cycle_counter_init(void);
+uint32_t cycle_counter(void);
+#define CYCLES_TO_US(c) ((c) / (CPU_FREQ / 1000000))
+
 #endif /* !TIMER_H_INCLUDED */
@@ -0,0 +1,329 @@
+/* tpm_ctx.c
+ *
+ * Persistent TPM context for the measured boot application: the TPM is
+ * initialized once, and the capabilities, attestation key and session are
+ * kept across operations.
+ *
+ * Copyright (C) 2021 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+#include <stdint.h>
+#include "system.h"
+#include "timer.h"
+#include "spi_drv.h"
+#include "spi_tpm.h"
+#include "spi_burst.h"
+#include "tpm_ctx.h"
+
+/* TIS SPI flow control: the TPM holds bit 0 of the last header byte low
+ * to insert wait states. Number of polled bytes before giving up: */
+#ifndef TPM_TIS_MAX_WAIT
+#define TPM_TIS_MAX_WAIT 50
+#endif
+#define TPM_TIS_HEADER_SZ 4
+
+static WOLFTPM2_DEV tpm_dev;
+static WOLFTPM2_CAPS tpm_caps;
+static WOLFTPM2_KEY tpm_aik;
+static WOLFTPM2_KEY tpm_srk; /* AIK parent and session salt key */
+static WOLFTPM2_SESSION tpm_session;
+static int tpm_ready = 0;
+static int tpm_srk_ready = 0;
+static int tpm_aik_ready = 0;
+static int tpm_session_ready = 0;
+
+#ifdef TPM_TIMING
+#ifndef TPM_TIMING_MAX_CMDS
+#define TPM_TIMING_MAX_CMDS 12
+#endif
+
+struct tpm_cmd_stats {
+    const char *cmd;
+    uint32_t count;
+    uint32_t last_us;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t total_us;
+    uint32_t spi_us;
+};
+
+extern void uart_print(const char *s);
+extern void uart_write_dec(uint32_t val);
+
+static struct tpm_cmd_stats tpm_stats[TPM_TIMING_MAX_CMDS];
+/* SPI activity accounted to the TPM command in progress */
+static uint32_t tpm_spi_cycles;
+static uint32_t tpm_cmd_start;
+
+void tpm_timing_start(void)
+{
+    tpm_spi_cycles = 0;
+    tpm_cmd_start = cycle_counter();
+}
+
+void tpm_timing_end(const char *cmd)
+{
+    uint32_t us = CYCLES_TO_US(cycle_counter() - tpm_cmd_start);
+    struct tpm_cmd_stats *st = NULL;
+    int i;
+    for (i = 0; i < TPM_TIMING_MAX_CMDS; i++) {
+        if ((tpm_stats[i].cmd == cmd) || (tpm_stats[i].cmd == NULL)) {
+            st = &tpm_stats[i];
+            break;
+        }
+    }
+    if (!st)
+        return;
+    if (st->cmd == NULL) {
+        st->cmd = cmd;
+        st->min_us = us;
+    }
+    st->count++;
+    st->last_us = us;
+    st->total_us += us;
+    st->spi_us += CYCLES_TO_US(tpm_spi_cycles);
+    if (us < st->min_us)
+        st->min_us = us;
+    if (us > st->max_us)
+        st->max_us = us;
+}
+
+void tpm_timing_report(void)
+{
+    int i;
+    uart_print("TPM command latency (us): count last min max avg spi-avg\r\n");
+    for (i = 0; (i < TPM_TIMING_MAX_CMDS) && tpm_stats[i].cmd; i++) {
+        struct tpm_cmd_stats *st = &tpm_stats[i];
+        uart_print(st->cmd);
+        uart_print(": ");
+        uart_write_dec(st->count);
+        uart_print(" ");
+        uart_write_dec(st->last_us);
+        uart_print(" ");
+        uart_write_dec(st->min_us);
+        uart_print(" ");
+        uart_write_dec(st->max_us);
+        uart_print(" ");
+        uart_write_dec(st->total_us / st->count);
+        uart_print(" ");
+        uart_write_dec(st->spi_us / st->count);
+        uart_print("\r\n");
+    }
+}
+#endif /* TPM_TIMING */
+
+static int tpm_ctx_IoCb(TPM2_CTX* ctx, const byte* txBuf, byte* rxBuf,
+    word16 xferSz, void* userCtx)
+{
+    (void)userCtx;
+    (void)ctx;
+    int rc = 0;
+#ifdef TPM_TIMING
+    uint32_t start = cycle_counter();
+#endif
+
+    spi_cs_on(SPI_CS_TPM);
+
+#ifndef WOLFTPM_CHECK_WAIT_STATE
+    /* wolfTPM hands over the whole TIS frame: send the header first, and
+     * poll for the end of the wait states before the data phase. */
+    if (xferSz > TPM_TIS_HEADER_SZ) {
+        int timeout = TPM_TIS_MAX_WAIT;
+        spi_burst_xfer(txBuf, rxBuf, TPM_TIS_HEADER_SZ);
+        while ((rxBuf[TPM_TIS_HEADER_SZ - 1] & 0x01) == 0) {
+            if (--timeout < 0) {
+                rc = TPM_RC_FAILURE;
+                break;
+            }
+            spi_burst_xfer(NULL, &rxBuf[TPM_TIS_HEADER_SZ - 1], 1);
+        }
+        if (rc == 0) {
+            rc = spi_burst_xfer(txBuf + TPM_TIS_HEADER_SZ,
+                    rxBuf + TPM_TIS_HEADER_SZ, xferSz - TPM_TIS_HEADER_SZ);
+        }
+    }
+    else
+#endif
+    {
+        /* Wait states are handled by wolfTPM (WOLFTPM_CHECK_WAIT_STATE) */
+        rc = spi_burst_xfer(txBuf, rxBuf, xferSz);
+    }
+    spi_cs_off(SPI_CS_TPM);
+
+#ifdef TPM_TIMING
+    tpm_spi_cycles += cycle_counter() - start;
+#endif
+    if (rc != 0)
+        return TPM_RC_FAILURE;
+
+    return 0;
+}
+
+/* Initialize the TPM and read its capabilities. Only the first call talks
+ * to the TPM. */
+int tpm_ctx_init(void)
+{
+    int rc;
+
+    if (tpm_ready)
+        return 0;
+
+    spi_init(0,0);
+
+    /* Init the TPM2 device */
+    tpm_timing_start();
+    rc = wolfTPM2_Init(&tpm_dev, tpm_ctx_IoCb, NULL);
+    tpm_timing_end("wolfTPM2_Init");
+    if (rc != 0)  {
+        return rc;
+    }
+
+    /* Get device capabilities + options */
+    tpm_timing_start();
+    rc = wolfTPM2_GetCapabilities(&tpm_dev, &tpm_caps);
+    tpm_timing_end("wolfTPM2_GetCapabilities");
+    if (rc != 0)  {
+        return rc;
+    }
+
+    tpm_ready = 1;
+    return 0;
+}
+
+WOLFTPM2_DEV *tpm_ctx_dev(void)
+{
+    return &tpm_dev;
+}
+
+const WOLFTPM2_CAPS *tpm_ctx_caps(void)
+{
+    return tpm_ready ? &tpm_caps : NULL;
+}
+
+/* Loads the storage root key, persistent at TPM_CTX_SRK_HANDLE. It is
+ * created on first use; the session salt needs it on every boot. */
+static int tpm_ctx_get_srk(void)
+{
+    int rc;
+
+    if (tpm_srk_ready)
+        return 0;
+    tpm_timing_start();
+    rc = wolfTPM2_ReadPublicKey(&tpm_dev, &tpm_srk, TPM_CTX_SRK_HANDLE);
+    tpm_timing_end("wolfTPM2_ReadPublicKey");
+    if (rc != 0) {
+        XMEMSET(&tpm_srk, 0, sizeof(tpm_srk));
+        tpm_timing_start();
+        rc = wolfTPM2_CreateSRK(&tpm_dev, &tpm_srk, TPM_ALG_ECC, NULL, 0);
+        tpm_timing_end("wolfTPM2_CreateSRK");
+        if (rc == 0) {
+            tpm_timing_start();
+            rc = wolfTPM2_NVStoreKey(&tpm_dev, TPM_RH_OWNER, &tpm_srk,
+                    TPM_CTX_SRK_HANDLE);
+            tpm_timing_end("wolfTPM2_NVStoreKey");
+            if (rc != 0)
+                wolfTPM2_UnloadHandle(&tpm_dev, &tpm_srk.handle);
+        }
+        if (rc != 0)
+            return rc;
+    }
+    tpm_srk_ready = 1;
+    return 0;
+}
+
+/* Returns the attestation key. It is looked up at TPM_CTX_AIK_HANDLE
+ * first; if missing, it is created under the SRK and made persistent,
+ * so the (slow) key generation only happens once per TPM. */
+int tpm_ctx_get_aik(WOLFTPM2_KEY **aik)
+{
+    int rc;
+
+    if (!tpm_ready)
+        return TPM_RC_INITIALIZE;
+    if (tpm_aik_ready) {
+        *aik = &tpm_aik;
+        return 0;
+    }
+
+    tpm_timing_start();
+    rc = wolfTPM2_ReadPublicKey(&tpm_dev, &tpm_aik, TPM_CTX_AIK_HANDLE);
+    tpm_timing_end("wolfTPM2_ReadPublicKey");
+    if (rc != 0) {
+        rc = tpm_ctx_get_srk();
+        if (rc == 0) {
+            tpm_timing_start();
+            rc = wolfTPM2_CreateAndLoadAIK(&tpm_dev, &tpm_aik, TPM_ALG_ECC,
+                    &tpm_srk, NULL, 0);
+            tpm_timing_end("wolfTPM2_CreateAndLoadAIK");
+        }
+        if (rc == 0) {
+            tpm_timing_start();
+            rc = wolfTPM2_NVStoreKey(&tpm_dev, TPM_RH_OWNER, &tpm_aik,
+                    TPM_CTX_AIK_HANDLE);
+            tpm_timing_end("wolfTPM2_NVStoreKey");
+            if (rc != 0)
+                wolfTPM2_UnloadHandle(&tpm_dev, &tpm_aik.handle);
+        }
+        if (rc != 0)
+            return rc;
+    }
+    tpm_aik_ready = 1;
+    *aik = &tpm_aik;
+    return 0;
+}
+
+/* Attach the HMAC session with parameter encryption to auth slot 1, for
+ * the next command only. The session is salted with the SRK, so its key
+ * cannot be derived from the bus traffic, and kept open across commands
+ * (continueSession). Only attach it to commands whose first parameter
+ * and first response parameter are a TPM2B (e.g. TPM2_Quote, not
+ * TPM2_PCR_Read), then call tpm_ctx_session_detach(). */
+int tpm_ctx_session(void)
+{
+    int rc;
+
+    if (!tpm_ready)
+        return TPM_RC_INITIALIZE;
+    if (!tpm_session_ready) {
+        rc = tpm_ctx_get_srk();
+        if (rc != 0)
+            return rc;
+        tpm_timing_start();
+        rc = wolfTPM2_StartSession(&tpm_dev, &tpm_session, &tpm_srk, NULL,
+                TPM_SE_HMAC, TPM_ALG_CFB);
+        tpm_timing_end("wolfTPM2_StartSession");
+        if (rc != 0)
+            return rc;
+        tpm_session_ready = 1;
+    }
+    return wolfTPM2_SetAuthSession(&tpm_dev, 1, &tpm_session,
+            (TPMA_SESSION_decrypt | TPMA_SESSION_encrypt |
+             TPMA_SESSION_continueSession));
+}
+
+/* Remove the session from auth slot 1. The TPM nonce returned by the last
+ * command is kept, as the next use of the session has to start from it. */
+void tpm_ctx_session_detach(void)
+{
+    if (!tpm_session_ready)
+        return;
+    XMEMCPY(&tpm_session.nonceTPM, &tpm_dev.session[1].nonceTPM,
+            sizeof(tpm_session.nonceTPM));
+    wolfTPM2_UnsetAuth(&tpm_dev, 1);
+}
@@ -0,0 +1,61 @@
+/* tpm_ctx.h
+ *
+ * Persistent TPM context for the measured boot application: the TPM is
+ * initialized once, and the capabilities, attestation key and session are
+ * kept across operations.
+ *
+ * Copyright (C) 2021 wolfSSL Inc.
+ *
+ * This file is part of wolfBoot.
+ *
+ * wolfBoot is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfBoot is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+#ifndef TPM_CTX_H_INCLUDED
+#define TPM_CTX_H_INCLUDED
+
+#include "wolftpm/tpm2.h"
+#include "wolftpm/tpm2_wrap.h"
+
+/* Persistent handle for the attestation key (owner hierarchy range) */
+#ifndef TPM_CTX_AIK_HANDLE
+#define TPM_CTX_AIK_HANDLE 0x81000200
+#endif
+
+/* Persistent handle for the storage root key, parent of the attestation
+ * key and salt of the HMAC session */
+#ifndef TPM_CTX_SRK_HANDLE
+#define TPM_CTX_SRK_HANDLE 0x81000201
+#endif
+
+int tpm_ctx_init(void);
+WOLFTPM2_DEV *tpm_ctx_dev(void);
+const WOLFTPM2_CAPS *tpm_ctx_caps(void);
+int tpm_ctx_get_aik(WOLFTPM2_KEY **aik);
+int tpm_ctx_session(void);
+void tpm_ctx_session_detach(void);
+
+#ifdef TPM_TIMING
+/* Per-command latency statistics */
+void tpm_timing_start(void);
+void tpm_timing_end(const char *cmd);
+void tpm_timing_report(void);
+#else
+#define tpm_timing_start() do {} while(0)
+#define tpm_timing_end(cmd) do {} while(0)
+#define tpm_timing_report() do {} while(0)
+#endif
+
+#endif /* !TPM_CTX_H_INCLUDED */